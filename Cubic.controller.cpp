@@ -6,13 +6,276 @@
 
 namespace Cubic_controller
 {
-    Controller::Controller(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double target, bool direction, double capableDutyCycle, double current, bool logging)
-	 : motorNo(motorNo), encoderNo(encoderNo), encoderType(encoderType), CPR(CPR), capableDutyCycle(capableDutyCycle), direction(direction), logging(logging), pid(*(new PID::PID(capableDutyCycle, Kp, Ki, Kd, current, target, direction)))
+    template <class T>
+    Basic_Velocity_estimator<T>::Basic_Velocity_estimator(uint16_t CPR, velocityEstimator type, T bandwidth)
+        : CPR(CPR)
     {
+        setType(type, bandwidth);
     }
 
-    Velocity_PID::Velocity_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double target, bool direction, double capableDutyCycle, double p, bool logging)
-	 : Controller(motorNo, encoderNo, encoderType, CPR, Kp, Ki, Kd, target, direction, capableDutyCycle, 0.0, logging), p(p)
+    template <class T>
+    void Basic_Velocity_estimator<T>::setType(const velocityEstimator type, const T bandwidth)
+    {
+        this->type = type;
+        this->bandwidth = bandwidth;
+        // 減衰係数1の2次のループ
+        Kp = T(2) * bandwidth;
+        Ki = bandwidth * bandwidth;
+        windowMicros = bandwidth > T(0) ? (uint32_t)(1000000.0 / (double)bandwidth) : 0;
+        reset();
+    }
+
+    template <class T>
+    void Basic_Velocity_estimator<T>::reset()
+    {
+        started = false;
+        velocity = T(0);
+        phaseError = T(0);
+        integrator = T(0);
+        count = 0;
+    }
+
+    template <class T>
+    T Basic_Velocity_estimator<T>::update(const int32_t diff, const uint32_t timestamp)
+    {
+        if (!started)
+        {
+            // 初回は時刻だけ記録する
+            started = true;
+            preTimestamp = timestamp;
+            windowStart = timestamp;
+            return velocity;
+        }
+        if (timestamp == preTimestamp)
+        {
+            // 新しいデータを受信していない
+            return velocity;
+        }
+        if (type == velocityEstimator::pll)
+        {
+            updatePLL(diff, timestamp);
+        }
+        else if (type == velocityEstimator::mt)
+        {
+            updateMT(diff, timestamp);
+        }
+        preTimestamp = timestamp;
+        return velocity;
+    }
+
+    template <class T>
+    void Basic_Velocity_estimator<T>::updatePLL(const int32_t diff, const uint32_t timestamp)
+    {
+        const T dt = Scalar_traits<T>::from_micros(timestamp - preTimestamp);
+        // エンコーダとの偏差で推定した速度を修正し、推定した角度を進める
+        phaseError += Cubic_controller::encoderToAngle<T>(diff, CPR, T(0), false);
+        integrator += Ki * phaseError * dt;
+        phaseError -= (integrator + Kp * phaseError) * dt;
+        velocity = integrator;
+    }
+
+    template <class T>
+    void Basic_Velocity_estimator<T>::updateMT(const int32_t diff, const uint32_t timestamp)
+    {
+        count += diff;
+        const uint32_t elapsed = timestamp - windowStart;
+        if (count != 0)
+        {
+            // 最短の計測時間が経っていれば、前回カウントが変化した受信時刻からのカウント数で速度を求める
+            if (elapsed >= windowMicros)
+            {
+                velocity = Cubic_controller::encoderToAngle<T>(count, CPR, T(0), false) / Scalar_traits<T>::from_micros(elapsed);
+                count = 0;
+                windowStart = timestamp;
+            }
+        }
+        else if (elapsed > MT_TIMEOUT_MICROS)
+        {
+            velocity = T(0);
+            windowStart = timestamp;
+        }
+        else
+        {
+            // カウントが来ていないので、速さは1カウント/経過時間より小さい
+            const T bound = Cubic_controller::encoderToAngle<T>(1, CPR, T(0), false) / Scalar_traits<T>::from_micros(elapsed);
+            velocity = velocity > bound ? bound : (velocity < -bound ? -bound : velocity);
+        }
+    }
+
+    template <class T>
+    Basic_Trajectory<T>::Basic_Trajectory(const T velocityLimit, const T accelerationLimit, const T jerkLimit)
+    {
+        setLimits(velocityLimit, accelerationLimit, jerkLimit);
+        const double zero[SEGMENT_NUM] = {};
+        plan(zero, zero, zero, 0.0, 0.0);
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::setLimits(const T velocityLimit, const T accelerationLimit, const T jerkLimit)
+    {
+        this->velocityLimit = scalar_abs(velocityLimit);
+        this->accelerationLimit = scalar_abs(accelerationLimit);
+        this->jerkLimit = scalar_abs(jerkLimit);
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::moveTo(const T from, const T target)
+    {
+        const double V = (double)velocityLimit, A = (double)accelerationLimit, J = (double)jerkLimit;
+        const double sign = target < from ? -1.0 : 1.0;
+        const double D = fabs((double)target - (double)from);
+
+        // 加速、等速、減速の区間の長さ。S字では加速と減速の前後に躍度一定の区間Tjが付く
+        double Tj = 0.0, Ta = 0.0, Tv = 0.0, peak = 0.0;
+        if (D > 0.0 && V > 0.0 && A > 0.0)
+        {
+            // 到達する最高速度
+            double vp = V;
+            if (J <= 0.0)
+            {
+                vp = fmin(V, sqrt(D * A));
+            }
+            else
+            {
+                const double Tjv = fmin(A / J, sqrt(V / J));
+                if (D < V * (V / (J * Tjv) + Tjv))
+                {
+                    // 最高速度に届かない。加速度の上限に届くなら D = vp^2/A + vp*A/J
+                    const double Tja = A / J;
+                    vp = A * (sqrt(Tja * Tja + 4.0 * D / A) - Tja) / 2.0;
+                    if (vp < A * Tja)
+                    {
+                        // 加速度の上限にも届かない。D = 2*J*Tj^3
+                        const double t = cbrt(D / (2.0 * J));
+                        vp = J * t * t;
+                    }
+                }
+            }
+            Tj = J > 0.0 ? fmin(A / J, sqrt(vp / J)) : 0.0;
+            peak = J > 0.0 ? J * Tj : A;
+            Ta = fmax(0.0, vp / peak - Tj);
+            Tv = fmax(0.0, D / vp - (2.0 * Tj + Ta));
+        }
+        const double Jd = J > 0.0 ? sign * J : 0.0;
+        const double a = sign * peak;
+        const double duration[SEGMENT_NUM] = {Tj, Ta, Tj, Tv, Tj, Ta, Tj};
+        const double accel[SEGMENT_NUM] = {0.0, a, a, 0.0, 0.0, -a, -a};
+        const double jerk[SEGMENT_NUM] = {Jd, 0.0, -Jd, 0.0, -Jd, 0.0, Jd};
+        plan(duration, accel, jerk, (double)from, 0.0);
+        // 丸め誤差を残さず目標位置で止める
+        finalPosition = target;
+        finalVelocity = T(0);
+        sample(T(0));
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::rampTo(const T from, const T target)
+    {
+        const double A = (double)accelerationLimit, J = (double)jerkLimit;
+        const double sign = target < from ? -1.0 : 1.0;
+        const double dv = fabs((double)target - (double)from);
+
+        double Tj = 0.0, Ta = 0.0, peak = 0.0;
+        if (dv > 0.0 && A > 0.0)
+        {
+            Tj = J > 0.0 ? fmin(A / J, sqrt(dv / J)) : 0.0;
+            peak = J > 0.0 ? J * Tj : A;
+            Ta = fmax(0.0, dv / peak - Tj);
+        }
+        const double Jd = J > 0.0 ? sign * J : 0.0;
+        const double a = sign * peak;
+        const double duration[SEGMENT_NUM] = {Tj, Ta, Tj, 0.0, 0.0, 0.0, 0.0};
+        const double accel[SEGMENT_NUM] = {0.0, a, a, 0.0, 0.0, 0.0, 0.0};
+        const double jerk[SEGMENT_NUM] = {Jd, 0.0, -Jd, 0.0, 0.0, 0.0, 0.0};
+        plan(duration, accel, jerk, 0.0, (double)from);
+        finalVelocity = target;
+        sample(T(0));
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::plan(const double *duration, const double *acceleration, const double *jerk, double position, double velocity)
+    {
+        double time = 0.0;
+        for (int i = 0; i < SEGMENT_NUM; i++)
+        {
+            const double t = duration[i], a = acceleration[i], j = jerk[i];
+            startTime[i] = T(time);
+            startPosition[i] = T(position);
+            startVelocity[i] = T(velocity);
+            startAcceleration[i] = T(a);
+            this->jerk[i] = T(j);
+            position += t * (velocity + t * (a / 2.0 + t * j / 6.0));
+            velocity += t * (a + t * j / 2.0);
+            time += t;
+        }
+        startTime[SEGMENT_NUM] = T(time);
+        finalPosition = T(position);
+        finalVelocity = T(velocity);
+        segment = 0;
+        startMicros = Recorder::now();
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::update()
+    {
+        sample(Scalar_traits<T>::from_micros(Recorder::now() - startMicros));
+    }
+
+    template <class T>
+    void Basic_Trajectory<T>::sample(const T time)
+    {
+        finished = time >= startTime[SEGMENT_NUM];
+        if (finished)
+        {
+            // 終わった後は最後の速度で進む(moveTo()では静止)
+            position = finalPosition + finalVelocity * (time - startTime[SEGMENT_NUM]);
+            velocity = finalVelocity;
+            acceleration = T(0);
+            return;
+        }
+        // 時刻は普通増えていくので、区間は前から順に進めるだけでよい
+        if (time < startTime[segment])
+        {
+            segment = 0;
+        }
+        while (time >= startTime[segment + 1])
+        {
+            segment++;
+        }
+        const uint8_t i = segment;
+        const T t = time - startTime[i];
+        const T halfJerk = jerk[i] * T(0.5);
+        position = startPosition[i] + t * (startVelocity[i] + t * (startAcceleration[i] * T(0.5) + t * jerk[i] * T(1.0 / 6.0)));
+        velocity = startVelocity[i] + t * (startAcceleration[i] + t * halfJerk);
+        acceleration = startAcceleration[i] + t * jerk[i];
+    }
+
+    template <class T>
+    Basic_Controller<T>::Basic_Controller(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle, T current, bool logging)
+	 : motorNo(motorNo), encoderNo(encoderNo), encoderType(encoderType), CPR(CPR), capableDutyCycle(capableDutyCycle), dutyCycle(T(0)), direction(direction), logging(logging), pid(capableDutyCycle, Kp, Ki, Kd, current, target, direction)
+    {
+    }
+
+    template <class T>
+    void Basic_Controller<T>::updateFeedforward()
+    {
+        T output = kV * referenceVelocity + kA * referenceAcceleration + gravity;
+        if (referenceVelocity > deadband)
+        {
+            output += friction;
+        }
+        else if (referenceVelocity < -deadband)
+        {
+            output -= friction;
+        }
+        feedforward = output;
+        // PIDの出力はdirectionに合わせて符号が反転しているので、同じ向きにする
+        pid.setFeedforward(direction ? output : -output);
+    }
+
+    template <class T>
+    Basic_Velocity_PID<T>::Basic_Velocity_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle, T p, bool logging)
+	 : Basic_Controller<T>(motorNo, encoderNo, encoderType, CPR, Kp, Ki, Kd, target, direction, capableDutyCycle, T(0), logging), p(p), estimator(CPR, velocityEstimator::lpf)
     {
         if (encoderType == encoderType::abs)
         {
@@ -20,113 +283,613 @@ namespace Cubic_controller
         }
     }
 
-    double Velocity_PID::compute()
+    template <class T>
+    T Basic_Velocity_PID<T>::compute()
     {
+        Profile_scope profile(ProfilePhase::COMPUTE + this->motorNo);
         int32_t encoder = this->readEncoder();
-        double angle = this->encoderToAngle(encoder);
-        double velocity = angle / this->getDt();
-        // low-pass filter
-        vLPF = vLPF * (1.0 - p) + velocity * p;
-        if (logging)
+        if (estimator.getType() == velocityEstimator::lpf)
         {
-            Serial.print("angle:");
-            Serial.print(angle, 4);
-            Serial.print(",");
+            T angle = this->encoderToAngle(encoder);
+            // 初回はdtがまだ無いので速度を0とする
+            T velocity = this->getDt() > T(0) ? angle / this->getDt() : T(0);
+            // low-pass filter
+            vLPF = vLPF * (T(1) - p) + velocity * p;
         }
-        double dutyCycle = this->compute_PID(vLPF);
-        if (logging)
+        else
         {
-            Serial.print("dutyCycle:");
-            Serial.println(dutyCycle);
+            vLPF = estimator.update(encoder, Inc_enc::snapshot().timestamp);
         }
-        DC_motor::put(motorNo, dutyCycle * DUTY_SPI_MAX, DUTY_SPI_MAX);
+        T dutyCycle = this->compute_PID(vLPF);
+        this->log(encoder);
+        DC_motor::put(this->motorNo, (int)(dutyCycle * T(DUTY_SPI_MAX)), DUTY_SPI_MAX);
         return dutyCycle;
     }
 
-    Position_PID::Position_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double targetAngle, bool direction, double capableDutyCycle, bool logging)
-	 : Controller(motorNo, encoderNo, encoderType, CPR, Kp, Ki, Kd, targetAngle, direction, capableDutyCycle, this->encoderToAngle(this->readEncoder()), logging)
+    template <class T>
+    void Basic_Velocity_PID<T>::setTarget(const T target)
+    {
+        Basic_Controller<T>::setTarget(target);
+        this->setReference(target, this->referenceAcceleration);
+    }
+
+    namespace
+    {
+        // 起動時の角度。基底クラスの構築前に呼ぶので、メンバではなく引数だけから求める。
+        // エンコーダを読めなかったときはControllerGroupと同じく0とする
+        template <class T>
+        T initialAngle(const int32_t encoder, const uint16_t CPR)
+        {
+            if (encoder < 0 || encoder > ABS_ENC_MAX)
+            {
+                return T(0);
+            }
+            return Cubic_controller::encoderToAngle<T>(encoder, CPR, T(-PI), true);
+        }
+    }
+
+    template <class T>
+    Basic_Position_PID<T>::Basic_Position_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T targetAngle, bool direction, T capableDutyCycle, bool logging)
+	 : Basic_Controller<T>(motorNo, encoderNo, encoderType, CPR, Kp, Ki, Kd, targetAngle, direction, capableDutyCycle, initialAngle<T>(Abs_enc::get(encoderNo), CPR), logging),
+      turnOffset(Abs_enc::turn(encoderNo).turns())
     {
         if (encoderType == encoderType::inc)
         {
             Serial.println("ERROR!! Incremental encoder can't be used for position PID.");
         }
-        double currentAngle = this->getCurrent();
+        T currentAngle = this->getCurrent();
         if (logging)
         {
             Serial.print("current angle:");
-            Serial.print(currentAngle);
+            Serial.print((double)currentAngle);
             Serial.print(",");
         }
     }
 
-    double Position_PID::compute()
+    template <class T>
+    T Basic_Position_PID<T>::compute()
     {
+        Profile_scope profile(ProfilePhase::COMPUTE + this->motorNo);
         int32_t encoder = this->readEncoder();
-        static double dutyCycle = 0.0;
+        // エンコーダを読めなかったときは前回のデューティ比を出し続ける
+        T dutyCycle = this->getDutyCycle();
+        uint8_t flags = 0;
         if (encoder == ABS_ENC_ERR_RP2040)
         { // RP2040でエンコーダを正しく読めなかったとき e.g.)エンコーダが繋がっていない・線材の接触不良
-            if (logging)
-            {
-                Serial.print("ERROR: ABS_ENC_ERR_RP2040. Skipping this loop.");
-            }
+            flags = TelemetryFlag::ABS_ENC_ERR_RP2040;
         }
         else if (encoder == ABS_ENC_ERR)
         { // ArduinoとRP2040間のSPI通信でバグがある，または引数が間違っている
-            if (logging)
-            {
-                Serial.print("ERROR: ABS_ENC_ERR. Skipping this loop.");
-            }
+            flags = TelemetryFlag::ABS_ENC_ERR;
         }
         else if (encoder > ABS_ENC_MAX)
         { // エンコーダの値が異常
-            if (logging)
+            flags = TelemetryFlag::ABS_ENC_RANGE;
+        }
+        else
+        {
+            T currentAngle = this->encoderToAngle(encoder);
+            dutyCycle = this->compute_PID(currentAngle);
+        }
+        this->log(encoder, flags);
+        DC_motor::put(this->motorNo, (int)(dutyCycle * T(DUTY_SPI_MAX)), DUTY_SPI_MAX);
+        return dutyCycle;
+    }
+
+    template <class T>
+    void Basic_Position_PID<T>::setTarget(const T target)
+    {
+        Basic_Controller<T>::setTarget(nearestTarget<T>(target, this->getCurrent()));
+    }
+
+    template <class T>
+    int Basic_ControllerGroup<T>::add(const Mode mode, const uint8_t motorNo, const uint8_t encoderNo, const uint16_t CPR, const T Kp, const T Ki, const T Kd, const T target, const bool direction, const T capableDutyCycle, const T p)
+    {
+        if (num >= CONTROLLER_GROUP_MAX)
+        {
+            return -1;
+        }
+        const int i = num++;
+        this->mode[i] = mode;
+        this->motorNo[i] = motorNo;
+        this->encoderNo[i] = encoderNo;
+        this->CPR[i] = CPR;
+        this->sign[i] = direction ? T(1) : T(-1);
+        this->capableDutyCycle[i] = capableDutyCycle;
+        this->Kp[i] = scalar_abs(Kp);
+        this->Ki[i] = scalar_abs(Ki);
+        this->Kd[i] = scalar_abs(Kd);
+        this->p[i] = p;
+        this->target[i] = target;
+        this->dutyCycle[i] = T(0);
+        this->turnOffset[i] = 0;
+        this->current[i] = T(0);
+        if (mode == Mode::position)
+        {
+            this->turnOffset[i] = Abs_enc::turn(encoderNo).turns();
+            const int32_t encoder = Abs_enc::get(encoderNo);
+            if (encoder >= 0 && encoder <= ABS_ENC_MAX)
             {
-                Serial.print("ERROR: encoder > ABS_ENC_MAX. Skipping this loop.");
+                this->current[i] = Cubic_controller::encoderToAngle<T>(encoder, CPR, T(-PI), true);
             }
         }
+        reset(i);
+        return i;
+    }
+
+    template <class T>
+    int Basic_ControllerGroup<T>::addVelocity(const uint8_t motorNo, const uint8_t encoderNo, const uint16_t CPR, const T Kp, const T Ki, const T Kd, const T target, const bool direction, const T capableDutyCycle, const T p)
+    {
+        return add(Mode::velocity, motorNo, encoderNo, CPR, Kp, Ki, Kd, target, direction, capableDutyCycle, p);
+    }
+
+    template <class T>
+    int Basic_ControllerGroup<T>::addPosition(const uint8_t motorNo, const uint8_t encoderNo, const uint16_t CPR, const T Kp, const T Ki, const T Kd, const T target, const bool direction, const T capableDutyCycle)
+    {
+        return add(Mode::position, motorNo, encoderNo, CPR, Kp, Ki, Kd, target, direction, capableDutyCycle, T(1));
+    }
+
+    template <class T>
+    void Basic_ControllerGroup<T>::setTarget(const uint8_t axis, const T target)
+    {
+        if (axis >= num)
+        {
+            return;
+        }
+        this->target[axis] = mode[axis] == Mode::position ? nearestTarget<T>(target, current[axis]) : target;
+    }
+
+    template <class T>
+    void Basic_ControllerGroup<T>::reset(const uint8_t axis)
+    {
+        if (axis >= num)
+        {
+            return;
+        }
+        diff[axis] = T(0);
+        preDiff[axis] = T(0);
+        integral[axis] = T(0);
+        if (mode[axis] == Mode::velocity)
+        {
+            current[axis] = T(0);
+        }
+    }
+
+    template <class T>
+    void Basic_ControllerGroup<T>::reset()
+    {
+        for (int i = 0; i < num; i++)
+        {
+            reset(i);
+        }
+        preMicros = Recorder::now();
+        started = true;
+    }
+
+    template <class T>
+    void Basic_ControllerGroup<T>::compute()
+    {
+        const uint32_t nowMicros = Recorder::now();
+        if (!started)
+        {
+            // 初回はdtが分からないので、時刻だけ記録する
+            preMicros = nowMicros;
+            started = true;
+            return;
+        }
+        dt = Scalar_traits<T>::from_micros(nowMicros - preMicros);
+        preMicros = nowMicros;
+        if (dt <= T(0))
+        {
+            return;
+        }
+        const T halfDt = dt * T(0.5);
+        const T invDt = T(1) / dt;
+
+        // 各軸の制御量
+        uint8_t flags[CONTROLLER_GROUP_MAX];
+        for (int i = 0; i < num; i++)
+        {
+            flags[i] = 0;
+            if (mode[i] == Mode::velocity)
+            {
+                encoder[i] = Inc_enc::get_diff(encoderNo[i]);
+                const T velocity = Cubic_controller::encoderToAngle<T>(encoder[i], CPR[i], T(0), false) * invDt;
+                current[i] = current[i] * (T(1) - p[i]) + velocity * p[i];
+                continue;
+            }
+
+            encoder[i] = Abs_enc::get(encoderNo[i]);
+            if (encoder[i] == ABS_ENC_ERR_RP2040)
+            {
+                flags[i] = TelemetryFlag::ABS_ENC_ERR_RP2040;
+            }
+            else if (encoder[i] == ABS_ENC_ERR)
+            {
+                flags[i] = TelemetryFlag::ABS_ENC_ERR;
+            }
+            else if (encoder[i] > ABS_ENC_MAX)
+            {
+                flags[i] = TelemetryFlag::ABS_ENC_RANGE;
+            }
+            else
+            {
+                current[i] = Cubic_controller::encoderToAngle<T>(encoder[i], CPR[i], T(-PI), false) + T(TWO_PI) * T(Abs_enc::turn(encoderNo[i]).turns() - turnOffset[i]);
+            }
+        }
+
+        // PID。分岐を持たないので、すべての軸をまとめて計算できる
+        int16_t duty[CONTROLLER_GROUP_MAX];
+        for (int i = 0; i < num; i++)
+        {
+            const bool valid = flags[i] == 0;
+            const T d = (target[i] - current[i]) * sign[i];
+            const T step = (d + preDiff[i]) * halfDt;
+            const T u = Kp[i] * d + Ki[i] * (integral[i] + step) + Kd[i] * (d - preDiff[i]) * invDt;
+            const T limited = u > capableDutyCycle[i] ? capableDutyCycle[i] : (u < -capableDutyCycle[i] ? -capableDutyCycle[i] : u);
+            // 出力が飽和したら積分しない
+            integral[i] += (valid && limited == u) ? step : T(0);
+            diff[i] = valid ? d : diff[i];
+            preDiff[i] = valid ? d : preDiff[i];
+            dutyCycle[i] = valid ? limited : dutyCycle[i];
+            duty[i] = (int)(dutyCycle[i] * T(DUTY_SPI_MAX));
+        }
+
+        DC_motor::put(motorNo, duty, num);
+
+        if (logging)
+        {
+            for (int i = 0; i < num; i++)
+            {
+                Telemetry_record record;
+                record.timestamp = nowMicros;
+                record.motorNo = motorNo[i];
+                record.flags = flags[i];
+                record.reserved = 0;
+                record.encoder = encoder[i];
+                record.current = (float)current[i];
+                record.target = (float)target[i];
+                record.diff = (float)diff[i];
+                record.integral = (float)integral[i];
+                record.duty = (float)dutyCycle[i];
+                record.dt = (float)dt;
+                Telemetry::push(record);
+            }
+        }
+    }
+
+    template <class T>
+    Basic_Cascade_controller<T>::Basic_Cascade_controller(uint8_t motorNo, uint8_t encoderNo, enum encoderType encoderType, uint16_t CPR, bool direction, T capableDutyCycle, T velocityLimit, T currentLimit, bool logging)
+        : motorNo(motorNo), encoderNo(encoderNo), encoderType(encoderType), CPR(CPR), logging(logging),
+          positionPID(velocityLimit, T(0), T(0), T(0), T(0), T(0), true),
+          velocityPID(currentLimit, T(0), T(0), T(0), T(0), T(0), direction),
+          currentPID(capableDutyCycle, T(0), T(0), T(0), T(0), T(0), true),
+          estimator(CPR)
+    {
+        if (encoderType == encoderType::abs)
+        {
+            turnOffset = Abs_enc::turn(encoderNo).turns();
+            counts = absCounts(encoderNo, CPR, turnOffset);
+        }
+        position = countsToAngle(counts);
+        positionPID.setTarget(position);
+    }
+
+    template <class T>
+    T Basic_Cascade_controller<T>::countsToAngle(const int64_t counts) const
+    {
+        // 1回転未満と回転数に分けて、固定小数点数でも桁あふれしないようにする
+        const T offset = encoderType == encoderType::abs ? T(-PI) : T(0);
+        return Cubic_controller::encoderToAngle<T>((int32_t)(counts % CPR), CPR, offset, false) + T(TWO_PI) * T((int32_t)(counts / CPR));
+    }
+
+    template <class T>
+    T Basic_Cascade_controller<T>::compute()
+    {
+        Profile_scope profile(ProfilePhase::COMPUTE + motorNo);
+
+        // 位置と速度は毎回更新する
+        int32_t encoder;
+        int32_t diff = 0;
+        uint32_t timestamp;
+        uint8_t flags = 0;
+        if (encoderType == encoderType::inc)
+        {
+            encoder = diff = Inc_enc::get_diff(encoderNo);
+            timestamp = Inc_enc::snapshot().timestamp;
+        }
         else
         {
-            double currentAngle = this->encoderToAngle(encoder);
-            if (logging)
+            encoder = Abs_enc::get(encoderNo);
+            timestamp = Abs_enc::snapshot().timestamp;
+            if (encoder == ABS_ENC_ERR_RP2040)
+            {
+                flags = TelemetryFlag::ABS_ENC_ERR_RP2040;
+            }
+            else if (encoder == ABS_ENC_ERR)
+            {
+                flags = TelemetryFlag::ABS_ENC_ERR;
+            }
+            else if (encoder > ABS_ENC_MAX)
             {
-                // Serial.print("actual angle:");
-                // Serial.print(actualAngle);
-                // Serial.print(",");
-                Serial.print("loopCount:");
-                Serial.print(loopCount);
-                Serial.print(",");
+                flags = TelemetryFlag::ABS_ENC_RANGE;
             }
+            else
+            {
+                diff = (int32_t)(absCounts(encoderNo, CPR, turnOffset) - counts);
+            }
+        }
+        counts += diff;
+        position = countsToAngle(counts);
+        const T velocity = estimator.update(diff, timestamp);
+        current = T(Adc::get(motorNo));
 
-            dutyCycle = this->compute_PID(currentAngle);
+        // 外側のループほど間引いて計算し、その出力を内側のループの目標値にする
+        const uint16_t positionPeriod = (uint16_t)currentPerVelocity * velocityPerPosition;
+        if (mode == cascadeMode::position && tick % positionPeriod == 0)
+        {
+            velocityPID.setTarget(positionPID.compute_PID(position));
+        }
+        if (mode != cascadeMode::current && tick % currentPerVelocity == 0)
+        {
+            currentPID.setTarget(velocityPID.compute_PID(velocity));
         }
+        dutyCycle = currentPID.compute_PID(current);
+        tick = (tick + 1) % positionPeriod;
+
         if (logging)
         {
-            Serial.print("dutyCycle:");
-            Serial.println(dutyCycle);
+            const PID::Basic_PID<T> &outer = mode == cascadeMode::position ? positionPID : (mode == cascadeMode::velocity ? velocityPID : currentPID);
+            Telemetry_record record;
+            record.timestamp = micros();
+            record.motorNo = motorNo;
+            record.flags = flags;
+            record.reserved = 0;
+            record.encoder = encoder;
+            record.current = (float)outer.getCurrent();
+            record.target = (float)outer.getTarget();
+            record.diff = (float)outer.getDiff();
+            record.integral = (float)outer.getIntegral();
+            record.duty = (float)dutyCycle;
+            record.dt = (float)currentPID.dt;
+            Telemetry::push(record);
         }
-        DC_motor::put(motorNo, dutyCycle * DUTY_SPI_MAX, DUTY_SPI_MAX);
+        DC_motor::put(motorNo, (int)(dutyCycle * T(DUTY_SPI_MAX)), DUTY_SPI_MAX);
         return dutyCycle;
     }
 
-    void Position_PID::setTarget(double target)
+    template <class T>
+    void Basic_Cascade_controller<T>::setMode(const cascadeMode mode)
     {
-        double currentAngle = this->getCurrent();
-        if (currentAngle > ALLOWED_ROTATION_RANGE)
+        this->mode = mode;
+        reset();
+        // 切り替えた直後に跳ばないように、新しい外側のループの目標値は今の位置・停止・電流0にする
+        positionPID.setTarget(position);
+        velocityPID.setTarget(T(0));
+        currentPID.setTarget(T(0));
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setTarget(const T target)
+    {
+        if (mode == cascadeMode::position)
         {
-            target += TWO_PI * (int)((ALLOWED_ROTATION_RANGE - target) / TWO_PI);
+            positionPID.setTarget(target);
         }
-        else if (currentAngle < -ALLOWED_ROTATION_RANGE)
+        else if (mode == cascadeMode::velocity)
         {
-            target -= TWO_PI * (int)((target + ALLOWED_ROTATION_RANGE) / TWO_PI);
+            velocityPID.setTarget(target);
         }
         else
         {
-            target += TWO_PI * (int)((currentAngle - target) / TWO_PI);
-            if (target - currentAngle > PI && target - TWO_PI >= -ALLOWED_ROTATION_RANGE)
-                target -= TWO_PI;
-            else if (currentAngle - target > PI && target + TWO_PI <= ALLOWED_ROTATION_RANGE)
-                target += TWO_PI;
+            currentPID.setTarget(target);
         }
-        Controller::setTarget(target);
     }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setPositionGains(const T Kp, const T Ki, const T Kd)
+    {
+        positionPID.setGains(scalar_abs(Kp), scalar_abs(Ki), scalar_abs(Kd));
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setVelocityGains(const T Kp, const T Ki, const T Kd)
+    {
+        velocityPID.setGains(scalar_abs(Kp), scalar_abs(Ki), scalar_abs(Kd));
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setCurrentGains(const T Kp, const T Ki, const T Kd)
+    {
+        currentPID.setGains(scalar_abs(Kp), scalar_abs(Ki), scalar_abs(Kd));
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setLimits(const T velocityLimit, const T currentLimit)
+    {
+        positionPID.setCapableDutyCycle(scalar_abs(velocityLimit));
+        velocityPID.setCapableDutyCycle(scalar_abs(currentLimit));
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setRatios(const uint8_t currentPerVelocity, const uint8_t velocityPerPosition)
+    {
+        this->currentPerVelocity = currentPerVelocity > 0 ? currentPerVelocity : 1;
+        this->velocityPerPosition = velocityPerPosition > 0 ? velocityPerPosition : 1;
+        tick = 0;
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::setVelocityEstimator(const velocityEstimator type, const T bandwidth)
+    {
+        estimator.setType(type == velocityEstimator::lpf ? velocityEstimator::pll : type, bandwidth);
+    }
+
+    template <class T>
+    void Basic_Cascade_controller<T>::reset()
+    {
+        positionPID.reset();
+        velocityPID.reset();
+        currentPID.reset();
+        estimator.reset();
+        dutyCycle = T(0);
+        tick = 0;
+    }
+
+    template <class T>
+    Basic_Relay_autotune<T>::Basic_Relay_autotune(uint8_t motorNo, uint8_t encoderNo, enum encoderType encoderType, uint16_t CPR, bool direction, T relayDutyCycle, T setpoint, T hysteresis, uint8_t cycles)
+        : motorNo(motorNo), encoderNo(encoderNo), encoderType(encoderType), CPR(CPR), direction(direction),
+          relayDutyCycle(scalar_abs(relayDutyCycle)), setpoint(setpoint), hysteresis(scalar_abs(hysteresis)), cycles(cycles > 0 ? cycles : 1),
+          estimator(CPR, velocityEstimator::lpf)
+    {
+        if (encoderType == encoderType::abs)
+        {
+            turnOffset = Abs_enc::turn(encoderNo).turns();
+            counts = absCounts(encoderNo, CPR, turnOffset);
+            current = Cubic_controller::encoderToAngle<T>((int32_t)(counts % CPR), CPR, T(-PI), false) + T(TWO_PI) * T((int32_t)(counts / CPR));
+        }
+        reset();
+    }
+
+    template <class T>
+    void Basic_Relay_autotune<T>::reset()
+    {
+        estimator.reset();
+        preMicros = Recorder::now();
+        high = true;
+        dutyCycle = T(0);
+        finished = false;
+        peakHigh = peakLow = current;
+        cycleStart = preMicros;
+        cycle = 0;
+        amplitudeSum = periodSum = 0.0;
+        ultimateGain = ultimatePeriod = amplitude = T(0);
+    }
+
+    template <class T>
+    void Basic_Relay_autotune<T>::setVelocityEstimator(const velocityEstimator type, const T bandwidth)
+    {
+        estimator.setType(type, bandwidth);
+    }
+
+    template <class T>
+    void Basic_Relay_autotune<T>::setLPF(const T p)
+    {
+        this->p = p;
+    }
+
+    template <class T>
+    void Basic_Relay_autotune<T>::measure()
+    {
+        const uint32_t now = Recorder::now();
+        const T dt = Scalar_traits<T>::from_micros(now - preMicros);
+        preMicros = now;
+        if (encoderType == encoderType::inc)
+        {
+            const int32_t diff = Inc_enc::get_diff(encoderNo);
+            if (estimator.getType() == velocityEstimator::lpf)
+            {
+                const T velocity = dt > T(0) ? Cubic_controller::encoderToAngle<T>(diff, CPR, T(0), false) / dt : T(0);
+                current = current * (T(1) - p) + velocity * p;
+            }
+            else
+            {
+                current = estimator.update(diff, Inc_enc::snapshot().timestamp);
+            }
+        }
+        else
+        {
+            // 読めなかったときはAbs_encの回転数も進まないので、前の角度のままになる
+            counts = absCounts(encoderNo, CPR, turnOffset);
+            current = Cubic_controller::encoderToAngle<T>((int32_t)(counts % CPR), CPR, T(-PI), false) + T(TWO_PI) * T((int32_t)(counts / CPR));
+        }
+    }
+
+    template <class T>
+    bool Basic_Relay_autotune<T>::compute()
+    {
+        Profile_scope profile(ProfilePhase::COMPUTE + motorNo);
+        measure();
+        if (!finished)
+        {
+            peakHigh = current > peakHigh ? current : peakHigh;
+            peakLow = current < peakLow ? current : peakLow;
+            if (high && current > setpoint + hysteresis)
+            {
+                high = false;
+            }
+            else if (!high && current < setpoint - hysteresis)
+            {
+                // 出力を正にしてから次に正にするまでを1周期とする。最初の半端な周期と次の1周期は捨てる
+                high = true;
+                const uint32_t now = Recorder::now();
+                if (++cycle > 2)
+                {
+                    amplitudeSum += ((double)peakHigh - (double)peakLow) / 2.0;
+                    periodSum += (now - cycleStart) * 1e-6;
+                }
+                cycleStart = now;
+                peakHigh = peakLow = current;
+                if (cycle >= cycles + 2)
+                {
+                    const double a = amplitudeSum / cycles;
+                    const double h = (double)hysteresis;
+                    const double d = (double)relayDutyCycle;
+                    // 記述関数法。ヒステリシスの分だけ位相が遅れたリレーとみなす
+                    const double denominator = a > h ? sqrt(a * a - h * h) : a;
+                    amplitude = T(a);
+                    ultimatePeriod = T(periodSum / cycles);
+                    ultimateGain = denominator > 0.0 ? T(4.0 * d / (PI * denominator)) : T(0);
+                    finished = true;
+                }
+            }
+        }
+        const T relay = finished ? T(0) : (high ? relayDutyCycle : -relayDutyCycle);
+        dutyCycle = direction ? relay : -relay;
+        DC_motor::put(motorNo, (int)(dutyCycle * T(DUTY_SPI_MAX)), DUTY_SPI_MAX);
+        return finished;
+    }
+
+    template <class T>
+    void Basic_Relay_autotune<T>::getGains(T &Kp, T &Ki, T &Kd) const
+    {
+        Kp = T(0.6) * ultimateGain;
+        Ki = ultimatePeriod > T(0) ? T(1.2) * ultimateGain / ultimatePeriod : T(0);
+        Kd = T(0.075) * ultimateGain * ultimatePeriod;
+    }
+
+    template class Basic_Controller<double>;
+    template class Basic_Velocity_PID<double>;
+    template class Basic_Position_PID<double>;
+    template class Basic_ControllerGroup<double>;
+    template class Basic_Velocity_estimator<double>;
+    template class Basic_Cascade_controller<double>;
+    template class Basic_Trajectory<double>;
+    template class Basic_Relay_autotune<double>;
+    template class Basic_Controller<float>;
+    template class Basic_Velocity_PID<float>;
+    template class Basic_Position_PID<float>;
+    template class Basic_ControllerGroup<float>;
+    template class Basic_Velocity_estimator<float>;
+    template class Basic_Cascade_controller<float>;
+    template class Basic_Trajectory<float>;
+    template class Basic_Relay_autotune<float>;
+    template class Basic_Controller<Q16_16>;
+    template class Basic_Velocity_PID<Q16_16>;
+    template class Basic_Position_PID<Q16_16>;
+    template class Basic_ControllerGroup<Q16_16>;
+    template class Basic_Velocity_estimator<Q16_16>;
+    template class Basic_Cascade_controller<Q16_16>;
+    template class Basic_Trajectory<Q16_16>;
+    template class Basic_Relay_autotune<Q16_16>;
+#ifdef CUBIC_HAS_Q32_32
+    template class Basic_Controller<Q32_32>;
+    template class Basic_Velocity_PID<Q32_32>;
+    template class Basic_Position_PID<Q32_32>;
+    template class Basic_ControllerGroup<Q32_32>;
+    template class Basic_Velocity_estimator<Q32_32>;
+    template class Basic_Cascade_controller<Q32_32>;
+    template class Basic_Trajectory<Q32_32>;
+    template class Basic_Relay_autotune<Q32_32>;
+#endif
 }
\ No newline at end of file
@@ -5,7 +5,14 @@
 #pragma once
 #include <Arduino.h>
 #include "PID.h"
+#include "cubic_scalar.h"
 #include "cubic_arduino.h"
+#include "cubic_profiler.h"
+#include "cubic_telemetry.h"
+#include "cubic_multiturn.h"
+#include <new>
+#include <type_traits>
+#include <utility>
 
 /**
  * @brief 度数法から弧度法に変換します
@@ -40,6 +47,9 @@ namespace Cubic_controller
     /// @brief アブソリュートエンコーダのループ閾値
     constexpr double LOOP_THRESHOLD = 5.0 * PI / 6.0;
 
+    /// @brief M/T法で、カウントが来ないまま経過したら速度を0とする時間[us]
+    constexpr uint32_t MT_TIMEOUT_MICROS = 1000000;
+
     /**
      * @brief アブソリュートエンコーダーの回転をどこまで許容するか。
      * @details [-ALLOWED_ROTATION_RANGE, ALLOWED_ROTATION_RANGE]の範囲で許容する。
@@ -61,19 +71,21 @@ namespace Cubic_controller
     /**
      * @brief 与えられた角度を一定範囲（min<=angle<min+2pi）に収めます
      *
+     * @tparam T 数値型。省略可能で、デフォルトはdouble
      * @param angle 角度[rad]
      * @param min 最低値[rad]。省略可能で、デフォルトは-PI
-     * @return constexpr double 角度[rad](-PI<= angle < PI)
+     * @return constexpr T 角度[rad](-PI<= angle < PI)
      */
-    constexpr double limitAngle(double angle, const double min = -PI)
+    template <class T = double>
+    constexpr T limitAngle(T angle, const typename std::common_type<T>::type min = T(-PI))
     {
         while (angle < min)
         {
-            angle += TWO_PI;
+            angle += T(TWO_PI);
         }
-        while (angle >= min + TWO_PI)
+        while (angle >= min + T(TWO_PI))
         {
-            angle -= TWO_PI;
+            angle -= T(TWO_PI);
         }
         return angle;
     }
@@ -81,35 +93,313 @@ namespace Cubic_controller
     /**
      * @brief 与えられたCPRのもと、エンコーダの値から角度を計算します
      *
+     * @tparam T 数値型。省略可能で、デフォルトはdouble
      * @param encoder エンコーダの値
      * @param CPR counts per revolution(PPRの4倍)
      * @param offset オフセット[rad]。省略可能で、デフォルトは-PI
      * @param limit 角度を一定範囲に収めるかどうか。省略可能で、デフォルトはtrue
-     * @return constexpr double angle[rad](-PI<= angle < PI)
+     * @return constexpr T angle[rad](-PI<= angle < PI)
+     */
+    template <class T = double>
+    constexpr T encoderToAngle(const int32_t encoder, const uint16_t CPR, const typename std::common_type<T>::type offset = T(-PI), const bool limit = true)
+    {
+        T angle = offset;
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            angle += encoder * (T(TWO_PI) / T(CPR));
+        }
+        else
+        {
+            // 固定小数点数では、1カウントあたりの角度は分解能が足りないので、回転数にしてから角度にする
+            angle += T(encoder) / T(CPR) * T(TWO_PI);
+        }
+        return limit ? limitAngle<T>(angle) : angle;
+    }
+
+    /**
+     * @brief アブソリュートエンコーダの累積位置[カウント]を、回転数がturnOffsetだったときを0回転目として返します
+     * @details 回転数はAbs_enc::turn()がエンコーダごとに毎周期数えているので、ここでは読むだけです。
+     *
+     * @param encoderNo エンコーダ番号
+     * @param CPR counts per revolution
+     * @param turnOffset 基準の回転数(制御器を作ったときのAbs_enc::turn().turns())
+     * @return int64_t 累積位置[カウント]
+     */
+    inline int64_t absCounts(const uint8_t encoderNo, const uint16_t CPR, const int32_t turnOffset)
+    {
+        const Multi_turn &turn = Abs_enc::turn(encoderNo);
+        return (int64_t)(turn.turns() - turnOffset) * CPR + turn.count();
+    }
+
+    /**
+     * @brief 目標角度を、現在の角度から近い向きに回るように2PIの倍数だけずらします
+     * @details 結果は[-ALLOWED_ROTATION_RANGE, ALLOWED_ROTATION_RANGE]の範囲に収まるようにします。
+     *
+     * @param target 目標角度[rad]
+     * @param currentAngle 現在の角度[rad]
+     * @return T 目標角度[rad]
      */
-    constexpr double encoderToAngle(const int32_t encoder, const uint16_t CPR, const double offset = -PI, const bool limit = true)
+    template <class T>
+    T nearestTarget(T target, const T currentAngle)
     {
-        if (limit)
+        const T range = T(ALLOWED_ROTATION_RANGE);
+        if (currentAngle > range)
+        {
+            target += T(TWO_PI) * T((int)((range - target) / T(TWO_PI)));
+        }
+        else if (currentAngle < -range)
         {
-            return limitAngle(offset + encoder * (TWO_PI / (double)CPR));
+            target -= T(TWO_PI) * T((int)((target + range) / T(TWO_PI)));
         }
         else
         {
-            return offset + encoder * (TWO_PI / (double)CPR);
+            target += T(TWO_PI) * T((int)((currentAngle - target) / T(TWO_PI)));
+            if (target - currentAngle > T(PI) && target - T(TWO_PI) >= -range)
+                target -= T(TWO_PI);
+            else if (currentAngle - target > T(PI) && target + T(TWO_PI) <= range)
+                target += T(TWO_PI);
         }
+        return target;
     }
 
+    /**
+     * @brief 速度の推定方法を示します
+     *
+     * @details lpf: 差分/dtにローパスフィルタ, pll: PLL(追従オブザーバ), mt: M/T法
+     *
+     */
+    enum class velocityEstimator
+    {
+        lpf,
+        pll,
+        mt
+    };
+
+    /**
+     * @brief インクリメンタルエンコーダの差分値と受信時刻から角速度を推定するクラス
+     * @details エンコーダのチャンネルごとに1つ持たせます。
+     * - pll: 角度の推定値をエンコーダに2次のループで追従させ、その速度を推定値とします。帯域幅より上の量子化の雑音を2次で落とし、一定速度では遅れません。
+     * - mt: エンコーダが変化した受信時刻の間の時間で、その間のカウント数を割ります。低速でも1カウントの量子化が速度に乗りません。カウントが来ない間は、1カウント/経過時間 を上限にして0に近づけます。高速ではフィルタをかけない差分/dtと同じになるので、低速の軸に向いています。
+     *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
+     */
+    template <class T>
+    class Basic_Velocity_estimator
+    {
+    public:
+        /**
+         * @brief Construct a new Velocity_estimator object
+         *
+         * @param CPR エンコーダのCPR
+         * @param type 推定方法。lpfを与えた場合は何もしません。
+         * @param bandwidth 帯域幅[rad/s]。pllではループの固有角周波数、mtでは1/bandwidth[s]を最短の計測時間とします。pllでは速度制御の応答より十分高く、1/(4*周期)程度までにしてください。
+         */
+        Basic_Velocity_estimator(uint16_t CPR, velocityEstimator type = velocityEstimator::pll, T bandwidth = T(50));
+
+        /**
+         * @brief 推定方法と帯域幅を設定し、推定値をリセットします。
+         *
+         * @param type
+         * @param bandwidth 帯域幅[rad/s]
+         */
+        void setType(velocityEstimator type, T bandwidth);
+        /**
+         * @brief 推定値を0にし、次のupdate()から推定し直します。
+         */
+        void reset();
+        /**
+         * @brief 1周期分の差分値を与え、角速度を推定します。
+         *
+         * @param diff エンコーダの差分値(Inc_enc::get_diff())
+         * @param timestamp 差分値を受信した時刻[us](Inc_enc::snapshot().timestamp)
+         * @return T 角速度[rad/s]。最初の呼び出しでは0。
+         */
+        T update(int32_t diff, uint32_t timestamp);
+        /**
+         * @brief 直前のupdate()で推定した角速度を返します。
+         *
+         * @return T 角速度[rad/s]
+         */
+        T get() const;
+        /**
+         * @brief 推定方法を返します。
+         *
+         * @return velocityEstimator
+         */
+        velocityEstimator getType() const;
+
+    private:
+        const uint16_t CPR;
+        velocityEstimator type;
+        T bandwidth;
+        bool started = false;
+        uint32_t preTimestamp = 0;
+        T velocity = T(0);
+
+        // pll: 角度の偏差(エンコーダ - 推定値)[rad]、積分器(定常の速度)と、ループのゲイン
+        T phaseError = T(0);
+        T integrator = T(0);
+        T Kp = T(0);
+        T Ki = T(0);
+
+        // mt: 計測中のカウント数と、計測を始めた時刻
+        int32_t count = 0;
+        uint32_t windowStart = 0;
+        uint32_t windowMicros = 0;
+
+        void updatePLL(int32_t diff, uint32_t timestamp);
+        void updateMT(int32_t diff, uint32_t timestamp);
+    };
+
+    /**
+     * @brief 速度・加速度・躍度の上限を守る目標値の軌道を作るクラス
+     * @details 動かし始めるとき(moveTo(), rampTo())に最大7つの区間(躍度一定)を計算しておき、各ループでは今の区間の3次式を求めるだけです。
+     * 躍度の上限を0にすると台形(加速度一定)の軌道、正にするとS字の軌道になります。
+     * 各ループでupdate()を呼び、getPosition()をPosition_PIDに、getVelocity()をVelocity_PIDにsetTarget()してください。
+     *
+     * @code
+     * static Cubic_controller::Trajectory trajectory(10.0, 40.0, 400.0);
+     * trajectory.moveTo(pid.getCurrent(), PI);
+     * // 各ループで
+     * trajectory.update();
+     * pid.setTarget(trajectory.getPosition());
+     * @endcode
+     *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
+     */
+    template <class T>
+    class Basic_Trajectory
+    {
+    public:
+        /**
+         * @brief Construct a new Trajectory object
+         *
+         * @param velocityLimit 速度の上限[rad/s]
+         * @param accelerationLimit 加速度の上限[rad/s^2]
+         * @param jerkLimit 躍度の上限[rad/s^3]。省略可能で、デフォルトは0(台形の軌道)。
+         */
+        Basic_Trajectory(T velocityLimit, T accelerationLimit, T jerkLimit = T(0));
+
+        /**
+         * @brief 上限を設定します。次のmoveTo(), rampTo()から使います。負の値は-1倍されます。
+         *
+         * @param velocityLimit 速度の上限[rad/s]
+         * @param accelerationLimit 加速度の上限[rad/s^2]
+         * @param jerkLimit 躍度の上限[rad/s^3]。0なら台形の軌道。
+         */
+        void setLimits(T velocityLimit, T accelerationLimit, T jerkLimit = T(0));
+        /**
+         * @brief 静止した状態からtargetまで動く位置の軌道を計算し、今の時刻から始めます。
+         * @details 動いている途中で呼んだ場合も、速度0から計算し直します。速度か加速度の上限が0なら、すぐにtargetに移ります。
+         *
+         * @param from 今の位置[rad]
+         * @param target 目標位置[rad]
+         */
+        void moveTo(T from, T target);
+        /**
+         * @brief 速度をfromからtargetまで変える軌道を計算し、今の時刻から始めます。速度の上限は使いません。
+         *
+         * @param from 今の速度[rad/s]
+         * @param target 目標速度[rad/s]
+         */
+        void rampTo(T from, T target);
+        /**
+         * @brief 今の時刻の目標値を計算します。各ループで一回呼び出してください。
+         */
+        void update();
+        /**
+         * @brief 動かし始めてからtime[s]後の目標値を計算します。
+         *
+         * @param time 動かし始めてからの時間[s]
+         */
+        void sample(T time);
+        /**
+         * @brief 目標位置を返します。rampTo()では動かし始めてからの変位です。
+         *
+         * @return T 位置[rad]
+         */
+        T getPosition() const;
+        /**
+         * @brief 目標速度を返します。
+         *
+         * @return T 速度[rad/s]
+         */
+        T getVelocity() const;
+        /**
+         * @brief 目標加速度を返します。
+         *
+         * @return T 加速度[rad/s^2]
+         */
+        T getAcceleration() const;
+        /**
+         * @brief 軌道全体の時間を返します。
+         *
+         * @return T 時間[s]
+         */
+        T getDuration() const;
+        /**
+         * @brief 直前のupdate(), sample()で軌道の終わりに着いていたかどうかを返します。
+         *
+         * @return bool
+         */
+        bool isFinished() const;
+
+    private:
+        static constexpr int SEGMENT_NUM = 7;
+
+        T velocityLimit;
+        T accelerationLimit;
+        T jerkLimit;
+
+        // 各区間の開始時刻[s](startTime[SEGMENT_NUM]は終了時刻)と、開始時の位置・速度・加速度、区間中の躍度
+        T startTime[SEGMENT_NUM + 1];
+        T startPosition[SEGMENT_NUM];
+        T startVelocity[SEGMENT_NUM];
+        T startAcceleration[SEGMENT_NUM];
+        T jerk[SEGMENT_NUM];
+        // 終了時の位置と速度
+        T finalPosition = T(0);
+        T finalVelocity = T(0);
+
+        uint8_t segment = 0;
+        uint32_t startMicros = 0;
+        T position = T(0);
+        T velocity = T(0);
+        T acceleration = T(0);
+        bool finished = true;
+
+        /**
+         * @brief 区間の長さ、開始時の加速度、躍度から各区間の開始時の状態を積分します。計算は一度だけなのでdoubleで行います。
+         */
+        void plan(const double *duration, const double *acceleration, const double *jerk, double position, double velocity);
+    };
+
     /**
      * @brief Cubic制御器の抽象クラス
      *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
      */
-    class Controller
+    template <class T>
+    class Basic_Controller
     {
     private:
-        PID::PID &pid;
+        PID::Basic_PID<T> pid;
 
-        double capableDutyCycle;
-        double dutyCycle;
+        T capableDutyCycle;
+        T dutyCycle;
+
+        /* フィードフォワード */
+        T kV = T(0);
+        T kA = T(0);
+        T friction = T(0);
+        T deadband = T(0);
+        T gravity = T(0);
+        T feedforward = T(0);
+
+        /**
+         * @brief ゲインと目標の速度・加速度からフィードフォワードの出力を計算し、PIDに設定します。
+         */
+        void updateFeedforward();
 
     protected:
         /// @brief モータ番号
@@ -125,16 +415,29 @@ namespace Cubic_controller
         const uint16_t CPR;
         /// @brief モータをプラスの方向に回したとき、エンコーダが増加するかどうか
         const bool direction;
-        /// @brief ログを出力するかどうか
+        /// @brief ログを記録するかどうか
         const bool logging;
+        /// @brief フィードフォワードに使う目標速度
+        T referenceVelocity = T(0);
+        /// @brief フィードフォワードに使う目標加速度
+        T referenceAcceleration = T(0);
 
         /**
          * @brief pid.compute_PID()を呼ぶだけの関数です。
          *
          * @param current
-         * @return double
+         * @return T
+         */
+        T compute_PID(T current);
+
+        /**
+         * @brief loggingがtrueのとき、直前のcompute_PID()の結果をTelemetryに記録します。
+         * @details Serialへの送信はCubic::update()の周期待ちの間に行われます。
+         *
+         * @param encoder 読んだエンコーダの値
+         * @param flags TelemetryFlag
          */
-        double compute_PID(double current);
+        void log(int32_t encoder, uint8_t flags = 0) const;
 
     public:
         /**
@@ -153,20 +456,22 @@ namespace Cubic_controller
          * @param current
          * @param logging
          */
-        Controller(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double target, bool direction, double capableDutyCycle, double current, bool logging = false);
+        Basic_Controller(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle, T current, bool logging = false);
+
+        virtual ~Basic_Controller() = default;
 
         /**
          * @brief duty比を計算します。各ループで一回呼び出してください。このduty比は、DUTY_SPI_MAXに対する比です。計算された値は、この関数内部で、DC_motor::put()されます。
          *
-         * @return double dutyCycle
+         * @return T dutyCycle
          */
-        virtual double compute() = 0;
+        virtual T compute() = 0;
         /**
          * @brief 制御量の目標値を設定します。
          *
          * @param target
          */
-        virtual void setTarget(double target);
+        virtual void setTarget(T target);
         /**
          * @brief PIDゲインを設定します。負の値は-1倍されます。
          *
@@ -174,27 +479,69 @@ namespace Cubic_controller
          * @param Ki
          * @param Kd
          */
-        void setGains(double Kp, double Ki, double Kd);
+        void setGains(T Kp, T Ki, T Kd);
         /**
          * @brief Pゲインを設定します。負の値は-1倍されます。
          *
          * @param Kp
          */
-        void setKp(double Kp);
+        void setKp(T Kp);
         /**
          * @brief Iゲインを設定します。負の値は-1倍されます。
          *
          * @param Ki
          */
-        void setKi(double Ki);
+        void setKi(T Ki);
         /**
          * @brief Dゲインを設定します。負の値は-1倍されます。
          *
          * @param Kd
          */
-        void setKd(double Kd);
+        void setKd(T Kd);
+        /**
+         * @brief ローパスフィルタの係数を設定します。フィルタを持たない制御器では何もしません。
+         *
+         * @param p
+         */
+        virtual void setLPF(T) {}
+        /**
+         * @brief compute()を一定周期で呼ぶ場合に、周期固定モードにします。
+         * @details 離散時間のPID係数を前もって計算しておき、各ループでは時刻を読まず、除算もしません。詳しくはPID::Basic_PID::setSampleTime()を参照してください。
+         *
+         * @param sampleTime 周期[s]。Cubic::update()に与える周期と同じにしてください。0なら通常のモードに戻します。
+         * @param derivativeFilter 微分のローパスフィルタの時定数[s]。省略可能で、デフォルトは0(フィルタなし)。
+         */
+        void setSampleTime(T sampleTime, T derivativeFilter = T(0));
+        /**
+         * @brief フィードフォワードのゲインを設定します。すべて0(デフォルト)ならフィードフォワードはありません。
+         * @details 出力は kV*目標速度 + kA*目標加速度 + 摩擦 + 重力 で、PIDの出力に足してからcapableDutyCycleで制限します。
+         * 摩擦は目標速度の絶対値がdeadbandより大きいときに、目標速度の向きにfrictionを足します。
+         * どの項も制御量がプラスになる向きを正とします(directionは考慮されます)。
+         *
+         * @param kV 速度のゲイン[duty/(rad/s)]
+         * @param kA 加速度のゲイン[duty/(rad/s^2)]
+         * @param friction 静止摩擦・クーロン摩擦を打ち消すduty比。省略可能で、デフォルトは0。
+         * @param deadband 摩擦を足さない目標速度の範囲[rad/s]。省略可能で、デフォルトは0。
+         * @param gravity 常に足すduty比(重力など)。省略可能で、デフォルトは0。
+         */
+        void setFeedforward(T kV, T kA, T friction = T(0), T deadband = T(0), T gravity = T(0));
+        /**
+         * @brief フィードフォワードに使う目標速度と目標加速度を設定します。Trajectoryの値を各ループで与えてください。
+         * @details Velocity_PIDでは、setTarget()で目標速度も設定されます。
+         *
+         * @param velocity 目標速度[rad/s]
+         * @param acceleration 目標加速度[rad/s^2]。省略可能で、デフォルトは0。
+         */
+        void setReference(T velocity, T acceleration = T(0));
+        /**
+         * @brief 直前に設定したフィードフォワードの出力を返します。
+         *
+         * @return T duty比
+         */
+        T getFeedforward() const;
         /**
          * @brief エンコーダを読みだします。
+         * @details Cubic::update()で復号済みの値を読むだけなので、何度呼んでも軽い処理です。
          *
          * @return int32_t encoder
          */
@@ -202,27 +549,27 @@ namespace Cubic_controller
         /**
          * @brief 目標値を返します。
          *
-         * @return double target
+         * @return T target
          */
-        double getTarget() const;
+        T getTarget() const;
         /**
          * @brief 直前に計算したデューティ比を返します。
          *
-         * @return double dutyCycle
+         * @return T dutyCycle
          */
-        double getDutyCycle() const;
+        T getDutyCycle() const;
         /**
          * @brief 直前のループにおける経過時間dtを返します
          *
-         * @return double dt[s]
+         * @return T dt[s]
          */
-        double getDt() const;
+        T getDt() const;
         /**
          * @brief 直前に読んだ制御量を返します。
          *
-         * @return double
+         * @return T
          */
-        double getCurrent() const;
+        T getCurrent() const;
 
         /**
          * @brief 制御器のリセット
@@ -236,7 +583,7 @@ namespace Cubic_controller
          *
          * @param target
          */
-        virtual void reset(double target);
+        virtual void reset(T target);
 
         /**
          * @brief 制御器のリセット
@@ -245,7 +592,7 @@ namespace Cubic_controller
          * @param Ki
          * @param Kd
          */
-        virtual void reset(double Kp, double Ki, double Kd);
+        virtual void reset(T Kp, T Ki, T Kd);
 
         /**
          * @brief 制御器のリセット
@@ -255,26 +602,29 @@ namespace Cubic_controller
          * @param Kd
          * @param target
          */
-        virtual void reset(double Kp, double Ki, double Kd, double target);
+        virtual void reset(T Kp, T Ki, T Kd, T target);
 
         /**
          * @brief エンコーダの値から角度を計算します。設定したCPR(Count Per Revolution)に依存します。
+         * @details 制御器の状態は変えません。
          *
          * @param encoder
-         * @return double angle[rad](-PI<= angle < PI)
+         * @return T 速度制御では1周期の差分の角度[rad]、位置制御では作ったときの回転を0回転目とした多回転の角度[rad]
          */
-        virtual double encoderToAngle(int32_t encoder) = 0;
+        virtual T encoderToAngle(int32_t encoder) = 0;
     };
 
     /**
      * @brief インクリメンタルエンコーダを用いた、DCモータの速度制御を行うためのクラス
      * @details このクラスでは、エンコーダの角速度[rad/s]を制御量とします。
      */
-    class Velocity_PID : public Controller
+    template <class T>
+    class Basic_Velocity_PID : public Basic_Controller<T>
     {
     private:
-        double p;
-        double vLPF = 0.0;
+        T p;
+        T vLPF = T(0);
+        Basic_Velocity_estimator<T> estimator;
 
     public:
         /**
@@ -291,37 +641,53 @@ namespace Cubic_controller
          * @param direction モーターに正のdutyを与えたときに、エンコーダが正方向に回転するかどうか。trueなら正方向、falseなら負方向。
          * @param capableDutyCycle 最大許容デューティ比。0.0~1.0。省略可能で、デフォルトは1.0。
          * @param p ローパスフィルタの係数。0.0~1.0。省略可能で、デフォルトは1.0(フィルタなし)。
-         * @param logging ログをSerial.printで出力するかどうか。省略可能で、デフォルトはfalse。
+         * @param logging ログをTelemetryに記録するかどうか。省略可能で、デフォルトはfalse。
          *
          */
-        Velocity_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double target, bool direction, double capableDutyCycle = 1.0, double p = 1.0, bool logging = false);
+        Basic_Velocity_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle = T(1.0), T p = T(1.0), bool logging = false);
         /**
          * @brief ローパスフィルタの係数pを設定します。
          *
          * @param p
          */
-        void setLPF(double p);
-        double encoderToAngle(int32_t encoder) override;
-        double compute() override;
+        void setLPF(T p) override;
+        /**
+         * @brief 速度の推定方法を設定します。
+         * @details デフォルトはlpf(差分/dtにsetLPF()のローパスフィルタ)です。pll, mtにすると、低速での量子化の雑音が小さくなり、ゲインを上げやすくなります。
+         *
+         * @param type 推定方法
+         * @param bandwidth 帯域幅[rad/s]。lpfでは使いません。
+         */
+        void setVelocityEstimator(velocityEstimator type, T bandwidth = T(50));
+        /**
+         * @brief 目標速度を設定します。フィードフォワードの目標速度にもなります。
+         *
+         * @param target 目標速度[rad/s]
+         */
+        void setTarget(T target) override;
+        T encoderToAngle(int32_t encoder) override;
+        T compute() override;
         /**
          * @brief 制御器のリセット
          *
-         * @details low-pass filterの値`vLPF`も0にリセットします。
+         * @details low-pass filterの値`vLPF`と速度の推定値も0にリセットします。
          */
         void reset() override;
-        void reset(double target) override;
-        void reset(double Kp, double Ki, double Kd) override;
-        void reset(double Kp, double Ki, double Kd, double target) override;
+        void reset(T target) override;
+        void reset(T Kp, T Ki, T Kd) override;
+        void reset(T Kp, T Ki, T Kd, T target) override;
     };
 
     /**
      * @brief アブソリュートエンコーダを用いた、DCモータの位置制御を行うためのクラス
      *
      */
-    class Position_PID : public Controller
+    template <class T>
+    class Basic_Position_PID : public Basic_Controller<T>
     {
     private:
-        int8_t loopCount = 0;
+        /// @brief 作ったときのエンコーダの回転数(Abs_enc::turn())。作ったときの角度を-PI~PIとする
+        int32_t turnOffset;
 
     public:
         /**
@@ -337,128 +703,868 @@ namespace Cubic_controller
          * @param target 目標角度[rad] (-PI<= target < PI)
          * @param direction モーターに正のdutyを与えたときに、エンコーダが正方向に回転するかどうか。trueなら正方向、falseなら負方向。
          * @param capableDutyCycle 最大許容デューティ比。0.0~1.0。省略可能で、デフォルトは1.0。
-         * @param logging ログをSerial.printで出力するかどうか。省略可能で、デフォルトはfalse。
+         * @param logging ログをTelemetryに記録するかどうか。省略可能で、デフォルトはfalse。
+         */
+        Basic_Position_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle = T(1.0), bool logging = false);
+
+        void setTarget(T target) override;
+        T encoderToAngle(int32_t encoder) override;
+        T compute() override;
+    };
+
+    /**
+     * @brief 制御器を1つ置いておくための領域
+     * @details 速度制御と位置制御を切り替えるときなどに、ヒープを使わずに同じ領域で制御器を作り直します。
+     * 作り直すと以前の制御器は破棄されるので、以前の参照(Command_parser::attach()したものなど)は使えなくなります。
+     *
+     * @code
+     * static Cubic_controller::Controller_slot slot;
+     * slot.emplace<Cubic_controller::Velocity_PID>(motorNo, encoderNo, Cubic_controller::encoderType::inc, CPR, Kp, Ki, Kd, velTarget, direction);
+     * slot->compute();
+     * @endcode
+     */
+    template <class T>
+    class Basic_Controller_slot
+    {
+    private:
+        alignas(Basic_Velocity_PID<T>) alignas(Basic_Position_PID<T>) unsigned char storage[sizeof(Basic_Velocity_PID<T>) > sizeof(Basic_Position_PID<T>) ? sizeof(Basic_Velocity_PID<T>) : sizeof(Basic_Position_PID<T>)];
+        Basic_Controller<T> *controller = nullptr;
+
+    public:
+        Basic_Controller_slot() = default;
+        Basic_Controller_slot(const Basic_Controller_slot &) = delete;
+        Basic_Controller_slot &operator=(const Basic_Controller_slot &) = delete;
+        ~Basic_Controller_slot()
+        {
+            clear();
+        }
+
+        /**
+         * @brief 以前の制御器を破棄し、同じ領域に新しい制御器を作ります。
+         *
+         * @tparam U Velocity_PIDまたはPosition_PID
+         * @param args Uのコンストラクタの引数
+         * @return U& 作った制御器
+         */
+        template <class U, class... Args>
+        U &emplace(Args &&...args)
+        {
+            static_assert(std::is_base_of<Basic_Controller<T>, U>::value, "U must derive from Controller");
+            static_assert(sizeof(U) <= sizeof(storage) && alignof(U) <= alignof(Basic_Velocity_PID<T>) && alignof(U) <= alignof(Basic_Position_PID<T>), "U does not fit in Controller_slot");
+            clear();
+            U *created = new (storage) U(std::forward<Args>(args)...);
+            controller = created;
+            return *created;
+        }
+
+        /**
+         * @brief 制御器を破棄します。
+         */
+        void clear()
+        {
+            if (controller != nullptr)
+            {
+                controller->~Basic_Controller();
+                controller = nullptr;
+            }
+        }
+
+        /**
+         * @brief 制御器を返します。無ければnullptrです。
+         *
+         * @return Basic_Controller<T>*
+         */
+        Basic_Controller<T> *get() const
+        {
+            return controller;
+        }
+        Basic_Controller<T> *operator->() const
+        {
+            return controller;
+        }
+        Basic_Controller<T> &operator*() const
+        {
+            return *controller;
+        }
+        explicit operator bool() const
+        {
+            return controller != nullptr;
+        }
+    };
+
+    /// @brief ControllerGroupにまとめられる軸の数
+    constexpr int CONTROLLER_GROUP_MAX = 16;
+
+    /**
+     * @brief 複数の軸の速度制御・位置制御をまとめて計算するクラス
+     * @details 各軸のゲイン、積分、偏差、フィルタの値を配列で持ち、compute()でmicros()を1回だけ読んで、
+     * すべての軸を1つのループで計算します。デューティ比はDC_motor::put()でまとめて格納します。
+     * 各軸の計算はVelocity_PID、Position_PIDと同じですが、dtはすべての軸で共通です。
+     *
+     * @code
+     * static Cubic_controller::ControllerGroup group;
+     * int wheel = group.addVelocity(0, 0, CPR, Kp, Ki, Kd, velTarget, direction);
+     * group.compute();
+     * @endcode
+     */
+    template <class T>
+    class Basic_ControllerGroup
+    {
+    public:
+        /**
+         * @brief 速度制御の軸を追加します。引数はVelocity_PIDと同じです。
+         *
+         * @return int 軸の番号。追加できなければ-1
+         */
+        int addVelocity(uint8_t motorNo, uint8_t encoderNo, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle = T(1.0), T p = T(1.0));
+        /**
+         * @brief 位置制御の軸を追加します。引数はPosition_PIDと同じです。
+         *
+         * @return int 軸の番号。追加できなければ-1
+         */
+        int addPosition(uint8_t motorNo, uint8_t encoderNo, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle = T(1.0));
+
+        /**
+         * @brief すべての軸のduty比を計算し、DC_motor::put()します。各ループで一回呼び出してください。
+         * @details 初回はdtを測るために時刻を記録するだけです。
+         */
+        void compute();
+
+        /**
+         * @brief PIDゲインを設定します。負の値は-1倍されます。
+         */
+        void setGains(uint8_t axis, T Kp, T Ki, T Kd);
+        /**
+         * @brief 目標値を設定します。位置制御の軸ではPosition_PID::setTarget()と同じく近い向きに回るようにします。
+         */
+        void setTarget(uint8_t axis, T target);
+        /**
+         * @brief ローパスフィルタの係数を設定します。位置制御の軸では使われません。
+         */
+        void setLPF(uint8_t axis, T p);
+        /**
+         * @brief ログをTelemetryに記録するかどうかを設定します。
+         */
+        void setLogging(bool logging);
+
+        /**
+         * @brief 軸の積分、偏差、フィルタを0に戻します。
+         */
+        void reset(uint8_t axis);
+        /**
+         * @brief すべての軸をリセットし、dtを測り直します。
+         */
+        void reset();
+
+        /// @brief 軸の数
+        uint8_t size() const;
+        /// @brief 直前に計算したデューティ比
+        T getDutyCycle(uint8_t axis) const;
+        /// @brief 直前に読んだ制御量
+        T getCurrent(uint8_t axis) const;
+        /// @brief 目標値
+        T getTarget(uint8_t axis) const;
+        /// @brief 直前のループにおける経過時間dt[s]
+        T getDt() const;
+
+    private:
+        enum class Mode : uint8_t
+        {
+            velocity,
+            position
+        };
+
+        int add(Mode mode, uint8_t motorNo, uint8_t encoderNo, uint16_t CPR, T Kp, T Ki, T Kd, T target, bool direction, T capableDutyCycle, T p);
+
+        uint8_t num = 0;
+        bool logging = false;
+        bool started = false;
+        uint32_t preMicros = 0;
+        T dt = T(0);
+
+        Mode mode[CONTROLLER_GROUP_MAX];
+        uint8_t motorNo[CONTROLLER_GROUP_MAX];
+        uint8_t encoderNo[CONTROLLER_GROUP_MAX];
+        uint16_t CPR[CONTROLLER_GROUP_MAX];
+        int32_t encoder[CONTROLLER_GROUP_MAX];
+        int32_t turnOffset[CONTROLLER_GROUP_MAX];
+        T sign[CONTROLLER_GROUP_MAX];
+        T capableDutyCycle[CONTROLLER_GROUP_MAX];
+        T Kp[CONTROLLER_GROUP_MAX];
+        T Ki[CONTROLLER_GROUP_MAX];
+        T Kd[CONTROLLER_GROUP_MAX];
+        T p[CONTROLLER_GROUP_MAX];
+        T target[CONTROLLER_GROUP_MAX];
+        T current[CONTROLLER_GROUP_MAX];
+        T diff[CONTROLLER_GROUP_MAX];
+        T preDiff[CONTROLLER_GROUP_MAX];
+        T integral[CONTROLLER_GROUP_MAX];
+        T dutyCycle[CONTROLLER_GROUP_MAX];
+    };
+
+    /**
+     * @brief カスケード制御の一番外側のループを示します
+     *
+     * @details position: 位置→速度→電流, velocity: 速度→電流, current: 電流のみ
+     *
+     */
+    enum class cascadeMode
+    {
+        position,
+        velocity,
+        current
+    };
+
+    /**
+     * @brief 1つの軸で、位置・速度・電流のループを入れ子にして制御するクラス
+     * @details 外側のループの出力を内側のループの目標値にします。位置ループの出力(速度の目標値)はvelocityLimit、
+     * 速度ループの出力(電流の目標値)はcurrentLimit、電流ループの出力(duty比)はcapableDutyCycleで制限します。
+     * 電流ループはcompute()のたびに、速度ループはその何回かに1回、位置ループはさらにその何回かに1回計算します(setRatios())。
+     * 電流はAdc::get(motorNo)を使うので、motorNoはメインモータ(0 ~ DC_MOTOR_NUM-1)にしてください。また正のduty比で電流が正になるものとします。
+     *
+     * @code
+     * static Cubic_controller::Cascade_controller axis(0, 0, Cubic_controller::encoderType::inc, 2048 * 4, true, 0.9, 30.0, 5.0);
+     * axis.setPositionGains(1.5, 0.0, 0.0);
+     * axis.setVelocityGains(0.3, 0.3, 0.0);
+     * axis.setCurrentGains(0.02, 0.8, 0.0);
+     * axis.setRatios(2, 2);
+     * axis.setTarget(PI);
+     * // 各ループで
+     * axis.compute();
+     * @endcode
+     *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
+     */
+    template <class T>
+    class Basic_Cascade_controller
+    {
+    public:
+        /**
+         * @brief Construct a new Cascade_controller object
+         *
+         * @param motorNo モータ番号
+         * @param encoderNo エンコーダ番号
+         * @param encoderType エンコーダの種類。incなら累積値、absなら回転数を数えた値を位置とします。
+         * @param CPR エンコーダのCPR（PPRでないことに注意。CPR=PPR*4）
+         * @param direction モーターに正のdutyを与えたときに、エンコーダが正方向に回転するかどうか。trueなら正方向、falseなら負方向。
+         * @param capableDutyCycle 最大許容デューティ比。0.0~1.0。省略可能で、デフォルトは1.0。
+         * @param velocityLimit 速度の目標値の最大値[rad/s]。省略可能で、デフォルトは50.0。
+         * @param currentLimit 電流の目標値の最大値[A]。省略可能で、デフォルトは5.0。
+         * @param logging ログをTelemetryに記録するかどうか。省略可能で、デフォルトはfalse。
+         */
+        Basic_Cascade_controller(uint8_t motorNo, uint8_t encoderNo, enum encoderType encoderType, uint16_t CPR, bool direction, T capableDutyCycle = T(1.0), T velocityLimit = T(50.0), T currentLimit = T(5.0), bool logging = false);
+
+        /**
+         * @brief duty比を計算し、DC_motor::put()します。各ループで一回呼び出してください。
+         *
+         * @return T dutyCycle
+         */
+        T compute();
+        /**
+         * @brief 一番外側のループを切り替えます。各ループはリセットされます。
+         *
+         * @param mode
+         */
+        void setMode(cascadeMode mode);
+        /**
+         * @brief 一番外側のループの目標値を設定します。
+         *
+         * @param target 位置[rad]、速度[rad/s]、電流[A]のいずれか
+         */
+        void setTarget(T target);
+        /**
+         * @brief 位置ループのPIDゲインを設定します。出力は速度[rad/s]です。
+         */
+        void setPositionGains(T Kp, T Ki, T Kd);
+        /**
+         * @brief 速度ループのPIDゲインを設定します。出力は電流[A]です。
+         */
+        void setVelocityGains(T Kp, T Ki, T Kd);
+        /**
+         * @brief 電流ループのPIDゲインを設定します。出力はduty比です。
+         */
+        void setCurrentGains(T Kp, T Ki, T Kd);
+        /**
+         * @brief 各ループの出力の最大値を設定します。
+         *
+         * @param velocityLimit 速度の目標値の最大値[rad/s]
+         * @param currentLimit 電流の目標値の最大値[A]
+         */
+        void setLimits(T velocityLimit, T currentLimit);
+        /**
+         * @brief 内側のループを外側のループの何倍の頻度で計算するかを設定します。
+         *
+         * @param currentPerVelocity 速度ループ1回あたりの電流ループの回数(1以上)
+         * @param velocityPerPosition 位置ループ1回あたりの速度ループの回数(1以上)
+         */
+        void setRatios(uint8_t currentPerVelocity, uint8_t velocityPerPosition);
+        /**
+         * @brief 速度の推定方法を設定します。lpfは使えないので、pllになります。
+         *
+         * @param type
+         * @param bandwidth 帯域幅[rad/s]
+         */
+        void setVelocityEstimator(velocityEstimator type, T bandwidth);
+        /**
+         * @brief 各ループの積分と速度の推定値を0に戻します。位置は保持します。
+         */
+        void reset();
+
+        /// @brief 一番外側のループ
+        cascadeMode getMode() const;
+        /// @brief 直前に読んだ位置[rad]
+        T getPosition() const;
+        /// @brief 直前に推定した速度[rad/s]
+        T getVelocity() const;
+        /// @brief 直前に読んだ電流[A]
+        T getCurrent() const;
+        /// @brief 一番外側のループの目標値
+        T getTarget() const;
+        /// @brief 速度ループの目標値[rad/s]
+        T getVelocityTarget() const;
+        /// @brief 電流ループの目標値[A]
+        T getCurrentTarget() const;
+        /// @brief 直前に計算したデューティ比
+        T getDutyCycle() const;
+
+    private:
+        const uint8_t motorNo;
+        const uint8_t encoderNo;
+        const enum encoderType encoderType;
+        const uint16_t CPR;
+        const bool logging;
+        cascadeMode mode = cascadeMode::position;
+        uint8_t currentPerVelocity = 1;
+        uint8_t velocityPerPosition = 1;
+        uint16_t tick = 0;
+
+        PID::Basic_PID<T> positionPID;
+        PID::Basic_PID<T> velocityPID;
+        PID::Basic_PID<T> currentPID;
+        Basic_Velocity_estimator<T> estimator;
+        int32_t turnOffset = 0;
+        int64_t counts = 0;
+
+        T position = T(0);
+        T current = T(0);
+        T dutyCycle = T(0);
+
+        // 位置[カウント]を角度にする
+        T countsToAngle(int64_t counts) const;
+    };
+
+    /**
+     * @brief リレー(ON/OFF)のフィードバックで軸を発振させ、限界ゲインと限界周期を測るクラス
+     * @details 制御量が目標値より下ならrelayDutyCycle、上なら-relayDutyCycleを出力します(ヒステリシス付き)。
+     * 制御量はインクリメンタルエンコーダなら角速度[rad/s]、アブソリュートエンコーダなら角度[rad]です。
+     * 最初の1周期は捨て、その後のcycles周期の振幅aと周期Tuの平均から、限界ゲイン Ku = 4*relayDutyCycle/(PI*sqrt(a^2-h^2)) を求めます。
+     * 測り終わるとモータを止めます。getGains()でジーグラ・ニコルスの限界感度法のゲインを得られます。
+     *
+     * @code
+     * static Cubic_controller::Relay_autotune autotune(0, 0, Cubic_controller::encoderType::inc, 2048 * 4, true, 0.3, 20.0, 1.0);
+     * // 各ループで
+     * if (autotune.compute())
+     * {
+     *     double Kp, Ki, Kd;
+     *     autotune.getGains(Kp, Ki, Kd);
+     * }
+     * @endcode
+     *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
+     */
+    template <class T>
+    class Basic_Relay_autotune
+    {
+    public:
+        /**
+         * @brief Construct a new Relay_autotune object
+         *
+         * @param motorNo モータ番号
+         * @param encoderNo エンコーダ番号
+         * @param encoderType エンコーダの種類。incなら角速度、absなら角度を制御量とします。
+         * @param CPR エンコーダのCPR（PPRでないことに注意。CPR=PPR*4）
+         * @param direction モーターに正のdutyを与えたときに、エンコーダが正方向に回転するかどうか。trueなら正方向、falseなら負方向。
+         * @param relayDutyCycle リレーの出力の大きさ。0.0~1.0。
+         * @param setpoint 発振させる中心の値[rad/s]または[rad]
+         * @param hysteresis ヒステリシスの幅。雑音で出力がばたつかない程度にしてください。省略可能で、デフォルトは0.0。
+         * @param cycles 平均をとる周期の数(1以上)。省略可能で、デフォルトは4。
+         */
+        Basic_Relay_autotune(uint8_t motorNo, uint8_t encoderNo, enum encoderType encoderType, uint16_t CPR, bool direction, T relayDutyCycle, T setpoint, T hysteresis = T(0), uint8_t cycles = 4);
+
+        /**
+         * @brief リレーの出力を計算し、DC_motor::put()します。各ループで一回呼び出してください。
+         *
+         * @return bool 測り終わったかどうか。測り終わった後はモータに0を出力します。
+         */
+        bool compute();
+        /**
+         * @brief 測った値を捨て、最初から測り直します。
+         */
+        void reset();
+        /**
+         * @brief 角速度の推定方法を設定します。インクリメンタルエンコーダのときだけ使います。チューニングするVelocity_PIDと同じにしてください。
+         *
+         * @param type 推定方法
+         * @param bandwidth 帯域幅[rad/s]。lpfでは使いません。
+         */
+        void setVelocityEstimator(velocityEstimator type, T bandwidth = T(50));
+        /**
+         * @brief lpfのときのローパスフィルタの係数pを設定します。
+         *
+         * @param p 0.0~1.0
+         */
+        void setLPF(T p);
+
+        /// @brief 測り終わったかどうか
+        bool isFinished() const;
+        /// @brief 直前に読んだ制御量[rad/s]または[rad]
+        T getCurrent() const;
+        /// @brief 直前に出力したデューティ比
+        T getDutyCycle() const;
+        /// @brief 限界ゲイン。測り終わる前は0
+        T getUltimateGain() const;
+        /// @brief 限界周期[s]。測り終わる前は0
+        T getUltimatePeriod() const;
+        /// @brief 発振の振幅(ピークの差の半分)。測り終わる前は0
+        T getAmplitude() const;
+        /**
+         * @brief 限界ゲインと限界周期から、ジーグラ・ニコルスの限界感度法でPIDゲインを計算します。
+         * @details Kp = 0.6*Ku, Ki = 1.2*Ku/Tu, Kd = 0.075*Ku*Tu。測り終わる前は全て0です。
+         *
+         * @param Kp
+         * @param Ki
+         * @param Kd
          */
-        Position_PID(uint8_t motorNo, uint8_t encoderNo, enum class encoderType encoderType, uint16_t CPR, double Kp, double Ki, double Kd, double target, bool direction, double capableDutyCycle = 1.0, bool logging = false);
+        void getGains(T &Kp, T &Ki, T &Kd) const;
+
+    private:
+        const uint8_t motorNo;
+        const uint8_t encoderNo;
+        const enum encoderType encoderType;
+        const uint16_t CPR;
+        const bool direction;
+        const T relayDutyCycle;
+        const T setpoint;
+        const T hysteresis;
+        const uint8_t cycles;
+
+        Basic_Velocity_estimator<T> estimator;
+        T p = T(1);
+        int32_t turnOffset = 0;
+        int64_t counts = 0;
+        uint32_t preMicros = 0;
+
+        T current = T(0);
+        bool high = true;
+        T dutyCycle = T(0);
+        bool finished = false;
 
-        void setTarget(double target) override;
-        double encoderToAngle(int32_t encoder) override;
-        double compute() override;
+        // 今の周期のピークと、出力を正にした時刻。周期の数は捨てる1周期を含む
+        T peakHigh = T(0);
+        T peakLow = T(0);
+        uint32_t cycleStart = 0;
+        // cyclesが255でもcycles + 2まで数えられる幅にする
+        uint16_t cycle = 0;
+        // 測った振幅[制御量]と周期[s]の和。回数が少ないのでdoubleで足す
+        double amplitudeSum = 0.0;
+        double periodSum = 0.0;
+
+        T ultimateGain = T(0);
+        T ultimatePeriod = T(0);
+        T amplitude = T(0);
+
+        // エンコーダを読み、制御量を更新する
+        void measure();
     };
 
     // Definition
 
-    inline double Controller::compute_PID(const double current)
+    template <class T>
+    inline T Basic_Controller<T>::compute_PID(const T current)
     {
         return dutyCycle = this->pid.compute_PID(current, logging);
     }
-    inline void Controller::setTarget(const double target)
+    template <class T>
+    inline void Basic_Controller<T>::setFeedforward(const T kV, const T kA, const T friction, const T deadband, const T gravity)
+    {
+        this->kV = kV;
+        this->kA = kA;
+        this->friction = friction;
+        this->deadband = scalar_abs(deadband);
+        this->gravity = gravity;
+        updateFeedforward();
+    }
+    template <class T>
+    inline void Basic_Controller<T>::setReference(const T velocity, const T acceleration)
+    {
+        referenceVelocity = velocity;
+        referenceAcceleration = acceleration;
+        updateFeedforward();
+    }
+    template <class T>
+    inline T Basic_Controller<T>::getFeedforward() const
+    {
+        return feedforward;
+    }
+    template <class T>
+    inline void Basic_Controller<T>::setTarget(const T target)
     {
         this->pid.setTarget(target);
     }
-    inline void Controller::setGains(const double Kp, const double Ki, const double Kd)
+    template <class T>
+    inline void Basic_Controller<T>::setGains(const T Kp, const T Ki, const T Kd)
+    {
+        this->pid.setGains(scalar_abs(Kp), scalar_abs(Ki), scalar_abs(Kd));
+    }
+    template <class T>
+    inline void Basic_Controller<T>::setKp(const T Kp)
     {
-        this->pid.setGains(abs(Kp), abs(Ki), abs(Kd));
+        this->pid.setKp(scalar_abs(Kp));
     }
-    inline void Controller::setKp(const double Kp)
+    template <class T>
+    inline void Basic_Controller<T>::setKi(const T Ki)
     {
-        this->pid.setKp(abs(Kp));
+        this->pid.setKi(scalar_abs(Ki));
     }
-    inline void Controller::setKi(const double Ki)
+    template <class T>
+    inline void Basic_Controller<T>::setKd(const T Kd)
     {
-        this->pid.setKi(abs(Ki));
+        this->pid.setKd(scalar_abs(Kd));
     }
-    inline void Controller::setKd(const double Kd)
+    template <class T>
+    inline void Basic_Controller<T>::setSampleTime(const T sampleTime, const T derivativeFilter)
     {
-        this->pid.setKd(abs(Kd));
+        this->pid.setSampleTime(sampleTime, derivativeFilter);
     }
-    inline double Controller::getTarget() const
+    template <class T>
+    inline T Basic_Controller<T>::getTarget() const
     {
         return this->pid.getTarget();
     }
-    inline double Controller::getCurrent() const
+    template <class T>
+    inline T Basic_Controller<T>::getCurrent() const
     {
         return this->pid.getCurrent();
     }
-    inline double Controller::getDutyCycle() const
+    template <class T>
+    inline T Basic_Controller<T>::getDutyCycle() const
     {
         return this->dutyCycle;
     }
-    inline double Controller::getDt() const
+    template <class T>
+    inline T Basic_Controller<T>::getDt() const
     {
         return this->pid.getDt();
     }
-    inline double Velocity_PID::encoderToAngle(const int32_t encoder)
+    template <class T>
+    inline T Basic_Velocity_PID<T>::encoderToAngle(const int32_t encoder)
     {
-        return Cubic_controller::encoderToAngle(encoder, this->CPR, 0, false);
+        return Cubic_controller::encoderToAngle<T>(encoder, this->CPR, T(0), false);
     }
-    inline double Position_PID::encoderToAngle(const int32_t encoder)
+    template <class T>
+    inline T Basic_Position_PID<T>::encoderToAngle(const int32_t encoder)
     {
-        double angle = Cubic_controller::encoderToAngle(encoder, this->CPR, -PI, true);
-        static double prevAngle = angle;
-        double actualAngle = angle;
-
-        if (actualAngle < -LOOP_THRESHOLD && prevAngle > LOOP_THRESHOLD)
-        {
-            this->loopCount++;
-        }
-        else if (actualAngle > LOOP_THRESHOLD && prevAngle < -LOOP_THRESHOLD)
-        {
-            this->loopCount--;
-        }
-        prevAngle = actualAngle;
-
-        return angle + TWO_PI * this->loopCount;
+        // 回転数はAbs_encが毎周期数えているので、ここでは読むだけにする
+        return Cubic_controller::encoderToAngle<T>(encoder, this->CPR, T(-PI), false) + T(TWO_PI) * T(Abs_enc::turn(this->encoderNo).turns() - turnOffset);
     }
-    inline int32_t Controller::readEncoder() const
+    template <class T>
+    inline int32_t Basic_Controller<T>::readEncoder() const
     {
-        int32_t value = encoderType == encoderType::inc ? Inc_enc::get_diff(encoderNo) : Abs_enc::get(encoderNo);
-        if (logging)
+        return encoderType == encoderType::inc ? Inc_enc::get_diff(encoderNo) : Abs_enc::get(encoderNo);
+    }
+    template <class T>
+    inline void Basic_Controller<T>::log(const int32_t encoder, const uint8_t flags) const
+    {
+        if (!logging)
         {
-            Serial.print("encoder:");
-            Serial.print(value);
-            Serial.print(",");
+            return;
         }
-        return value;
+        Telemetry_record record;
+        record.timestamp = micros();
+        record.motorNo = motorNo;
+        record.flags = flags;
+        record.reserved = 0;
+        record.encoder = encoder;
+        record.current = (float)pid.getCurrent();
+        record.target = (float)pid.getTarget();
+        record.diff = (float)pid.getDiff();
+        record.integral = (float)pid.getIntegral();
+        record.duty = (float)dutyCycle;
+        record.dt = (float)pid.getDt();
+        Telemetry::push(record);
     }
-    inline void Velocity_PID::setLPF(const double p)
+    template <class T>
+    inline void Basic_Velocity_PID<T>::setLPF(const T p)
     {
         this->p = p;
     }
-    inline void Controller::reset()
+    template <class T>
+    inline T Basic_Velocity_estimator<T>::get() const
+    {
+        return velocity;
+    }
+    template <class T>
+    inline velocityEstimator Basic_Velocity_estimator<T>::getType() const
+    {
+        return type;
+    }
+    template <class T>
+    inline void Basic_Velocity_PID<T>::setVelocityEstimator(const velocityEstimator type, const T bandwidth)
+    {
+        this->estimator.setType(type, bandwidth);
+    }
+    template <class T>
+    inline void Basic_Controller<T>::reset()
     {
         this->pid.reset();
     }
-    inline void Controller::reset(const double target)
+    template <class T>
+    inline void Basic_Controller<T>::reset(const T target)
     {
         this->pid.reset(target);
     }
-    inline void Controller::reset(const double Kp, const double Ki, const double Kd)
+    template <class T>
+    inline void Basic_Controller<T>::reset(const T Kp, const T Ki, const T Kd)
     {
         this->pid.reset(Kp, Ki, Kd);
     }
-    inline void Controller::reset(const double Kp, const double Ki, const double Kd, const double target)
+    template <class T>
+    inline void Basic_Controller<T>::reset(const T Kp, const T Ki, const T Kd, const T target)
     {
         this->pid.reset(Kp, Ki, Kd, target);
     }
-    inline void Velocity_PID::reset()
+    template <class T>
+    inline void Basic_Velocity_PID<T>::reset()
+    {
+        Basic_Controller<T>::reset();
+        this->vLPF = T(0);
+        this->estimator.reset();
+    }
+    template <class T>
+    inline void Basic_Velocity_PID<T>::reset(const T target)
     {
-        Controller::reset();
-        this->vLPF = 0;
+        Basic_Controller<T>::reset(target);
+        this->setReference(target, this->referenceAcceleration);
+        this->vLPF = T(0);
+        this->estimator.reset();
+    }
+    template <class T>
+    inline void Basic_Velocity_PID<T>::reset(const T Kp, const T Ki, const T Kd)
+    {
+        Basic_Controller<T>::reset(Kp, Ki, Kd);
+        this->vLPF = T(0);
+        this->estimator.reset();
+    }
+    template <class T>
+    inline void Basic_Velocity_PID<T>::reset(const T Kp, const T Ki, const T Kd, const T target)
+    {
+        Basic_Controller<T>::reset(Kp, Ki, Kd, target);
+        this->setReference(target, this->referenceAcceleration);
+        this->vLPF = T(0);
+        this->estimator.reset();
+    }
+    template <class T>
+    inline void Basic_ControllerGroup<T>::setGains(const uint8_t axis, const T Kp, const T Ki, const T Kd)
+    {
+        if (axis >= num)
+        {
+            return;
+        }
+        this->Kp[axis] = scalar_abs(Kp);
+        this->Ki[axis] = scalar_abs(Ki);
+        this->Kd[axis] = scalar_abs(Kd);
+    }
+    template <class T>
+    inline void Basic_ControllerGroup<T>::setLPF(const uint8_t axis, const T p)
+    {
+        if (axis < num)
+        {
+            this->p[axis] = p;
+        }
     }
-    inline void Velocity_PID::reset(const double target)
+    template <class T>
+    inline void Basic_ControllerGroup<T>::setLogging(const bool logging)
     {
-        Controller::reset(target);
-        this->vLPF = 0;
+        this->logging = logging;
     }
-    inline void Velocity_PID::reset(const double Kp, const double Ki, const double Kd)
+    template <class T>
+    inline uint8_t Basic_ControllerGroup<T>::size() const
     {
-        Controller::reset(Kp, Ki, Kd);
-        this->vLPF = 0;
+        return num;
     }
-    inline void Velocity_PID::reset(const double Kp, const double Ki, const double Kd, const double target)
+    template <class T>
+    inline T Basic_ControllerGroup<T>::getDutyCycle(const uint8_t axis) const
     {
-        Controller::reset(Kp, Ki, Kd, target);
-        this->vLPF = 0;
+        return axis < num ? dutyCycle[axis] : T(0);
     }
+    template <class T>
+    inline T Basic_ControllerGroup<T>::getCurrent(const uint8_t axis) const
+    {
+        return axis < num ? current[axis] : T(0);
+    }
+    template <class T>
+    inline T Basic_ControllerGroup<T>::getTarget(const uint8_t axis) const
+    {
+        return axis < num ? target[axis] : T(0);
+    }
+    template <class T>
+    inline T Basic_ControllerGroup<T>::getDt() const
+    {
+        return dt;
+    }
+
+    template <class T>
+    inline cascadeMode Basic_Cascade_controller<T>::getMode() const
+    {
+        return mode;
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getPosition() const
+    {
+        return position;
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getVelocity() const
+    {
+        return estimator.get();
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getCurrent() const
+    {
+        return current;
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getTarget() const
+    {
+        return mode == cascadeMode::position ? positionPID.getTarget() : (mode == cascadeMode::velocity ? velocityPID.getTarget() : currentPID.getTarget());
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getVelocityTarget() const
+    {
+        return velocityPID.getTarget();
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getCurrentTarget() const
+    {
+        return currentPID.getTarget();
+    }
+    template <class T>
+    inline T Basic_Cascade_controller<T>::getDutyCycle() const
+    {
+        return dutyCycle;
+    }
+
+    template <class T>
+    inline T Basic_Trajectory<T>::getPosition() const
+    {
+        return position;
+    }
+    template <class T>
+    inline T Basic_Trajectory<T>::getVelocity() const
+    {
+        return velocity;
+    }
+    template <class T>
+    inline T Basic_Trajectory<T>::getAcceleration() const
+    {
+        return acceleration;
+    }
+    template <class T>
+    inline T Basic_Trajectory<T>::getDuration() const
+    {
+        return startTime[SEGMENT_NUM];
+    }
+    template <class T>
+    inline bool Basic_Trajectory<T>::isFinished() const
+    {
+        return finished;
+    }
+
+    template <class T>
+    inline bool Basic_Relay_autotune<T>::isFinished() const
+    {
+        return finished;
+    }
+    template <class T>
+    inline T Basic_Relay_autotune<T>::getCurrent() const
+    {
+        return current;
+    }
+    template <class T>
+    inline T Basic_Relay_autotune<T>::getDutyCycle() const
+    {
+        return dutyCycle;
+    }
+    template <class T>
+    inline T Basic_Relay_autotune<T>::getUltimateGain() const
+    {
+        return ultimateGain;
+    }
+    template <class T>
+    inline T Basic_Relay_autotune<T>::getUltimatePeriod() const
+    {
+        return ultimatePeriod;
+    }
+    template <class T>
+    inline T Basic_Relay_autotune<T>::getAmplitude() const
+    {
+        return amplitude;
+    }
+
+    /// @brief doubleで計算する制御器
+    typedef Basic_Controller<double> Controller;
+    typedef Basic_Velocity_PID<double> Velocity_PID;
+    typedef Basic_Position_PID<double> Position_PID;
+    typedef Basic_Controller_slot<double> Controller_slot;
+    typedef Basic_ControllerGroup<double> ControllerGroup;
+    typedef Basic_Velocity_estimator<double> Velocity_estimator;
+    typedef Basic_Cascade_controller<double> Cascade_controller;
+    typedef Basic_Trajectory<double> Trajectory;
+    typedef Basic_Relay_autotune<double> Relay_autotune;
+
+    /// @brief floatで計算する制御器
+    typedef Basic_Controller<float> Controller_f;
+    typedef Basic_Velocity_PID<float> Velocity_PID_f;
+    typedef Basic_Position_PID<float> Position_PID_f;
+    typedef Basic_Controller_slot<float> Controller_slot_f;
+    typedef Basic_ControllerGroup<float> ControllerGroup_f;
+    typedef Basic_Velocity_estimator<float> Velocity_estimator_f;
+    typedef Basic_Cascade_controller<float> Cascade_controller_f;
+    typedef Basic_Trajectory<float> Trajectory_f;
+    typedef Basic_Relay_autotune<float> Relay_autotune_f;
+
+    extern template class Basic_Controller<double>;
+    extern template class Basic_Velocity_PID<double>;
+    extern template class Basic_Position_PID<double>;
+    extern template class Basic_ControllerGroup<double>;
+    extern template class Basic_Velocity_estimator<double>;
+    extern template class Basic_Cascade_controller<double>;
+    extern template class Basic_Trajectory<double>;
+    extern template class Basic_Relay_autotune<double>;
+    extern template class Basic_Controller<float>;
+    extern template class Basic_Velocity_PID<float>;
+    extern template class Basic_Position_PID<float>;
+    extern template class Basic_ControllerGroup<float>;
+    extern template class Basic_Velocity_estimator<float>;
+    extern template class Basic_Cascade_controller<float>;
+    extern template class Basic_Trajectory<float>;
+    extern template class Basic_Relay_autotune<float>;
+    extern template class Basic_Controller<Q16_16>;
+    extern template class Basic_Velocity_PID<Q16_16>;
+    extern template class Basic_Position_PID<Q16_16>;
+    extern template class Basic_ControllerGroup<Q16_16>;
+    extern template class Basic_Velocity_estimator<Q16_16>;
+    extern template class Basic_Cascade_controller<Q16_16>;
+    extern template class Basic_Trajectory<Q16_16>;
+    extern template class Basic_Relay_autotune<Q16_16>;
+#ifdef CUBIC_HAS_Q32_32
+    extern template class Basic_Controller<Q32_32>;
+    extern template class Basic_Velocity_PID<Q32_32>;
+    extern template class Basic_Position_PID<Q32_32>;
+    extern template class Basic_ControllerGroup<Q32_32>;
+    extern template class Basic_Velocity_estimator<Q32_32>;
+    extern template class Basic_Cascade_controller<Q32_32>;
+    extern template class Basic_Trajectory<Q32_32>;
+    extern template class Basic_Relay_autotune<Q32_32>;
+#endif
 }
\ No newline at end of file
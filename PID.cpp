@@ -2,35 +2,117 @@
 
 namespace PID
 {
-  PID::PID(double capableDutyCycle, double Kp, double Ki, double Kd, double current, double target, bool direction)
+  template <class T>
+  Basic_PID<T>::Basic_PID(T capableDutyCycle, T Kp, T Ki, T Kd, T current, T target, bool direction)
       : Kp(Kp), Ki(Ki), Kd(Kd), capableDutyCycle(capableDutyCycle), current(current), target(target), direction(direction)
   {
-    preMicros = micros();
-    preDiff = 0;
-    integral = 0;
+    preMicros = Recorder::now();
+    dt = T(0);
+    diff = T(0);
+    preDiff = T(0);
+    integral = T(0);
   }
 
-  double PID::compute_PID(double current, const bool logging)
+  template <class T>
+  void Basic_PID<T>::setSampleTime(const T sampleTime, const T derivativeFilter)
   {
+    const bool leaving = this->sampleTime > T(0) && !(sampleTime > T(0));
+    this->sampleTime = sampleTime > T(0) ? sampleTime : T(0);
+    this->derivativeFilter = derivativeFilter > T(0) ? derivativeFilter : T(0);
+    /* 切り替えた時に出力が跳ばないように、今の出力から積み上げる */
+    derivative = T(0);
+    proportionalIntegral = dutyCycle - feedforward;
+    if (leaving)
+    {
+      /* 通常のモードは積分から出力を計算するので、今の出力になるように積分を合わせ、経過時間は今から測る */
+      integral = Ki != T(0) ? (dutyCycle - feedforward - Kp * diff) / Ki : T(0);
+      preMicros = Recorder::now();
+    }
+    updateCoefficients();
+  }
+
+  template <class T>
+  void Basic_PID<T>::updateCoefficients()
+  {
+    if (sampleTime <= T(0))
+    {
+      return;
+    }
+    dt = sampleTime;
+    halfSampleTime = sampleTime * T(0.5);
+    q0 = Kp + Ki * halfSampleTime;
+    q1 = Ki * halfSampleTime - Kp;
+    /* 後退差分で離散化した1次遅れの微分 */
+    a = derivativeFilter / (derivativeFilter + sampleTime);
+    b = Kd / (derivativeFilter + sampleTime);
+  }
+
+  template <class T>
+  T Basic_PID<T>::computeFixed()
+  {
+    /* 比例と積分は差分で積み上げ、フィードフォワードとの和を出力の範囲で制限することで積分が溜まり続けないようにする */
+    T pi = proportionalIntegral + q0 * diff + q1 * preDiff;
+    const T upper = capableDutyCycle - feedforward;
+    const T lower = -capableDutyCycle - feedforward;
+    if (pi > upper)
+    {
+      pi = upper;
+    }
+    else if (pi < lower)
+    {
+      pi = lower;
+    }
+    else
+    {
+      integral += (diff + preDiff) * halfSampleTime;
+    }
+    proportionalIntegral = pi;
+
+    derivative = a * derivative + b * (diff - preDiff);
+    T output = pi + derivative + feedforward;
+    if (output > capableDutyCycle)
+    {
+      output = capableDutyCycle;
+    }
+    else if (output < -capableDutyCycle)
+    {
+      output = -capableDutyCycle;
+    }
+
+    preDiff = diff;
+    return dutyCycle = output;
+  }
+
+  template <class T>
+  T Basic_PID<T>::compute_PID(T current, const bool)
+  {
+    if (sampleTime > T(0))
+    {
+      this->current = current;
+      diff = direction ? target - current : current - target;
+      return computeFixed();
+    }
+
     /* Update dt */
-    unsigned long nowMicros = micros();
+    uint32_t nowMicros = Recorder::now();
+    uint32_t elapsed;
     if constexpr (EXCEED_MICROS_LIMIT)
     {
       if (nowMicros < preMicros)
       {
-        dt = MAX_MICROSECONDS - preMicros + nowMicros;
+        elapsed = MAX_MICROSECONDS - preMicros + nowMicros;
       }
       else
       {
-        dt = nowMicros - preMicros;
+        elapsed = nowMicros - preMicros;
       }
     }
     else
     {
-      dt = nowMicros - preMicros;
+      elapsed = nowMicros - preMicros;
     }
 
-    dt *= MICROSECONDS_TO_SECONDS;
+    dt = Scalar_traits<T>::from_micros(elapsed);
     preMicros = nowMicros;
 
     this->current = current;
@@ -38,46 +120,36 @@ namespace PID
 
     if (!direction)
     {
-      diff *= -1.0;
+      diff = -diff;
     }
 
     /* Compute dutyCycle */
-    integral += (diff + preDiff) * dt * 0.50;
-    dutyCycle = Kp * diff + Ki * integral + Kd * (diff - preDiff) / dt;
-
-    if (logging)
-    {
-      Serial.print("integral:");
-      Serial.print(integral);
-      Serial.print(",");
-    }
+    const T step = (diff + preDiff) * dt * T(0.5);
+    integral += step;
+    // 前回から時間が進んでいないとき(コンストラクタ直後の初回など)は微分項を0とする
+    const T derivative = dt > T(0) ? Kd * (diff - preDiff) / dt : T(0);
+    dutyCycle = Kp * diff + Ki * integral + derivative + feedforward;
 
     if (dutyCycle > capableDutyCycle)
     {
-      integral -= (diff + preDiff) * dt * 0.50;
+      integral -= step;
       dutyCycle = capableDutyCycle;
     }
     else if (dutyCycle < -capableDutyCycle)
     {
-      integral -= (diff + preDiff) * dt * 0.50;
+      integral -= step;
       dutyCycle = -capableDutyCycle;
     }
 
     preDiff = diff;
 
-    if (logging)
-    {
-      Serial.print("dt:");
-      Serial.print(dt, 4);
-      Serial.print(",");
-      Serial.print("current:");
-      Serial.print(current);
-      Serial.print(",target:");
-      Serial.print(target);
-      Serial.print(",diff:");
-      Serial.print(diff);
-      Serial.print(",");
-    }
     return dutyCycle;
   }
+
+  template class Basic_PID<double>;
+  template class Basic_PID<float>;
+  template class Basic_PID<Q16_16>;
+#ifdef CUBIC_HAS_Q32_32
+  template class Basic_PID<Q32_32>;
+#endif
 }
\ No newline at end of file
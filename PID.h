@@ -1,35 +1,60 @@
 #pragma once
 #include <Arduino.h>
 #include <limits.h>
+#include "cubic_scalar.h"
+#include "cubic_record.h"
 
 namespace PID
 {
     constexpr bool EXCEED_MICROS_LIMIT = false;
 
-    constexpr unsigned long MAX_MICROSECONDS = ULONG_MAX;
+    constexpr uint32_t MAX_MICROSECONDS = UINT32_MAX;
     constexpr double MICROSECONDS_TO_SECONDS = 1.0 / 1000000.0;
 
-    class PID
+    /**
+     * @brief PID制御器
+     *
+     * @tparam T 計算に使う数値型(double, float, Q16_16, Q32_32)
+     */
+    template <class T>
+    class Basic_PID
     {
     private:
-        double Kp;
-        double Ki;
-        double Kd;
-        double current;
-        double target;
-        double diff;
-        double preDiff;
-        double integral;
-        unsigned long preMicros;
-
-        double dutyCycle = 0;
-        double capableDutyCycle;
+        T Kp;
+        T Ki;
+        T Kd;
+        T current;
+        T target;
+        T diff;
+        T preDiff;
+        T integral;
+        uint32_t preMicros;
+
+        T dutyCycle = T(0);
+        T capableDutyCycle;
+        T feedforward = T(0);
 
         bool direction;
 
+        /* 周期固定モード */
+        T sampleTime = T(0);
+        T derivativeFilter = T(0);
+        T derivative = T(0);
+        T proportionalIntegral = T(0);
+        // 比例・積分の差分の係数 (q0 * diff + q1 * preDiff)
+        T q0 = T(0);
+        T q1 = T(0);
+        // 微分のフィルタの係数 (derivative = a * derivative + b * (diff - preDiff))
+        T a = T(0);
+        T b = T(0);
+        T halfSampleTime = T(0);
+
+        void updateCoefficients();
+        T computeFixed();
+
     public:
         /// @brief dt[s]
-        double dt;
+        T dt;
 
         /**
          * @brief コントローラのコンストラクタ
@@ -42,7 +67,7 @@ namespace PID
          * @param target 目標
          * @param direction 方向。trueで正方向、falseで負方向。
          */
-        PID(double capableDutyCycle, double Kp, double Ki, double Kd, double current, double target, bool direction);
+        Basic_PID(T capableDutyCycle, T Kp, T Ki, T Kd, T current, T target, bool direction);
 
         /**
          * @brief ゲインを変更する。
@@ -51,49 +76,62 @@ namespace PID
          * @param Ki 積分ゲイン
          * @param Kd 微分ゲイン
          */
-        void setGains(double Kp, double Ki, double Kd);
+        void setGains(T Kp, T Ki, T Kd);
 
         /**
          * @brief Set the Kp object
          *
          * @param Kp
          */
-        void setKp(double Kp);
+        void setKp(T Kp);
 
         /**
          * @brief Set the Ki object
          *
          * @param Ki
          */
-        void setKi(double Ki);
+        void setKi(T Ki);
 
         /**
          * @brief Set the Kd object
          *
          * @param Kd
          */
-        void setKd(double Kd);
+        void setKd(T Kd);
 
         /**
          * @brief 目標を変更する。
          *
          * @param target 目標
          */
-        void setTarget(double target);
+        void setTarget(T target);
+        /**
+         * @brief 出力の最大値を変更する。
+         *
+         * @param capableDutyCycle 出力最大Duty比（絶対値）
+         */
+        void setCapableDutyCycle(T capableDutyCycle);
+        /**
+         * @brief フィードフォワードの出力を設定する。
+         * @details 次のcompute_PID()からPIDの出力に足してから最大Duty比で制限する。積分はこの和が飽和しているときに止まる。
+         *
+         * @param feedforward Duty比
+         */
+        void setFeedforward(T feedforward);
 
         /**
          * @brief 目標を取得する。
          *
-         * @return double 目標
+         * @return T 目標
          */
-        double getTarget() const;
+        T getTarget() const;
 
         /**
          * @brief 現在値を取得する。
          *
-         * @return double 現在値
+         * @return T 現在値
          */
-        double getCurrent() const;
+        T getCurrent() const;
 
         /**
          * @brief Duty比の取得
@@ -101,7 +139,7 @@ namespace PID
          *
          * @return int duty比
          */
-        double getDutyCycle() const;
+        T getDutyCycle() const;
 
         /**
          * @brief 制御器のリセット
@@ -115,7 +153,7 @@ namespace PID
          *
          * @param target
          */
-        void reset(double target);
+        void reset(T target);
 
         /**
          * @brief 制御器のリセット
@@ -124,7 +162,7 @@ namespace PID
          * @param Ki
          * @param Kd
          */
-        void reset(double Kp, double Ki, double Kd);
+        void reset(T Kp, T Ki, T Kd);
 
         /**
          * @brief 制御器のリセット
@@ -134,75 +172,145 @@ namespace PID
          * @param Kd
          * @param target
          */
-        void reset(double Kp, double Ki, double Kd, double target);
+        void reset(T Kp, T Ki, T Kd, T target);
 
         /**
          * @brief PID制御を行う関数
          *
          * @param current 現在値
-         * @param logging ログを出力するかどうか。省略可能で、デフォルトではfalse。
+         * @param logging 互換性のために残している引数で、使われない。ログはCubic_controller::Controllerがcubic_telemetry.hで記録する。
          * @return int duty比
          */
-        double compute_PID(double current, bool logging = false);
+        T compute_PID(T current, bool logging = false);
+
+        /**
+         * @brief 周期固定モードにする。
+         * @details compute_PID()を一定周期で呼ぶ場合に使う。離散時間の係数をゲインと周期から前もって計算しておき、
+         * 各ステップでは時刻を読まず、除算もせずに、比例・積分は速度形(差分)で、微分はフィルタを通して出力を更新する。
+         * 比例・積分の和は最大Duty比で制限されるので、積分が溜まり続けることはない。
+         *
+         * @param sampleTime 周期[s]。0ならmicros()で経過時間を測る通常のモードに戻す。戻すときは今の出力になるように積分を合わせ、経過時間はこの呼び出しから測る。
+         * @param derivativeFilter 微分のローパスフィルタの時定数[s]。省略可能で、デフォルトは0(フィルタなし)。
+         */
+        void setSampleTime(T sampleTime, T derivativeFilter = T(0));
+
+        /**
+         * @brief 周期固定モードの周期を取得する。
+         *
+         * @return T 周期[s]。通常のモードなら0
+         */
+        T getSampleTime() const
+        {
+            return sampleTime;
+        }
 
         /**
          * @brief Get the Dt object
          *
-         * @return double dt[s]
+         * @return T dt[s]
          */
-        double getDt() const
+        T getDt() const
         {
             return dt;
         }
+
+        /**
+         * @brief 直前のcompute_PID()で計算した偏差を取得する。
+         *
+         * @return T 偏差(directionがfalseなら符号が反転している)
+         */
+        T getDiff() const
+        {
+            return diff;
+        }
+
+        /**
+         * @brief 偏差の積分を取得する。
+         *
+         * @return T 積分
+         */
+        T getIntegral() const
+        {
+            return integral;
+        }
     };
 
-    inline void PID::setGains(const double Kp, const double Ki, const double Kd)
+    template <class T>
+    inline void Basic_PID<T>::setGains(const T Kp, const T Ki, const T Kd)
     {
         this->Kp = Kp;
         this->Ki = Ki;
         this->Kd = Kd;
+        updateCoefficients();
     }
-    inline void PID::setKp(const double Kp)
+    template <class T>
+    inline void Basic_PID<T>::setKp(const T Kp)
     {
         this->Kp = Kp;
+        updateCoefficients();
     }
-    inline void PID::setKi(const double Ki)
+    template <class T>
+    inline void Basic_PID<T>::setKi(const T Ki)
     {
         this->Ki = Ki;
+        updateCoefficients();
     }
-    inline void PID::setKd(const double Kd)
+    template <class T>
+    inline void Basic_PID<T>::setKd(const T Kd)
     {
         this->Kd = Kd;
+        updateCoefficients();
     }
-    inline void PID::setTarget(const double target)
+    template <class T>
+    inline void Basic_PID<T>::setTarget(const T target)
     {
         this->target = target;
     }
-    inline double PID::getTarget() const
+    template <class T>
+    inline void Basic_PID<T>::setCapableDutyCycle(const T capableDutyCycle)
+    {
+        this->capableDutyCycle = capableDutyCycle;
+    }
+    template <class T>
+    inline void Basic_PID<T>::setFeedforward(const T feedforward)
+    {
+        this->feedforward = feedforward;
+    }
+    template <class T>
+    inline T Basic_PID<T>::getTarget() const
     {
         return this->target;
     }
-    inline double PID::getCurrent() const
+    template <class T>
+    inline T Basic_PID<T>::getCurrent() const
     {
         return this->current;
     }
-    inline double PID::getDutyCycle() const
+    template <class T>
+    inline T Basic_PID<T>::getDutyCycle() const
     {
         return this->dutyCycle;
     }
-    inline void PID::reset()
+    template <class T>
+    inline void Basic_PID<T>::reset()
     {
-        preMicros = micros();
-        preDiff = 0;
-        integral = 0;
+        preMicros = Recorder::now();
+        preDiff = T(0);
+        integral = T(0);
+        derivative = T(0);
+        proportionalIntegral = T(0);
+        dutyCycle = T(0);
+        updateCoefficients();
     }
-    inline void PID::reset(const double target)
+    template <class T>
+    inline void Basic_PID<T>::reset(const T target)
     {
         this->target = target;
         this->reset();
     }
 
-    inline void PID::reset(const double Kp, const double Ki, const double Kd)
+    template <class T>
+    inline void Basic_PID<T>::reset(const T Kp, const T Ki, const T Kd)
     {
         this->Kp = Kp;
         this->Ki = Ki;
@@ -210,7 +318,8 @@ namespace PID
         this->reset();
     }
 
-    inline void PID::reset(const double Kp, const double Ki, const double Kd, const double target)
+    template <class T>
+    inline void Basic_PID<T>::reset(const T Kp, const T Ki, const T Kd, const T target)
     {
         this->Kp = Kp;
         this->Ki = Ki;
@@ -219,4 +328,15 @@ namespace PID
         this->reset();
     }
 
+    /// @brief doubleで計算するPID制御器
+    typedef Basic_PID<double> PID;
+    /// @brief floatで計算するPID制御器
+    typedef Basic_PID<float> PID_f;
+
+    extern template class Basic_PID<double>;
+    extern template class Basic_PID<float>;
+    extern template class Basic_PID<Q16_16>;
+#ifdef CUBIC_HAS_Q32_32
+    extern template class Basic_PID<Q32_32>;
+#endif
 }
\ No newline at end of file
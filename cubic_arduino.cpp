@@ -1,32 +1,122 @@
 #include "cubic_arduino.h"
+#include "cubic_multiturn.h"
+#include "cubic_profiler.h"
+#include "cubic_telemetry.h"
+#include "cubic_record.h"
+#ifdef CUBIC_HOST
+#include "cubic_host.h"
+#endif
+#include <float.h>
 
 SPISettings Cubic_SPISettings = SPISettings(SPI_FREQ, MSBFIRST, SPI_MODE0);
 SPISettings ADC_SPISettings = SPISettings(ADC_SPI_FREQ, MSBFIRST, SPI_MODE0);
 
 const uint8_t Adc::ch[DC_MOTOR_NUM] = {7, 5, 6, 4, 3, 2, 0, 1};
 
-int16_t DC_motor::buf[(DC_MOTOR_NUM+SOL_SUB_NUM)*2];
-uint8_t Inc_enc::buf[INC_ENC_NUM*INC_ENC_BYTES*2];
-uint8_t Abs_enc::buf[ABS_ENC_NUM*ABS_ENC_BYTES];
-float Adc::buf[DC_MOTOR_NUM];
+CUBIC_TLS int16_t DC_motor::buf[Cubic_board::SLOT_NUM];
+CUBIC_TLS uint8_t Inc_enc::buf[INC_ENC_NUM*INC_ENC_BYTES*2];
+CUBIC_TLS uint8_t Abs_enc::buf[ABS_ENC_NUM*ABS_ENC_BYTES];
+
+CUBIC_TLS int16_t DC_motor::out[Cubic_board::SLOT_NUM];
+CUBIC_TLS uint8_t Inc_enc::back[INC_ENC_NUM*INC_ENC_BYTES*2];
+CUBIC_TLS bool Inc_enc::back_valid = false;
+CUBIC_TLS uint8_t Abs_enc::back[ABS_ENC_NUM*ABS_ENC_BYTES];
+CUBIC_TLS uint16_t Adc::back[DC_MOTOR_NUM];
+
+CUBIC_TLS bool DC_motor::_use_B = false;
+CUBIC_TLS uint8_t DC_motor::_version[2] = {CubicFrame::VERSION_LEGACY, CubicFrame::VERSION_LEGACY};
+CUBIC_TLS uint8_t DC_motor::_seq = 0;
+CUBIC_TLS bool DC_motor::_acked = false;
+CUBIC_TLS uint32_t DC_motor::_frame_errors = 0;
+CUBIC_TLS bool Solenoid::_use_B = false;
+CUBIC_TLS uint32_t Solenoid::time_prev[Cubic_board::SOLENOID_NUM];
+CUBIC_TLS Inc_enc_snapshot Inc_enc::snap;
+CUBIC_TLS Abs_enc_snapshot Abs_enc::snap;
+CUBIC_TLS Multi_turn Abs_enc::turns[ABS_ENC_NUM];
+CUBIC_TLS uint8_t Inc_enc::_version = CubicFrame::VERSION_LEGACY;
+CUBIC_TLS uint32_t Inc_enc::_frame_errors = 0;
+CUBIC_TLS uint8_t Inc_enc::burst_failures = 0;
+CUBIC_TLS bool Inc_enc::fallback_pending = false;
+CUBIC_TLS bool Inc_enc::rebase = false;
+CUBIC_TLS int32_t Inc_enc::offset[INC_ENC_NUM*2];
+CUBIC_TLS uint32_t Cubic::next_deadline;
+CUBIC_TLS unsigned int Cubic::period = 0;
+CUBIC_TLS Loop_stats Cubic::stats;
+CUBIC_TLS int32_t Adc::zero[DC_MOTOR_NUM];
+CUBIC_TLS int64_t Adc::bias_sum[DC_MOTOR_NUM];
+CUBIC_TLS uint16_t Adc::bias_count[DC_MOTOR_NUM];
+CUBIC_TLS uint16_t Adc::bias_window = ADC_BIAS_WINDOW;
+CUBIC_TLS uint32_t Adc::idle_since[DC_MOTOR_NUM];
+CUBIC_TLS uint8_t Adc::idle = 0;
+CUBIC_TLS uint8_t Adc::_calibrated = 0;
+CUBIC_TLS bool Adc::seed_pending = false;
+CUBIC_TLS int32_t Adc::state[DC_MOTOR_NUM];
+CUBIC_TLS uint8_t Adc::mask = 0xff;
+CUBIC_TLS uint8_t Adc::primed = 0;
+CUBIC_TLS uint8_t Adc::oversample_shift = 0;
+CUBIC_TLS uint8_t Adc::filter[DC_MOTOR_NUM] = {AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR, AdcFilter::IIR};
+CUBIC_TLS uint8_t Adc::filter_k[DC_MOTOR_NUM] = {3, 3, 3, 3, 3, 3, 3, 3};
+CUBIC_TLS int32_t Adc::average_buf[DC_MOTOR_NUM][ADC_AVERAGE_MAX];
+CUBIC_TLS int32_t Adc::average_sum[DC_MOTOR_NUM];
+CUBIC_TLS uint8_t Adc::average_index[DC_MOTOR_NUM];
+CUBIC_TLS float Cubic::_current_limit;
+CUBIC_TLS int32_t Overcurrent::limit_raw[DC_MOTOR_NUM];
+CUBIC_TLS int32_t Overcurrent::release_raw[DC_MOTOR_NUM];
+CUBIC_TLS uint8_t Overcurrent::i2t_mask = 0;
+CUBIC_TLS float Overcurrent::continuous2[DC_MOTOR_NUM];
+CUBIC_TLS float Overcurrent::capacity[DC_MOTOR_NUM];
+CUBIC_TLS float Overcurrent::capacity_release[DC_MOTOR_NUM];
+CUBIC_TLS float Overcurrent::_i2t[DC_MOTOR_NUM];
+CUBIC_TLS uint8_t Overcurrent::latch_mask = 0;
+CUBIC_TLS uint8_t Overcurrent::_faults = 0;
+CUBIC_TLS uint32_t Overcurrent::_trips[DC_MOTOR_NUM];
+CUBIC_TLS uint32_t Overcurrent::prev_micros = 0;
+CUBIC_TLS CubicTransfer::Job Cubic::queue[TRANSFER_QUEUE_SIZE] = {DC_motor::transmit, Abs_enc::fetch, Inc_enc::fetch, Adc::fetch};
+CUBIC_TLS int Cubic::queue_num = 4;
+CUBIC_TLS bool Cubic::in_flight = false;
+
+
+#ifndef CUBIC_HOST
+// ボードではSPIを非同期に扱えないので，その場ですべて実行する
+// (ホストでの実装はhost/cubic_host.cppにある)
+void CubicTransfer::start(const Job *jobs, const int num) {
+    for (int i = 0; i < num; i++) {
+        jobs[i]();
+    }
+}
+
+bool CubicTransfer::busy(void) {
+    return false;
+}
 
-bool DC_motor::_use_B = false;
-bool Solenoid::_use_B = false;
-unsigned long Solenoid::time_prev[SOL_SUB_NUM*2];
-int32_t Inc_enc::val_prev[INC_ENC_NUM];
-unsigned long Cubic::time_prev;
-float Adc::bias[DC_MOTOR_NUM];
-float Adc::buf_prev[DC_MOTOR_NUM];
-float Cubic::_current_limit;
+void CubicTransfer::wait(void) {
+}
+#endif
+
+uint16_t CubicFrame::crc16(const uint8_t *data, const int len, uint16_t crc) {
+    // 4bitずつ処理するための表
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+    };
+    for (int i = 0; i < len; i++) {
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0f)];
+    }
+    return crc;
+}
 
 
 void DC_motor::begin(bool use_B){
 	_use_B = use_B;
+	// 止めた状態から始める
+	memset(buf, 0, sizeof(buf));
+	memset(out, 0, sizeof(out));
     pinMode(SS_MD_A,OUTPUT);
     digitalWriteFast(Pin(SS_MD_A),HIGH);
     pinMode(ENABLE_MD_A,OUTPUT);
     digitalWriteFast(Pin(ENABLE_MD_A),HIGH);
-	if(_use_B){
+	if(DC_motor::use_B()){
 		pinMode(SS_MD_B,OUTPUT);
 		digitalWriteFast(Pin(SS_MD_B),HIGH);
     		pinMode(ENABLE_MD_B,OUTPUT);
@@ -42,7 +132,7 @@ void DC_motor::begin(bool use_B){
     digitalWriteFast(Pin(SS_MD_SS_A1),HIGH);
     digitalWriteFast(Pin(SS_MD_SS_A2),HIGH);
     digitalWriteFast(Pin(SS_MD_SS_A3),HIGH);
-	if(_use_B){
+	if(DC_motor::use_B()){
 		pinMode(SS_MD_SS_B0,OUTPUT);
 		pinMode(SS_MD_SS_B1,OUTPUT);
 		pinMode(SS_MD_SS_B2,OUTPUT);
@@ -52,69 +142,147 @@ void DC_motor::begin(bool use_B){
 		digitalWriteFast(Pin(SS_MD_SS_B2),HIGH);
 		digitalWriteFast(Pin(SS_MD_SS_B3),HIGH);
 	}
+
+    _version[0] = query_version(SS_MD_A, ENABLE_MD_A);
+    _version[1] = DC_motor::use_B() ? query_version(SS_MD_B, ENABLE_MD_B) : CubicFrame::VERSION_LEGACY;
 }
 
 void DC_motor::put(const uint8_t num, const int16_t duty, const uint16_t duty_max){
     // 想定外の入力が来たら何もしない
     if(duty_max > DUTY_SPI_MAX) return;
     if(abs(duty) > duty_max) return;
-	if(num >= (DC_MOTOR_NUM + SOL_SUB_NUM) * (_use_B ? 2:1)) return;
+	if(num >= Cubic_board::slot_num(_use_B)) return;
 
     // duty値を代入
 	buf[num] = (int16_t)((float)duty/(float)duty_max * (float)DUTY_SPI_MAX);
 }
 
+void DC_motor::put(const uint8_t *num, const int16_t *duty, const uint8_t count){
+    const uint8_t num_max = Cubic_board::slot_num(_use_B);
+    for(int i = 0; i < count; i++) {
+        if(num[i] >= num_max) continue;
+        buf[num[i]] = (int16_t)constrain((int)duty[i], -DUTY_SPI_MAX, DUTY_SPI_MAX);
+    }
+}
+
 int16_t DC_motor::get(uint8_t num) {
-	if(num >= (DC_MOTOR_NUM + SOL_SUB_NUM) * (_use_B ? 2:1)) return -1;
+	if(num >= Cubic_board::slot_num(_use_B)) return -1;
 
     return buf[num];
 }
 
 void DC_motor::send(void){
-    uint8_t *l_buf = (uint8_t*)buf;
-    uint8_t sign_buf = 0;
+    latch();
+    transmit();
+}
+
+void DC_motor::latch(void){
+    memcpy(out, buf, sizeof(out));
+    Recorder::capture_duty();
+
+    // 過電流で遮断しているメインモータは止める
+    const uint8_t faults = Overcurrent::faults();
+    if (faults) {
+        for (int i = 0; i < DC_MOTOR_NUM; i++) {
+            if (faults & (1 << i)) out[i] = 0;
+        }
+    }
+}
+
+void DC_motor::transmit(void){
+    Profile_scope profile(ProfilePhase::SEND);
+    uint8_t *l_buf = (uint8_t*)out;
+    _seq++;
+
+    _acked = send_side(SS_MD_A, ENABLE_MD_A, l_buf, _version[0]);
+
+	// B面を使わない場合はここで終了
+	if(!use_B()) return;
+    _acked &= send_side(SS_MD_B, ENABLE_MD_B, &l_buf[(DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTES], _version[1]);
+}
+
+bool DC_motor::send_side(const int ss, const int enable, const uint8_t *data, const uint8_t version){
+    const int len = (DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTES;
     SPI.beginTransaction(Cubic_SPISettings);
 
-    // A面の送信要求を受け取る
-    digitalWriteFast(Pin(ENABLE_MD_A),LOW);
-    digitalWriteFast(Pin(SS_MD_A),LOW);
-    sign_buf = SPI.transfer(0x00);
-    digitalWriteFast(Pin(ENABLE_MD_A),HIGH);
-    digitalWriteFast(Pin(SS_MD_A),HIGH);
+    if(version >= CubicFrame::VERSION_BURST){
+        // コマンド，シーケンス番号，長さ，データ，CRCを送り，最後の2バイトでスレーブの応答を受け取る
+        uint8_t frame[DC_MOTOR_FRAME_BYTES] = {};
+        frame[0] = CubicFrame::CMD_DUTY;
+        frame[1] = _seq;
+        frame[2] = len;
+        memcpy(&frame[3], data, len);
+        const uint16_t crc = CubicFrame::crc16(&frame[1], len + 2);
+        frame[3 + len] = crc >> 8;
+        frame[4 + len] = crc & 0xff;
+
+        digitalWriteFast(Pin(enable),LOW);
+        digitalWriteFast(Pin(ss),LOW);
+        SPI.transfer(frame, DC_MOTOR_FRAME_BYTES);
+        digitalWriteFast(Pin(enable),HIGH);
+        digitalWriteFast(Pin(ss),HIGH);
+        SPI.endTransaction();
+
+        if(frame[DC_MOTOR_FRAME_BYTES-2] == CubicFrame::ACK && frame[DC_MOTOR_FRAME_BYTES-1] == _seq) return true;
+        _frame_errors++;
+        return false;
+    }
+
+    // 送信要求を受け取る
+    digitalWriteFast(Pin(enable),LOW);
+    digitalWriteFast(Pin(ss),LOW);
+    uint8_t sign_buf = SPI.transfer(0x00);
+    digitalWriteFast(Pin(enable),HIGH);
+    digitalWriteFast(Pin(ss),HIGH);
     delayMicroseconds(1);
 
     // 送信要求データ（2進数で"11111111"）だったならデータを送信***スレーブからマスターへのデータ送信はデータが破損（？）するのでそれに対する応急処置。要修正***
     if(sign_buf == 0xFF){
-        for (int i = 0; i < (DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTES; i++) {
-            digitalWriteFast(Pin(SS_MD_A),LOW);
-            SPI.transfer(l_buf[i]);
-            digitalWriteFast(Pin(SS_MD_A),HIGH);
+        for (int i = 0; i < len; i++) {
+            digitalWriteFast(Pin(ss),LOW);
+            SPI.transfer(data[i]);
+            digitalWriteFast(Pin(ss),HIGH);
         }
     }
     SPI.endTransaction();
+    // 従来のプロトコルでは受信を確認できない
+    return true;
+}
 
-	// B面を使わない場合はここで終了
-	if(!_use_B) return;
+uint8_t DC_motor::query_version(const int ss, const int enable){
+    // ENABLE_MDをLOWにしておくと，従来のファームウェアは送信要求として0xFFを返すだけになる
+    const int probe_bytes = 4;
+    uint8_t rx[probe_bytes];
     SPI.beginTransaction(Cubic_SPISettings);
-    digitalWriteFast(Pin(ENABLE_MD_B),LOW);
-    digitalWriteFast(Pin(SS_MD_B),LOW);
-    sign_buf = SPI.transfer(0x00);
-    digitalWriteFast(Pin(ENABLE_MD_B),HIGH);
-    digitalWriteFast(Pin(SS_MD_B),HIGH);
-    delayMicroseconds(1);
-	if(sign_buf == 0xFF){
-        for (int i = (DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTES; i < (DC_MOTOR_NUM+SOL_SUB_NUM)*2*DC_MOTOR_BYTES; i++) {
-            digitalWriteFast(Pin(SS_MD_B),LOW);
-            SPI.transfer(l_buf[i]);
-            digitalWriteFast(Pin(SS_MD_B),HIGH);
-        }
+    digitalWriteFast(Pin(enable),LOW);
+    digitalWriteFast(Pin(ss),LOW);
+    for (int i = 0; i < probe_bytes; i++) {
+        rx[i] = SPI.transfer(i == 0 ? CubicFrame::CMD_VERSION : 0x00);
     }
+    digitalWriteFast(Pin(enable),HIGH);
+    digitalWriteFast(Pin(ss),HIGH);
     SPI.endTransaction();
+
+    if (rx[1] == CubicFrame::SYNC && rx[2] >= CubicFrame::VERSION_BURST && rx[3] == (uint8_t)~rx[2]) return CubicFrame::VERSION_BURST;
+    return CubicFrame::VERSION_LEGACY;
+}
+
+uint8_t DC_motor::version(const uint8_t side){
+    if(side >= 2) return 0;
+    return _version[side];
+}
+
+bool DC_motor::acked(void){
+    return _acked;
+}
+
+uint32_t DC_motor::frame_errors(void){
+    return _frame_errors;
 }
 
 void DC_motor::print(const bool new_line){
 	// B面を使わない場合はB面のデータを出力しない
-    for (int i = 0; i < (DC_MOTOR_NUM+SOL_SUB_NUM) * (_use_B ? 2:1); i++) {
+    for (int i = 0; i < Cubic_board::slot_num(_use_B); i++) {
         if (abs(buf[i]) == DUTY_SPI_MAX + 1 && i >= DC_MOTOR_NUM) {
             Serial.print("SOL");
         }
@@ -132,18 +300,18 @@ void DC_motor::print(const bool new_line){
 
 void Solenoid::begin(bool use_B) {
 	_use_B = use_B;
-    for (int i = 0; i < SOL_SUB_NUM*2; i++) {
+    for (int i = 0; i < Cubic_board::SOLENOID_NUM; i++) {
         time_prev[i] = millis();
     }
 }
 
 void Solenoid::put(const uint8_t num, const bool state) {
-    if (num >= SOL_SUB_NUM * (_use_B ? 2:1)) return;
+    if (num >= Cubic_board::solenoid_num(_use_B)) return;
 	bool is_B = (num >= SOL_SUB_NUM);
 	// 同じ状態を指定していた時は何もしない
 	if (DC_motor::buf[DC_MOTOR_NUM * (is_B ? 2:1) + num] == (state ? DUTY_SPI_MAX + 1 : -(DUTY_SPI_MAX + 1))) return;
 
-	unsigned long time_now = millis();
+	uint32_t time_now = millis();
 	if (time_now - time_prev[num] < SOL_TIME_MIN) return;
 
 	DC_motor::buf[DC_MOTOR_NUM * (is_B ? 2:1) + num] = (state ? DUTY_SPI_MAX + 1 : -(DUTY_SPI_MAX + 1));
@@ -151,7 +319,7 @@ void Solenoid::put(const uint8_t num, const bool state) {
 }
 
 int8_t Solenoid::get(const uint8_t num) {
-    if (num >= SOL_SUB_NUM * (_use_B ? 2:1)) return -1;
+    if (num >= Cubic_board::solenoid_num(_use_B)) return -1;
 	bool is_B = (num >= SOL_SUB_NUM);
 	int16_t raw_val = DC_motor::buf[DC_MOTOR_NUM * (is_B ? 2:1) + num];
 
@@ -159,7 +327,7 @@ int8_t Solenoid::get(const uint8_t num) {
 }
 
 void Solenoid::print(const bool new_line) {
-    for (int i = 0; i < SOL_SUB_NUM*(_use_B ? 2:1); i++) {
+    for (int i = 0; i < Cubic_board::solenoid_num(_use_B); i++) {
         int8_t val = get(i);
         if (val == -1) Serial.print("MOT");
         else           Serial.print(val);
@@ -178,45 +346,152 @@ void Inc_enc::begin(void){
 
     pinMode(INC_ENC_RESET, OUTPUT);
     digitalWriteFast(Pin(INC_ENC_RESET), HIGH);
+
+    memset(offset, 0, sizeof(offset));
+    burst_failures = 0;
+    fallback_pending = false;
+    rebase = false;
+
+    // 従来のファームウェアは問い合わせに累積値のバイトを返すので，先に累積値を0に戻して応答が0だけになるようにする
+    pulse_reset();
+
+    SPI.beginTransaction(Cubic_SPISettings);
+    _version = query_version();
+    SPI.endTransaction();
+}
+
+uint8_t Inc_enc::query_version(void){
+    // 問い合わせの1バイト目は従来のファームウェアにもデータの読み出しとして扱われる
+    const int probe_bytes = 4;
+    uint8_t rx[probe_bytes];
+    digitalWriteFast(Pin(SS_INC_ENC),LOW);
+    for (int i = 0; i < probe_bytes; i++) {
+        rx[i] = SPI.transfer(i == 0 ? CubicFrame::CMD_VERSION : 0x00);
+    }
+    digitalWriteFast(Pin(SS_INC_ENC),HIGH);
+
+    // バージョンのビット反転まで合っていれば，累積値のバイトを応答と取り違えることはない
+    if (rx[1] == CubicFrame::SYNC && rx[2] >= CubicFrame::VERSION_BURST && rx[3] == (uint8_t)~rx[2]) {
+        return CubicFrame::VERSION_BURST;
+    }
+
+    // 従来のファームウェアの送信位置が先頭に戻るように残りを読み捨てる
+    for (int i = probe_bytes; i < INC_ENC_NUM*INC_ENC_BYTES*2; i++) {
+        digitalWriteFast(Pin(SS_INC_ENC),LOW);
+        SPI.transfer(0x88);
+        digitalWriteFast(Pin(SS_INC_ENC),HIGH);
+    }
+    return CubicFrame::VERSION_LEGACY;
+}
+
+uint8_t Inc_enc::version(void){
+    return _version;
+}
+
+uint32_t Inc_enc::frame_errors(void){
+    return _frame_errors;
 }
 
 int32_t Inc_enc::get(const uint8_t num){
     if(num >= INC_ENC_NUM*2) return 1;
 
-    int32_t ret = 0;
-    ret |= buf[num*INC_ENC_BYTES];
-    ret |= buf[num*INC_ENC_BYTES+1] << 8;
-    ret |= buf[num*INC_ENC_BYTES+2] << 16;
-    ret |= buf[num*INC_ENC_BYTES+3] << 24;
-    return ret;
+    return snap.count[num];
 }
 
 int16_t Inc_enc::get_diff(const uint8_t num){
     if(num >= INC_ENC_NUM) return 1;
 
-    return get(num) - val_prev[num];
+    return snap.diff[num];
 }
 
-void Inc_enc::save_val(void){
-    for (int i = 0; i < INC_ENC_NUM; i++) {
-        val_prev[i] = get(i);
-    }
+const Inc_enc_snapshot &Inc_enc::snapshot(void){
+    return snap;
 }
 
 void Inc_enc::receive(void){
-    save_val();
+    fetch();
+    commit();
+}
 
+void Inc_enc::fetch(void){
+    Profile_scope profile(ProfilePhase::INC_ENC);
+    if (fallback_pending) {
+        // 一括読み出しが続けて失敗したので従来のプロトコルで読む
+        // 従来のファームウェアの送信位置は分からないので，累積値と一緒に0に戻す(get()の値はcommit()でつなぐ)
+        _version = CubicFrame::VERSION_LEGACY;
+        pulse_reset();
+        fallback_pending = false;
+    }
     SPI.beginTransaction(Cubic_SPISettings);
-    // データを受信
-    for (int i = 0; i < INC_ENC_NUM*INC_ENC_BYTES*2; i++) {
-        digitalWriteFast(Pin(SS_INC_ENC),LOW);
-        buf[i] = SPI.transfer(0x88);
-        digitalWriteFast(Pin(SS_INC_ENC),HIGH);
+    if (_version >= CubicFrame::VERSION_BURST) {
+        back_valid = receive_burst();
+    }
+    else {
+        // データを受信
+        for (int i = 0; i < INC_ENC_NUM*INC_ENC_BYTES*2; i++) {
+            digitalWriteFast(Pin(SS_INC_ENC),LOW);
+            back[i] = SPI.transfer(0x88);
+            digitalWriteFast(Pin(SS_INC_ENC),HIGH);
+        }
+        back_valid = true;
     }
     SPI.endTransaction();
 }
 
+void Inc_enc::commit(void){
+    // フレームが壊れていた場合は前回の値を保持する(差分値は0になる)
+    if (back_valid) memcpy(buf, back, sizeof(buf));
+
+    // 続けて失敗したら次のfetch()で従来のプロトコルに戻す
+    // 記録を流し直すときも同じ値になるように，判断は受信データだけから行う
+    if (back_valid) {
+        burst_failures = 0;
+    }
+    else if (++burst_failures == INC_ENC_BURST_FAIL_MAX) {
+        fallback_pending = true;
+        rebase = true;
+    }
+
+    // 受信したときに1度だけ復号し，get()などはsnapを読むだけにする
+    for (int i = 0; i < INC_ENC_NUM*2; i++) {
+        const uint8_t *p = &buf[i*INC_ENC_BYTES];
+        const uint32_t raw = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        // 合わせ直した後の最初の値は，前回の累積値から続ける(差分値は0になる)
+        if (rebase && back_valid) offset[i] = (int32_t)((uint32_t)snap.count[i] - raw);
+        const int32_t count = (int32_t)(raw + (uint32_t)offset[i]);
+        if (i < INC_ENC_NUM) snap.diff[i] = (int16_t)(count - snap.count[i]);
+        snap.count[i] = count;
+    }
+    if (back_valid) rebase = false;
+    snap.valid = back_valid;
+    snap.timestamp = Recorder::now();
+}
+
+bool Inc_enc::receive_burst(void){
+    // コマンドの送信中に返ってくるバイトは読み捨て，以降はフレームを連続して受信する
+    uint8_t frame[INC_ENC_FRAME_BYTES] = {};
+    digitalWriteFast(Pin(SS_INC_ENC),LOW);
+    SPI.transfer(CubicFrame::CMD_INC_BURST);
+    SPI.transfer(frame, INC_ENC_FRAME_BYTES);
+    digitalWriteFast(Pin(SS_INC_ENC),HIGH);
+
+    const int len = INC_ENC_NUM*INC_ENC_BYTES*2;
+    const uint16_t crc = (frame[INC_ENC_FRAME_BYTES-2] << 8) | frame[INC_ENC_FRAME_BYTES-1];
+    if (frame[0] != CubicFrame::SYNC || frame[1] != len || CubicFrame::crc16(&frame[1], len + 1) != crc) {
+        _frame_errors++;
+        return false;
+    }
+    memcpy(back, &frame[2], len);
+    return true;
+}
+
 void Inc_enc::reset(void){
+    pulse_reset();
+    memset(offset, 0, sizeof(offset));
+    rebase = false;
+}
+
+void Inc_enc::pulse_reset(void){
     digitalWriteFast(Pin(INC_ENC_RESET), LOW);
     delayMicroseconds(1);
     digitalWriteFast(Pin(INC_ENC_RESET), HIGH);
@@ -248,57 +523,99 @@ void Inc_enc::print_diff(const bool new_line){
 void Abs_enc::begin(void){
     pinMode(SS_ABS_ENC, OUTPUT);
     digitalWriteFast(Pin(SS_ABS_ENC), HIGH);
+
+    // 回転数は最初に正しく読めた値から数え直す
+    for (int i = 0; i < ABS_ENC_NUM; i++) {
+        turns[i] = Multi_turn();
+    }
+    // 受信前もget()がエラーを返すように，空のデータを復号しておく
+    commit();
 }
 
 uint16_t Abs_enc::get(const uint8_t num){
     if(num >= ABS_ENC_NUM) return ABS_ENC_ERR;
 
-    uint16_t ret = 0;
-    ret |= buf[num*ABS_ENC_BYTES];
-    ret |= buf[num*ABS_ENC_BYTES+1] << 8;
-
-    // RP2040で正しく読めてない場合
-    if(ret == ABS_ENC_ERR_RP2040) return ret;
+    return snap.value[num];
+}
 
-    if(!(parity_check(ret))) {
-        // Arduinoで正しく読めてない場合
-        return ABS_ENC_ERR;
-    }
-    else {
-        // 正しく読めた場合
-        return remove_parity_bit(ret);
-    }
+const Abs_enc_snapshot &Abs_enc::snapshot(void){
+    return snap;
 }
 
-bool Abs_enc::parity_check(const uint16_t enc_val) {
-    bool bit[16];
-    for (int i = 0; i < 16; i++) {
-        bit[i] = (enc_val >> i) & 1;
-    }
+const Multi_turn &Abs_enc::turn(const uint8_t num){
+    // 範囲外の番号には，値を与えていない(回転数0の)ものを返す
+    static const Multi_turn none;
+    if(num >= ABS_ENC_NUM) return none;
 
-    if (bit[15] == !(bit[13] ^ bit[11] ^ bit[9] ^ bit[7] ^ bit[5] ^ bit[3] ^ bit[1]) &&
-        bit[14] == !(bit[12] ^ bit[10] ^ bit[8] ^ bit[6] ^ bit[4] ^ bit[2] ^ bit[0])) {
-        return true;
-    }
-    return false;
+    return turns[num];
 }
 
-uint16_t Abs_enc::remove_parity_bit(const uint16_t enc_val) {
-    return enc_val & 0x3fff;
+uint8_t Abs_enc::parity_mask(const uint8_t *data) {
+    // AMT22のパリティ: bit15は奇数番目のbit，bit14は偶数番目のbitの奇数パリティ
+    // すなわち奇数番目，偶数番目のbitそれぞれの1の数が奇数なら正しい
+    // 4チャンネル分(16bit×4)を64bit整数に詰め，16bitごとに同時に畳み込む
+    uint8_t mask = 0;
+    for (int w = 0; w < ABS_ENC_NUM / 4; w++) {
+        uint64_t x = 0;
+        for (int b = 0; b < 8; b++) {
+            x |= (uint64_t)data[w*8+b] << (b*8);
+        }
+        // 偶数ビットずつずらして畳み込むと，各16bitの最下位2bitに偶数番目・奇数番目のパリティが残る
+        x ^= (x >> 8) & 0x00ff00ff00ff00ffULL;
+        x ^= (x >> 4) & 0x000f000f000f000fULL;
+        x ^= (x >> 2) & 0x0003000300030003ULL;
+        for (int c = 0; c < 4; c++) {
+            if (((x >> (c*16)) & 0x3) == 0x3) mask |= 1 << (w*4 + c);
+        }
+    }
+    return mask;
 }
 
 void Abs_enc::receive(void){
+    fetch();
+    commit();
+}
+
+void Abs_enc::fetch(void){
+    Profile_scope profile(ProfilePhase::ABS_ENC);
     SPI.beginTransaction(Cubic_SPISettings);
 
     // データを受信
     for (int i = 0; i < ABS_ENC_NUM*ABS_ENC_BYTES; i++) {
         digitalWriteFast(Pin(SS_ABS_ENC),LOW);
-        buf[i] = SPI.transfer(0x88);
+        back[i] = SPI.transfer(0x88);
         digitalWriteFast(Pin(SS_ABS_ENC),HIGH);
     }
     SPI.endTransaction();
 }
 
+void Abs_enc::commit(void){
+    memcpy(buf, back, sizeof(buf));
+
+    // 受信したときに1度だけ復号し，get()などはsnapを読むだけにする
+    const uint8_t parity = parity_mask(buf);
+    snap.valid = 0;
+    for (int i = 0; i < ABS_ENC_NUM; i++) {
+        const uint16_t raw = buf[i*ABS_ENC_BYTES] | buf[i*ABS_ENC_BYTES+1] << 8;
+        if (raw == ABS_ENC_ERR_RP2040) {
+            // RP2040で正しく読めてない場合
+            snap.value[i] = ABS_ENC_ERR_RP2040;
+        }
+        else if (!(parity & (1 << i))) {
+            // Arduinoで正しく読めてない場合
+            snap.value[i] = ABS_ENC_ERR;
+        }
+        else {
+            // 正しく読めた場合はパリティビットを取り除く
+            snap.value[i] = raw & 0x3fff;
+            snap.angle[i] = snap.value[i] * (float)(TWO_PI / (ABS_ENC_MAX + 1));
+            snap.valid |= 1 << i;
+            turns[i].update(snap.value[i]);
+        }
+    }
+    snap.timestamp = Recorder::now();
+}
+
 void Abs_enc::print(const bool new_line) {
     for (int i = 0; i < ABS_ENC_NUM; i++) {
         uint16_t val = get(i);
@@ -321,46 +638,171 @@ void Adc::begin(void) {
     digitalWriteFast(Pin(SS_ADC_A),HIGH);
     digitalWriteFast(Pin(SS_ADC_B),HIGH);
     
-    // バイアス項を求める
-    const int vrfy_num = 10;
-    float temp[DC_MOTOR_NUM];
-    for(int i = 0; i < DC_MOTOR_NUM; i++) bias[i] = temp[i] = 0.0;
-    for(int i = 0; i < vrfy_num; i++) {
-        receive();
-        for(int j = 0; j < DC_MOTOR_NUM; j++) {
-            temp[j] += buf[j];
-        }
+    // バイアスはupdate()のたびにDutyが0の間の値から求める
+    // 求めるまでは最初の受信の値を電流0とする(それまではADCの中央値)
+    for(int i = 0; i < DC_MOTOR_NUM; i++) {
+        zero[i] = (int32_t)CURRENT_RES << ADC_FRAC_BITS;
+        bias_sum[i] = 0;
+        bias_count[i] = 0;
     }
-    for(int i = 0; i < DC_MOTOR_NUM; i++) bias[i] = -temp[i] / vrfy_num;
+    idle = 0;
+    _calibrated = 0;
+    seed_pending = true;
+    // フィルタは最初の受信で初期化する
+    primed = 0;
 }
 
 float Adc::get(uint8_t num) {
     if (num >= DC_MOTOR_NUM) return 0;
-    return buf[num];
+    if (!(mask & (1 << num))) return 0;
+    return to_current(num);
 }
 
 void Adc::receive(void) {
+    fetch();
+    commit();
+}
+
+void Adc::set_channels(const uint8_t mask) {
+    // 新しく受信するチャンネルは，次の値でフィルタを初期化する
+    primed &= mask;
+    Adc::mask = mask;
+}
+
+uint8_t Adc::channels(void) {
+    return mask;
+}
+
+void Adc::set_oversampling(const uint8_t count) {
+    uint8_t shift = 0;
+    while ((2 << shift) <= count && (2 << shift) <= ADC_OVERSAMPLE_MAX) shift++;
+    oversample_shift = shift;
+}
+
+void Adc::set_filter(const uint8_t num, const uint8_t filter, const uint8_t k) {
+    if (num >= DC_MOTOR_NUM) return;
+    int max_k = 0;
+    while ((2 << max_k) <= ADC_AVERAGE_MAX) max_k++;
+    Adc::filter[num] = filter;
+    const int k_max = filter == AdcFilter::AVERAGE ? max_k : ADC_FRAC_BITS;
+    Adc::filter_k[num] = k > k_max ? k_max : k;
+    // 次の値でフィルタを初期化する
+    primed &= ~(1 << num);
+}
+
+void Adc::set_calibration(const uint16_t window) {
+    bias_window = window;
+    // 途中までのサンプルは捨てる
+    for(int i = 0; i < DC_MOTOR_NUM; i++) {
+        bias_sum[i] = 0;
+        bias_count[i] = 0;
+    }
+}
+
+uint8_t Adc::calibrated(void) {
+    return _calibrated;
+}
+
+void Adc::fetch(void) {
+    Profile_scope profile(ProfilePhase::ADC);
     SPI.beginTransaction(ADC_SPISettings);
+    const int samples = 1 << oversample_shift;
     for(int i = 0; i < DC_MOTOR_NUM; i++) {
-        byte channelDataH2 = (ch[i] >> 2) | 0x06;
-        byte channelDataL2 = ch[i] << 6;
-
-        digitalWriteFast(Pin(SS_ADC_A), LOW);
-        digitalWriteFast(Pin(SS_ADC_B), LOW);
-        SPI.transfer(channelDataH2);                  // Start bit 1 + D2bit
-        unsigned int highByte = SPI.transfer(channelDataL2);  // singleEnd D1,D0 bit
-        unsigned int lowByte = SPI.transfer(0x00);            // dummy
-        digitalWriteFast(Pin(SS_ADC_A), HIGH);
-        digitalWriteFast(Pin(SS_ADC_B), HIGH);
-
-        unsigned int data = ((highByte & 0x0f) << 8) | lowByte;
-        float raw_val = (float)(data - CURRENT_RES)/CURRENT_RES * CURRENT_MAX + bias[i];
-        buf[i] = 0.1*raw_val + 0.9*buf_prev[i]; // ローパスフィルタ
-        buf_prev[i] = buf[i];
+        if (!(mask & (1 << i))) continue;
+        uint16_t sum = 0;
+        for(int j = 0; j < samples; j++) {
+            // Start bit 1 + D2bit，singleEnd D1,D0 bit，dummy
+            uint8_t frame[3] = {(uint8_t)((ch[i] >> 2) | 0x06), (uint8_t)(ch[i] << 6), 0x00};
+
+            digitalWriteFast(Pin(SS_ADC_A), LOW);
+            digitalWriteFast(Pin(SS_ADC_B), LOW);
+            SPI.transfer(frame, 3);
+            digitalWriteFast(Pin(SS_ADC_A), HIGH);
+            digitalWriteFast(Pin(SS_ADC_B), HIGH);
+
+            sum += ((frame[1] & 0x0f) << 8) | frame[2];
+        }
+        back[i] = sum;
     }
     SPI.endTransaction();
 }
 
+void Adc::commit(void) {
+    for(int i = 0; i < DC_MOTOR_NUM; i++) {
+        if (!(mask & (1 << i))) continue;
+        // オーバーサンプリングの合計を，小数部ADC_FRAC_BITSビットの平均値にする
+        const int32_t x = (int32_t)back[i] << (ADC_FRAC_BITS - oversample_shift);
+        const uint8_t bit = 1 << i;
+        const uint8_t k = filter_k[i];
+
+        calibrate(i, x);
+
+        if (!(primed & bit)) {
+            // 最初の値でフィルタを初期化する
+            state[i] = x;
+            for (int j = 0; j < ADC_AVERAGE_MAX; j++) average_buf[i][j] = x;
+            average_sum[i] = x << k;
+            average_index[i] = 0;
+            primed |= bit;
+            continue;
+        }
+
+        switch (filter[i]) {
+            case AdcFilter::IIR:
+                state[i] += (x - state[i]) >> k;
+                break;
+            case AdcFilter::AVERAGE:
+                average_sum[i] += x - average_buf[i][average_index[i]];
+                average_buf[i][average_index[i]] = x;
+                average_index[i] = (average_index[i] + 1) & ((1 << k) - 1);
+                state[i] = average_sum[i] >> k;
+                break;
+            default:
+                state[i] = x;
+                break;
+        }
+    }
+    seed_pending = false;
+}
+
+void Adc::calibrate(const uint8_t num, const int32_t x) {
+    const uint8_t bit = 1 << num;
+    // 受信した値は，直前に送信したDutyで流れた電流
+    // 過電流で止めている間は電流が残っていることがあるので，指令値も0のときだけ使う
+    const bool busy = DC_motor::out[num] != 0 || DC_motor::buf[num] != 0;
+
+    // begin()の後の最初の値は，まだモータに電流を流していないので仮のバイアスにする
+    // ADCの中央値のままだと，センサのオフセットをOvercurrentが電流と見て，バイアスを求める前に遮断しかねない
+    if (seed_pending && !busy && bias_window != 0 && !(_calibrated & bit)) zero[num] = x;
+
+    if (busy) {
+        idle &= ~bit;
+        return;
+    }
+    const uint32_t now = Recorder::now();
+    if (!(idle & bit)) {
+        idle |= bit;
+        idle_since[num] = now;
+    }
+    if (bias_window == 0 || now - idle_since[num] < ADC_BIAS_SETTLE_MICROS) return;
+
+    bias_sum[num] += x;
+    if (++bias_count[num] >= bias_window) {
+        zero[num] = (int32_t)(bias_sum[num] / bias_count[num]);
+        bias_sum[num] = 0;
+        bias_count[num] = 0;
+        _calibrated |= bit;
+    }
+}
+
+float Adc::to_current(const uint8_t num) {
+    return (float)(state[num] - zero[num]) * ADC_CURRENT_SCALE;
+}
+
+void Adc::get_raw_all(int32_t *raw) {
+    for(int i = 0; i < DC_MOTOR_NUM; i++) raw[i] = (mask & (1 << i)) ? state[i] - zero[i] : 0;
+}
+
 void Adc::print(const bool new_line){
     for (int i = 0; i < DC_MOTOR_NUM; i++) {
         Serial.print(get(i));
@@ -373,6 +815,123 @@ void Adc::print(const bool new_line){
 }
 
 
+void Overcurrent::begin(const float limit){
+    for (int i = 0; i < DC_MOTOR_NUM; i++) {
+        set_limit(i, limit);
+        set_i2t(i, 0, 0);
+        _trips[i] = 0;
+    }
+    latch_mask = 0;
+    _faults = 0;
+    prev_micros = 0;
+}
+
+void Overcurrent::set_limit(const uint8_t num, const float limit){
+    if (num >= DC_MOTOR_NUM) return;
+    // 受信のたびに電流値へ変換しないように，閾値の方をstateとバイアスの差の単位にしておく
+    const float raw = limit / ADC_CURRENT_SCALE;
+    if (limit <= 0 || raw >= (float)INT32_MAX) {
+        limit_raw[num] = release_raw[num] = INT32_MAX;
+        return;
+    }
+    limit_raw[num] = (int32_t)raw;
+    release_raw[num] = (int32_t)(raw * OVERCURRENT_RELEASE);
+}
+
+void Overcurrent::set_i2t(const uint8_t num, const float continuous, const float capacity){
+    if (num >= DC_MOTOR_NUM) return;
+    continuous2[num] = continuous * continuous;
+    // 無効なら積算値が許容量を超えないようにする
+    Overcurrent::capacity[num] = capacity > 0 ? capacity : FLT_MAX;
+    capacity_release[num] = capacity > 0 ? capacity * OVERCURRENT_I2T_RELEASE : FLT_MAX;
+    _i2t[num] = 0;
+    if (capacity > 0) i2t_mask |= 1 << num;
+    else              i2t_mask &= ~(1 << num);
+}
+
+void Overcurrent::set_latch(const uint8_t num, const bool latch){
+    if (num >= DC_MOTOR_NUM) return;
+    if (latch) latch_mask |= 1 << num;
+    else       latch_mask &= ~(1 << num);
+}
+
+uint8_t Overcurrent::faults(void){
+    return _faults;
+}
+
+bool Overcurrent::fault(const uint8_t num){
+    if (num >= DC_MOTOR_NUM) return false;
+    return _faults & (1 << num);
+}
+
+uint32_t Overcurrent::trips(const uint8_t num){
+    if (num >= DC_MOTOR_NUM) return 0;
+    return _trips[num];
+}
+
+float Overcurrent::i2t(const uint8_t num){
+    if (num >= DC_MOTOR_NUM) return 0;
+    return _i2t[num];
+}
+
+void Overcurrent::clear(const uint8_t num){
+    if (num >= DC_MOTOR_NUM) return;
+    _faults &= ~(1 << num);
+}
+
+void Overcurrent::clear(void){
+    _faults = 0;
+}
+
+void Overcurrent::check(const int32_t *raw){
+    const uint32_t now = Recorder::now();
+    const float dt = prev_micros ? (now - prev_micros) * 1e-6f : 0;
+    prev_micros = now;
+
+    // 瞬時の閾値は整数のまま比べる。分岐を持たないので，全チャンネルをまとめて比べられる
+    uint8_t over = 0, under = 0;
+    for (int i = 0; i < DC_MOTOR_NUM; i++) {
+        const int32_t a = raw[i] < 0 ? -raw[i] : raw[i];
+        over  |= (a > limit_raw[i]) << i;
+        under |= (a < release_raw[i]) << i;
+    }
+
+    // I2tを有効にしたモータだけ電流値(A)にして積算する
+    uint8_t heat = 0, cool = 0xff;
+    if (i2t_mask) {
+        for (int i = 0; i < DC_MOTOR_NUM; i++) {
+            if (!(i2t_mask & (1 << i))) continue;
+            const float current = raw[i] * ADC_CURRENT_SCALE;
+            const float acc = _i2t[i] + (current * current - continuous2[i]) * dt;
+            _i2t[i] = acc > 0 ? acc : 0;
+            heat |= (_i2t[i] > capacity[i]) << i;
+            cool &= ~((_i2t[i] >= capacity_release[i]) << i);
+        }
+    }
+
+    const uint8_t tripped = over | heat;
+    const uint8_t fresh = tripped & ~_faults;
+    if (fresh) {
+        for (int i = 0; i < DC_MOTOR_NUM; i++) {
+            if (fresh & (1 << i)) _trips[i]++;
+        }
+    }
+    // ラッチしないモータは，電流とI2tの両方が十分に下がったら復帰する
+    _faults = (_faults | tripped) & ~(under & cool & ~tripped & ~latch_mask);
+}
+
+void Overcurrent::print(const bool new_line){
+    for (int i = 0; i < DC_MOTOR_NUM; i++) {
+        Serial.print(fault(i) ? 1 : 0);
+        Serial.print(" ");
+    }
+    if (new_line == true)
+        Serial.println();
+    else
+        Serial.print(" ");
+}
+
+
 void Cubic::begin(bool use_B, const float current_limit){
     // Cubicの動作開始
     pinMode(ENABLE,OUTPUT);
@@ -402,33 +961,166 @@ void Cubic::begin(bool use_B, const float current_limit){
     Adc::begin();
     // 電流の許容値を設定
     _current_limit = abs(current_limit);
+    Overcurrent::begin(_current_limit);
 
-    // ループ前の時刻を記録
-    time_prev = micros();
+    // 最初のupdate()の時刻から締め切りを数え始める
+    period = 0;
 
     Cubic::update();
     Cubic::update();
     Cubic::update();
+    reset_loop_stats();
 }
 
 void Cubic::update(const unsigned int us) {
-    // ここに電流値によるチェックを入れる
-    // for(int i = 0; i < DC_MOTOR_NUM; i++) {
-    //     if(abs(Adc::get(i)) > _current_limit) {
-    //         DC_motor::put(i, 0);
-    //     }
-    // }
+#ifdef CUBIC_HOST
+    // 記録を流し直している間は，送受信と周期待ちをせずに記録した受信データを反映する
+    if(Recorder::playing()) {
+        DC_motor::latch();
+        commit();
+        return;
+    }
+    // 直結モードでは，SPIのバイト列を模擬せずにボードのモデルと直接やり取りする
+    if(Cubic_host::Direct_link *link = Cubic_host::direct()) {
+        DC_motor::latch();
+        link->send();
+        wait_period(us);
+        link->receive();
+        commit();
+        return;
+    }
+#endif
+    // 過電流で遮断しているモータは送信時に止める(Overcurrent)
     DC_motor::send();
 
-    unsigned long time_now = micros();
-    unsigned int dt;
-    if(time_now < time_prev) dt = time_now + MICROS_MAX - time_prev;
-    else                     dt = time_now - time_prev;
-    time_prev = time_now;
+    wait_period(us);
+
+    Abs_enc::fetch();
+    Inc_enc::fetch();
+    Adc::fetch();
+    commit();
+}
+
+void Cubic::commit(void) {
+    Profile_scope profile(ProfilePhase::DECODE);
+#ifdef CUBIC_HOST
+    if(Recorder::playing()) Recorder::play_next();
+#endif
+    Recorder::capture();
+    Abs_enc::commit();
+    Inc_enc::commit();
+    Adc::commit();
+    int32_t raw[DC_MOTOR_NUM];
+    Adc::get_raw_all(raw);
+    Overcurrent::check(raw);
+}
+
+void Cubic::wait_period(const unsigned int us) {
+    if(us == 0) return;
+    Profile_scope profile(ProfilePhase::SLEEP);
+
+    uint32_t now = micros();
+    // 周期が変わったら今の時刻から数え直す
+    if(us != period) {
+        period = us;
+        next_deadline = now + us;
+    }
+
+    // 差を符号付きで見ることでmicros()のオーバーフローをまたいでも正しく比較できる
+    int32_t remaining = (int32_t)(next_deadline - now);
+    if(remaining < 0) {
+        stats.overruns++;
+        if((uint32_t)(-remaining) > stats.late_max) stats.late_max = -remaining;
+        // 1周期以上遅れていたら，遅れを取り戻そうとせずに今の時刻から数え直す
+        if((uint32_t)(-remaining) >= us) next_deadline = now;
+    }
+    // 空き時間にテレメトリを送る
+    if(remaining > 0) {
+        Telemetry::drain(next_deadline);
+        Recorder::drain(next_deadline);
+        now = micros();
+        remaining = (int32_t)(next_deadline - now);
+    }
+    // delayMicroseconds()の精度に依らないように，残り時間を測り直しながら待つ
+    while(remaining > 0) {
+        delayMicroseconds(remaining);
+        now = micros();
+        remaining = (int32_t)(next_deadline - now);
+    }
+
+    const int32_t jitter = (int32_t)(now - next_deadline);
+    if(stats.cycles == 0 || jitter < stats.jitter_min) stats.jitter_min = jitter;
+    if(stats.cycles == 0 || jitter > stats.jitter_max) stats.jitter_max = jitter;
+    stats.jitter_sum += jitter;
+    stats.cycles++;
+
+    next_deadline += us;
+}
+
+const Loop_stats &Cubic::loop_stats(void) {
+    return stats;
+}
+
+void Cubic::reset_loop_stats(void) {
+    stats = Loop_stats();
+}
+
+void Cubic::print_loop_stats(const bool new_line) {
+    Serial.print("cycles:");
+    Serial.print(stats.cycles);
+    Serial.print(" overruns:");
+    Serial.print(stats.overruns);
+    Serial.print(" late_max:");
+    Serial.print(stats.late_max);
+    Serial.print(" jitter:");
+    Serial.print(stats.jitter_min);
+    Serial.print("/");
+    Serial.print(stats.jitter_mean());
+    Serial.print("/");
+    Serial.print(stats.jitter_max);
+    if (new_line == true)
+        Serial.println();
+    else
+        Serial.print(" ");
+}
+
+void Cubic::update_begin(const unsigned int us) {
+    // 前回の送受信が終わっていなければ先に反映する
+    if(in_flight) update_end();
+
+#ifdef CUBIC_HOST
+    // 記録を流し直している間は，update_end()で記録した受信データを反映する
+    if(Recorder::playing()) {
+        DC_motor::latch();
+        in_flight = true;
+        return;
+    }
+#endif
+    wait_period(us);
 
-    if(us > dt) delayMicroseconds((us - dt)*2); // なぜか2倍すると正しい周期になる
+    // compute()中にput()されても送信データが混ざらないように控えに写してから送る
+    DC_motor::latch();
+    CubicTransfer::start(queue, queue_num);
+    in_flight = true;
+}
+
+bool Cubic::update_ready(void) {
+    return !in_flight || !CubicTransfer::busy();
+}
+
+void Cubic::update_end(void) {
+    if(!in_flight) return;
+    {
+        Profile_scope profile(ProfilePhase::WAIT);
+        CubicTransfer::wait();
+    }
+    in_flight = false;
+
+    commit();
+}
 
-    Abs_enc::receive();
-    Inc_enc::receive();
-    Adc::receive();
+bool Cubic::add_transfer(const CubicTransfer::Job job) {
+    if(queue_num >= TRANSFER_QUEUE_SIZE) return false;
+    queue[queue_num++] = job;
+    return true;
 }
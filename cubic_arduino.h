@@ -5,6 +5,21 @@
 #include "33BLE_digitalWriteFast.hpp"
 using namespace nano33BLE_digitalWriteFast;
 
+// ホストビルドでは，スレッドごとに独立したCubicを動かせるように，各クラスの状態をスレッドごとに持つ
+#ifdef CUBIC_HOST
+#define CUBIC_TLS thread_local
+#else
+#define CUBIC_TLS
+#endif
+
+#ifdef CUBIC_HOST
+// ホストのボードのモデル(host/cubic_slave.h)は，直結モードで送受信のバッファを直接読み書きする
+namespace Cubic_host { class Board_model; }
+#endif
+
+// アブソリュートエンコーダの回転数を数えるクラス(cubic_multiturn.h)
+class Multi_turn;
+
 // 各種ENABLEをHIGHにすることによって動作開始
 constexpr int ENABLE = 7;
 constexpr int ENABLE_MD_A = 2; // A面のモータドライバのENABLE、スレーブからマスターへデータを送る時LOWにしないといけないピン
@@ -47,6 +62,44 @@ constexpr int DC_MOTOR_BYTES = 2;
 constexpr int INC_ENC_BYTES = 4;
 constexpr int ABS_ENC_BYTES = 2;
 
+/**
+ * ボードの構成をコンパイル時に決める設定
+ * DC_motorとSolenoidのバッファの大きさ，番号の範囲の確認，ループの回数をここから決める。
+ * B面を使わない構成では，B面のバッファと送信などの処理はコンパイル時に消える。
+ * 1面あたりのモータとソレノイドの数はモータドライバとのフレームで決まっているので，DC_MOTOR_NUMとSOL_SUB_NUMのまま。
+ * @tparam UseB B面のモータドライバを使うかどうか(Dynamicならバッファを確保するかどうか)
+ * @tparam Dynamic B面を使うかどうかをCubic::begin()の引数で実行時に決めるかどうか
+ */
+template <bool UseB, bool Dynamic = false>
+struct CubicBoard {
+    static_assert(UseB || !Dynamic, "Dynamic needs the buffers for side B");
+
+    // バッファを確保する面の数
+    static constexpr int SIDE_NUM = UseB ? 2 : 1;
+    // DC_motor::put()の番号の数(各面のメインモータとサブチャンネル)
+    static constexpr int SLOT_NUM = (DC_MOTOR_NUM + SOL_SUB_NUM) * SIDE_NUM;
+    // Solenoid::put()の番号の数
+    static constexpr int SOLENOID_NUM = SOL_SUB_NUM * SIDE_NUM;
+
+    // B面を使うかどうか。Dynamicでなければselectedによらず定数になる
+    static constexpr bool use_B(const bool selected) { return Dynamic ? selected : UseB; }
+    // 使う面のモータの番号の数
+    static constexpr int slot_num(const bool selected) { return (DC_MOTOR_NUM + SOL_SUB_NUM) * (use_B(selected) ? 2 : 1); }
+    // 使う面のソレノイドの番号の数
+    static constexpr int solenoid_num(const bool selected) { return SOL_SUB_NUM * (use_B(selected) ? 2 : 1); }
+};
+
+// B面のモータドライバを使うかどうか
+// CUBIC_USE_B=0: A面のみ，1: A面とB面，未定義: Cubic::begin()の引数で決める(両面分のバッファを持つ)
+// PlatformIOではbuild_flagsに-DCUBIC_USE_B=0のように書く
+#if !defined(CUBIC_USE_B)
+typedef CubicBoard<true, true> Cubic_board;
+#elif CUBIC_USE_B
+typedef CubicBoard<true> Cubic_board;
+#else
+typedef CubicBoard<false> Cubic_board;
+#endif
+
 // SPI通信におけるDCモータのDutyの最大値
 constexpr int DUTY_SPI_MAX = 32766;
 
@@ -55,6 +108,27 @@ constexpr float CURRENT_MAX = 30.0;
 // 電流センサの分解能(-2048 ~ 2048)
 constexpr float CURRENT_RES = 2048;
 
+// ADCの1回の受信で各チャンネルを変換する最大回数(オーバーサンプリング)
+constexpr int ADC_OVERSAMPLE_MAX = 16;
+// ADCの値をフィルタで扱うときの小数部のビット数
+constexpr int ADC_FRAC_BITS = 8;
+// フィルタ済みの値とバイアスの差1あたりの電流値(A)
+constexpr float ADC_CURRENT_SCALE = CURRENT_MAX / CURRENT_RES / (1 << ADC_FRAC_BITS);
+// ADCの移動平均で平均する最大の個数
+constexpr int ADC_AVERAGE_MAX = 16;
+
+// 電流のバイアスを求めるときに平均するサンプル数のデフォルト
+constexpr uint16_t ADC_BIAS_WINDOW = 64;
+// Dutyが0になってから電流が落ち着くまで，バイアスを求めるのを待つ時間[us]
+constexpr uint32_t ADC_BIAS_SETTLE_MICROS = 5000;
+
+// ADCのフィルタの種類
+namespace AdcFilter {
+	constexpr uint8_t NONE = 0;    // フィルタなし
+	constexpr uint8_t IIR = 1;     // y += (x - y) / 2^k
+	constexpr uint8_t AVERAGE = 2; // 直近2^k個の移動平均
+}
+
 // アブソリュートエンコーダの取り得る最大値
 constexpr float ABS_ENC_MAX = 16383;
 // RP2040でアブソリュートエンコーダが正しく読めなかったときに返す値
@@ -65,10 +139,60 @@ constexpr int ABS_ENC_ERR = 0xffff;
 // インクリメントエンコーダのRP2040のリセットピン(LOW:reset HIGH:start)
 constexpr int INC_ENC_RESET = 0;
 
+// RP2040とのフレーム通信の定義
+namespace CubicFrame {
+	constexpr uint8_t SYNC = 0xA5;          // フレームの先頭を示すバイト
+	constexpr uint8_t CMD_VERSION = 0xB1;   // プロトコルバージョンの要求(応答はSYNC，バージョン，バージョンのビット反転)
+	constexpr uint8_t CMD_INC_BURST = 0xB2; // インクリメントエンコーダの一括読み出し
+	constexpr uint8_t CMD_DUTY = 0xB3;      // モータドライバへのDutyの一括送信
+	constexpr uint8_t ACK = 0x06;           // Dutyフレームを正しく受信した
+	constexpr uint8_t NAK = 0x15;           // Dutyフレームが壊れていた
+
+	// 1バイトごとにSSを切り替える従来のプロトコル
+	constexpr uint8_t VERSION_LEGACY = 1;
+	// SSを1回だけ下げ，ヘッダとCRCの付いたフレームで一括して送受信するプロトコル
+	constexpr uint8_t VERSION_BURST = 2;
+
+	/**
+	 * CRC-16/CCITT-FALSE(多項式0x1021)を計算する関数
+	 * @param data データ
+	 * @param len バイト数
+	 * @param crc 初期値(続きを計算する場合は前回の戻り値)
+	 */
+	uint16_t crc16(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+}
+
+// インクリメントエンコーダの一括読み出しフレームのバイト数(同期バイト，長さ，データ，CRC)
+constexpr int INC_ENC_FRAME_BYTES = 2 + INC_ENC_NUM*INC_ENC_BYTES*2 + 2;
+
+// 一括読み出しがこの回数続けて失敗したら，従来のプロトコルに戻して送信位置を合わせ直す
+constexpr uint8_t INC_ENC_BURST_FAIL_MAX = 8;
+
+// モータドライバへのDutyフレームのバイト数
+// コマンド，シーケンス番号，長さ，データ，CRC，スレーブの応答待ち1バイト，応答(ACK/NAKとシーケンス番号)
+constexpr int DC_MOTOR_FRAME_BYTES = 3 + (DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTES + 2 + 1 + 2;
+
 // ソレノイドの出力を切り替える最小時間(ms)
 constexpr float SOL_TIME_MIN = 10.0;
-// micros()で測れる最大時間
-constexpr int MICROS_MAX = 0xffffffff;
+
+// Cubic::update_begin()で実行するSPI転送の最大数
+constexpr int TRANSFER_QUEUE_SIZE = 8;
+
+// SPI転送キューを実行するエンジン
+namespace CubicTransfer {
+	// 1つのSPI転送(送受信バッファの控えとの間でやり取りする関数)
+	typedef void (*Job)(void);
+
+	// ジョブを順に実行し始める
+	// ボードではその場ですべて実行する。ホストではバスの所要時間を模擬し，時刻を進めずに完了時刻を記録する
+	void start(const Job *jobs, int num);
+
+	// 実行中のジョブが残っているかどうか
+	bool busy(void);
+
+	// すべてのジョブが完了するまで待つ
+	void wait(void);
+}
 
 class DC_motor {
     public:
@@ -86,25 +210,82 @@ class DC_motor {
 		 */
         static void put(uint8_t num, int16_t duty, uint16_t duty_max = 1000);
 
+        /**
+		 * 複数のモータのDutyをまとめて格納する関数
+		 * @param num モータ番号の配列
+		 * @param duty デューティ比(DUTY_SPI_MAXに対する値)の配列。範囲外の値は±DUTY_SPI_MAXに丸める
+		 * @param count 配列の要素数
+		 */
+        static void put(const uint8_t *num, const int16_t *duty, uint8_t count);
+
         // 指定したモータのDutyを取得する関数
         // 第1引数：モータ番号0~11
         static int16_t get(uint8_t num);
 
         // すべてのモータのDutyをSPI通信で送信する関数
+        // モータドライバがCubicFrame::VERSION_BURSTに対応していれば，各面1回のSSでCRC付きのフレームを送り応答を確認する
         static void send(void);
 
+        // モータドライバと取り決めたプロトコルバージョンを取得する関数
+        // 第1引数：面(0:A面，1:B面)
+        static uint8_t version(uint8_t side = 0);
+
+        // 直前のsend()ですべての面のフレームにACKが返ってきたかどうか
+        static bool acked(void);
+
+        // ACKが返ってこなかった(NAK，シーケンス番号の不一致，無応答)回数を取得する関数
+        static uint32_t frame_errors(void);
+
         // すべてのモータのDutyの値をSerial.print()で表示する関数
         // ソレノイドの状態を出力している場合はSOLと表示される
         static void print(bool new_line = false);
 
         // RP2040への送信データを格納する配列
-		// 前半12個の要素がA面のデータ、後半12個の要素がB面のデータ
+		// 前半12個の要素がA面のデータ、後半12個の要素がB面のデータ(Cubic_boardでB面を使わない場合は無い)
         // ソレノイドを使用する場合は各面のデータの後ろ4つの要素を使用する
-        static int16_t buf[(DC_MOTOR_NUM+SOL_SUB_NUM)*2];
+        static CUBIC_TLS int16_t buf[Cubic_board::SLOT_NUM];
+
+        // B面のモータドライバを使うかどうか(Cubic_boardで決めている場合は定数)
+        static bool use_B(void) { return Cubic_board::use_B(_use_B); }
 
 	private:
-		// B面のモータドライバを使うかどうか
-		static bool _use_B;
+		// begin()で指定した，B面のモータドライバを使うかどうか
+		static CUBIC_TLS bool _use_B;
+
+		// 各面のモータドライバと取り決めたプロトコルバージョン
+		static CUBIC_TLS uint8_t _version[2];
+
+		// Dutyフレームのシーケンス番号
+		static CUBIC_TLS uint8_t _seq;
+
+		// 直前のsend()でACKが返ってきたかどうか
+		static CUBIC_TLS bool _acked;
+
+		// ACKが返ってこなかった回数
+		static CUBIC_TLS uint32_t _frame_errors;
+
+		// モータドライバにプロトコルバージョンを問い合わせる関数
+		static uint8_t query_version(int ss, int enable);
+
+		// 1面分のDutyを送信する関数
+		// 第1引数：SS，第2引数：ENABLE，第3引数：送信データ
+		static bool send_side(int ss, int enable, const uint8_t *data, uint8_t version);
+
+		// 送信中のDuty(bufの控え)
+		static CUBIC_TLS int16_t out[Cubic_board::SLOT_NUM];
+
+		// bufをoutに写す関数
+		static void latch(void);
+
+		// outを送信する関数
+		static void transmit(void);
+
+		friend class Cubic;
+		friend class Adc;
+		friend class Recorder;
+#ifdef CUBIC_HOST
+		friend class Cubic_host::Board_model;
+#endif
 };
 
 class Solenoid {
@@ -127,15 +308,40 @@ class Solenoid {
 
     private:
         // 状態を変更した時刻を保存する配列
-        static unsigned long time_prev[SOL_SUB_NUM*2];
+        static CUBIC_TLS uint32_t time_prev[Cubic_board::SOLENOID_NUM];
+
+		// begin()で指定した，B面のモータドライバを使うかどうか
+		static CUBIC_TLS bool _use_B;
+};
 
-		// B面のモータドライバを使うかどうか
-		static bool _use_B;
+// Inc_enc::receive()で復号したインクリメントエンコーダの値
+struct Inc_enc_snapshot {
+    // 累積値
+    int32_t count[INC_ENC_NUM*2];
+    // 1つ前のreceive()からの差分値
+    int16_t diff[INC_ENC_NUM];
+    // 今回のデータを正しく受信できたかどうか(falseなら累積値は前回のまま，差分値は0)
+    bool valid;
+    // 復号したときのmicros()
+    uint32_t timestamp;
+};
+
+// Abs_enc::receive()で復号したアブソリュートエンコーダの値
+struct Abs_enc_snapshot {
+    // パリティビットを除いた値。読めなかった場合はABS_ENC_ERR_RP2040またはABS_ENC_ERR
+    uint16_t value[ABS_ENC_NUM];
+    // 正しく読めたエンコーダのビットを立てたもの
+    uint8_t valid;
+    // 角度(0 ~ 2π)。読めなかったエンコーダは最後に読めた角度のまま
+    float angle[ABS_ENC_NUM];
+    // 復号したときのmicros()
+    uint32_t timestamp;
 };
 
 class Inc_enc{
     public:
         // 初期化する関数
+        // RP2040にプロトコルバージョンを問い合わせ，対応していれば一括読み出しを使う
         static void begin(void);
 
         // エンコーダの累積値を取得する関数
@@ -158,15 +364,66 @@ class Inc_enc{
         // すべてのエンコーダの差分値をSerial.print()で表示する関数
         static void print_diff(bool new_line = false);
 
+        // 復号済みのすべてのエンコーダの値を取得する関数
+        static const Inc_enc_snapshot &snapshot(void);
+
+        // RP2040と取り決めたプロトコルバージョンを取得する関数
+        static uint8_t version(void);
+
+        // 一括読み出しで同期バイト，長さ，CRCのいずれかが合わなかった回数を取得する関数
+        static uint32_t frame_errors(void);
+
     private:
         // RP2040からの受信データを格納する配列
-        static uint8_t buf[INC_ENC_NUM*INC_ENC_BYTES*2];
+        static CUBIC_TLS uint8_t buf[INC_ENC_NUM*INC_ENC_BYTES*2];
+
+        // RP2040と取り決めたプロトコルバージョン
+        static CUBIC_TLS uint8_t _version;
+
+        // 一括読み出しの失敗回数
+        static CUBIC_TLS uint32_t _frame_errors;
+
+        // 一括読み出しが続けて失敗した回数
+        static CUBIC_TLS uint8_t burst_failures;
+
+        // 次のfetch()で従来のプロトコルに戻し，RP2040の累積値と送信位置を0に戻すかどうか
+        static CUBIC_TLS bool fallback_pending;
 
-        // 1つ前の値を格納する配列
-        static int32_t val_prev[INC_ENC_NUM];
+        // 次に正しく受信したときに，累積値が続くようにoffsetを求め直すかどうか
+        static CUBIC_TLS bool rebase;
 
-        // 今の値をval_prevに保存する関数
-        static void save_val(void);
+        // RP2040の累積値に足す値(合わせ直しでRP2040の累積値が0に戻っても，get()の値が続くようにする)
+        static CUBIC_TLS int32_t offset[INC_ENC_NUM*2];
+
+        // RP2040の累積値と送信位置を0に戻すパルスを出す関数
+        static void pulse_reset(void);
+
+        // RP2040にプロトコルバージョンを問い合わせる関数
+        static uint8_t query_version(void);
+
+        // 一括読み出しフレームを受信し，正しければbackを更新する関数
+        static bool receive_burst(void);
+
+        // 受信中のデータ(bufの控え)
+        static CUBIC_TLS uint8_t back[INC_ENC_NUM*INC_ENC_BYTES*2];
+
+        // backが正しく受信できたかどうか
+        static CUBIC_TLS bool back_valid;
+
+        // SPI通信でbackに受信する関数
+        static void fetch(void);
+
+        // backをbufに反映し，snapに復号する関数
+        static void commit(void);
+
+        friend class Cubic;
+        friend class Recorder;
+#ifdef CUBIC_HOST
+        friend class Cubic_host::Board_model;
+#endif
+
+        // 復号済みの値
+        static CUBIC_TLS Inc_enc_snapshot snap;
 };
 
 class Abs_enc{
@@ -184,15 +441,41 @@ class Abs_enc{
         // すべてのエンコーダの値をSerial.print()で表示する関数
         static void print(bool new_line = false);
 
+        // 復号済みのすべてのエンコーダの値を取得する関数
+        static const Abs_enc_snapshot &snapshot(void);
+
+        // エンコーダの回転数を取得する関数
+        // commit()のたびに正しく読めた値で数えるので，制御器がcompute()を呼ばない周期があっても数え間違えない
+        // 第1引数：エンコーダ番号
+        static const Multi_turn &turn(uint8_t num);
+
     private:
         // RP2040からの受信データを格納する配列
-        static uint8_t buf[ABS_ENC_NUM*ABS_ENC_BYTES];
+        static CUBIC_TLS uint8_t buf[ABS_ENC_NUM*ABS_ENC_BYTES];
+
+        // 復号済みの値
+        static CUBIC_TLS Abs_enc_snapshot snap;
+
+        // エンコーダごとの回転数
+        static CUBIC_TLS Multi_turn turns[ABS_ENC_NUM];
+
+        // 全エンコーダのパリティをまとめて検査し，正しいエンコーダのビットを立てて返す関数
+        static uint8_t parity_mask(const uint8_t *data);
 
-        // RP2040からの受信データのパリティチェックをする関数
-        static bool parity_check(uint16_t);
+        // 受信中のデータ(bufの控え)
+        static CUBIC_TLS uint8_t back[ABS_ENC_NUM*ABS_ENC_BYTES];
 
-        // RP2040からの受信データのパリティビットを取り除く関数
-        static uint16_t remove_parity_bit(uint16_t);
+        // SPI通信でbackに受信する関数
+        static void fetch(void);
+
+        // backをbufに反映し，snapに復号する関数
+        static void commit(void);
+
+        friend class Cubic;
+        friend class Recorder;
+#ifdef CUBIC_HOST
+        friend class Cubic_host::Board_model;
+#endif
 };
 
 class Adc {
@@ -201,6 +484,7 @@ class Adc {
         static void begin(void);
 
         // 電流値を取得する関数
+        // フィルタ済みの整数の値を，ここで電流値(A)に変換する
         static float get(uint8_t num);
 
         // 電流値を受信する関数
@@ -208,39 +492,267 @@ class Adc {
 
         // 各メインモータに対応した電流値を表示する関数
         static void print(bool new_line = false);
-    
-    private:
-        // 各メインモータに対応した電流値を格納する配列
-        static float buf[DC_MOTOR_NUM];
 
+        // 受信するモータのビットを立てたものを設定する関数(デフォルトは0xff)
+        // 受信しないモータのget()は0を返す
+        static void set_channels(uint8_t mask);
+
+        // 受信するモータのビットを立てたものを取得する関数
+        static uint8_t channels(void);
+
+        // 1回の受信で各チャンネルを何回変換して平均するかを設定する関数
+        // 1 ~ ADC_OVERSAMPLE_MAXで，2のべき乗に切り捨てる
+        static void set_oversampling(uint8_t count);
+
+        // フィルタを設定する関数
+        // 第1引数：モータ番号 第2引数：AdcFilter 第3引数：IIRなら係数1/2^kのk(0 ~ 8)，AVERAGEなら個数2^kのk(0 ~ 4)
+        // デフォルトはIIRでk=3
+        static void set_filter(uint8_t num, uint8_t filter, uint8_t k);
+
+        // バイアス(電流0のときの値)を求めるときに平均するサンプル数を設定する関数
+        // Dutyが0の間の受信で平均を取り，windowサンプルごとにバイアスを更新する
+        // 0にするとバイアスの更新を止める(デフォルトはADC_BIAS_WINDOW)
+        static void set_calibration(uint16_t window);
+
+        // バイアスを一度でも求めたモータのビットを立てたものを取得する関数
+        // 求める前は，begin()の後の最初の受信の値(まだDutyを送っていないときの値)を電流0として扱う
+        static uint8_t calibrated(void);
+
+    private:
         // 各メインモータに対応したチャンネル番号を格納する配列
         static const uint8_t ch[DC_MOTOR_NUM];
 
-        // 各メインモータに対応した電流値のバイアス項
-        static float bias[DC_MOTOR_NUM];
+        // 各メインモータの電流0のときの値(変換値 * 2^ADC_FRAC_BITS)
+        static CUBIC_TLS int32_t zero[DC_MOTOR_NUM];
+
+        // バイアスを求めるためのサンプルの合計と個数，平均する個数
+        static CUBIC_TLS int64_t bias_sum[DC_MOTOR_NUM];
+        static CUBIC_TLS uint16_t bias_count[DC_MOTOR_NUM];
+        static CUBIC_TLS uint16_t bias_window;
+
+        // Dutyが0になった時刻，Dutyが0のモータ，バイアスを求めたモータ
+        static CUBIC_TLS uint32_t idle_since[DC_MOTOR_NUM];
+        static CUBIC_TLS uint8_t idle;
+        static CUBIC_TLS uint8_t _calibrated;
+
+        // begin()の後の最初の受信かどうか(その値を仮のバイアスにする)
+        static CUBIC_TLS bool seed_pending;
+
+        // 受信中のADCの変換値(オーバーサンプリングした合計)
+        static CUBIC_TLS uint16_t back[DC_MOTOR_NUM];
+
+        // フィルタ済みの値(変換値 * 2^ADC_FRAC_BITS)
+        static CUBIC_TLS int32_t state[DC_MOTOR_NUM];
+
+        // 受信するモータ，最初の値でフィルタを初期化したモータ
+        static CUBIC_TLS uint8_t mask;
+        static CUBIC_TLS uint8_t primed;
 
-        // 各メインモータに対応した電流値の前の値
-        static float buf_prev[DC_MOTOR_NUM];
+        // オーバーサンプリングの回数(2^oversample_shift)
+        static CUBIC_TLS uint8_t oversample_shift;
+
+        // フィルタの設定
+        static CUBIC_TLS uint8_t filter[DC_MOTOR_NUM];
+        static CUBIC_TLS uint8_t filter_k[DC_MOTOR_NUM];
+
+        // 移動平均のリングバッファと合計
+        static CUBIC_TLS int32_t average_buf[DC_MOTOR_NUM][ADC_AVERAGE_MAX];
+        static CUBIC_TLS int32_t average_sum[DC_MOTOR_NUM];
+        static CUBIC_TLS uint8_t average_index[DC_MOTOR_NUM];
+
+        // SPI通信でbackに受信する関数
+        static void fetch(void);
+
+        // backをフィルタに通してstateに反映する関数
+        static void commit(void);
+
+        // Dutyが0の間の値からバイアスを更新する関数
+        static void calibrate(uint8_t num, int32_t x);
+
+        // stateを電流値(A)にする関数
+        static float to_current(uint8_t num);
+
+        // 受信するすべてのモータのstateとバイアスの差をrawに書き込む関数(受信しないモータは0)
+        // 電流値(A)にするにはADC_CURRENT_SCALEを掛ける
+        static void get_raw_all(int32_t *raw);
+
+        friend class Cubic;
+        friend class Recorder;
+#ifdef CUBIC_HOST
+        friend class Cubic_host::Board_model;
+#endif
+};
+
+// 過電流保護で，閾値に対して電流が下がったとみなす割合(ヒステリシス)
+constexpr float OVERCURRENT_RELEASE = 0.9;
+
+// I2tの積算値が許容量に対してこの割合まで下がったら復帰する
+constexpr float OVERCURRENT_I2T_RELEASE = 0.5;
+
+/**
+ * メインモータの過電流保護
+ * Cubic::update()などでADCを受信した直後に全モータの電流を調べ，遮断するモータのビットを立てる。
+ * 遮断したモータは次にDutyを送信するときに0にする(put()した値は残る)。
+ * 瞬時の閾値を超えるか，I2t(電流の2乗から連続電流の2乗を引いたものの積分)が許容量を超えると遮断する。
+ * ラッチしないモータは，電流が閾値のOVERCURRENT_RELEASE倍を下回り，I2tが許容量のOVERCURRENT_I2T_RELEASE倍を下回ると復帰する。
+ * ラッチするモータは，clear()を呼ぶまで遮断したままにする。
+ */
+class Overcurrent {
+    public:
+        // すべてのモータの閾値をlimitにし，I2tとラッチを無効にする関数
+        // Cubic::begin()から呼ばれる
+        static void begin(float limit);
+
+        // 瞬時の閾値を設定する関数
+        // 第1引数：モータ番号 第2引数：閾値(A)。0以下なら瞬時の閾値で遮断しない
+        static void set_limit(uint8_t num, float limit);
+
+        // I2tを設定する関数
+        // 第1引数：モータ番号 第2引数：連続して流せる電流(A) 第3引数：許容量(A^2 s)。0以下なら無効
+        static void set_i2t(uint8_t num, float continuous, float capacity);
+
+        // 遮断したままにするかどうかを設定する関数
+        static void set_latch(uint8_t num, bool latch);
+
+        // 遮断しているモータのビットを立てたものを取得する関数
+        static uint8_t faults(void);
+
+        // モータを遮断しているかどうかを取得する関数
+        static bool fault(uint8_t num);
+
+        // 遮断した回数を取得する関数
+        static uint32_t trips(uint8_t num);
+
+        // I2tの積算値(A^2 s)を取得する関数
+        static float i2t(uint8_t num);
+
+        // 遮断を解除する関数。I2tが許容量を超えたままなら次の受信で再び遮断する
+        static void clear(uint8_t num);
+        static void clear(void);
+
+        // 遮断しているかどうかをSerial.print()で表示する関数
+        static void print(bool new_line = false);
+
+    private:
+        // 閾値と復帰する値(Adcのstateとバイアスの差の単位)。電流値に変換せずに整数のまま比べる
+        static CUBIC_TLS int32_t limit_raw[DC_MOTOR_NUM];
+        static CUBIC_TLS int32_t release_raw[DC_MOTOR_NUM];
+
+        // I2tを有効にしたモータ。このモータだけ電流値(A)にして積算する
+        static CUBIC_TLS uint8_t i2t_mask;
+
+        // I2tの連続電流の2乗，許容量，復帰する値，積算値
+        static CUBIC_TLS float continuous2[DC_MOTOR_NUM];
+        static CUBIC_TLS float capacity[DC_MOTOR_NUM];
+        static CUBIC_TLS float capacity_release[DC_MOTOR_NUM];
+        static CUBIC_TLS float _i2t[DC_MOTOR_NUM];
+
+        static CUBIC_TLS uint8_t latch_mask;
+        static CUBIC_TLS uint8_t _faults;
+        static CUBIC_TLS uint32_t _trips[DC_MOTOR_NUM];
+
+        // 前回check()した時刻(us)。0なら未実行
+        static CUBIC_TLS uint32_t prev_micros;
+
+        // 受信した電流(Adc::get_raw_all()の値)から遮断するモータを更新する関数
+        static void check(const int32_t *raw);
+
+        friend class Cubic;
+};
+
+// Cubic::update()のループ周期の統計
+struct Loop_stats {
+    // 周期を待った回数
+    uint32_t cycles;
+    // 締め切りを過ぎてから周期待ちに入った回数
+    uint32_t overruns;
+    // 締め切りから周期待ちを抜けるまでの遅れ(us)の最小値，最大値，合計
+    int32_t jitter_min;
+    int32_t jitter_max;
+    int64_t jitter_sum;
+    // 締め切りを過ぎていた時間(us)の最大値
+    uint32_t late_max;
+
+    // 遅れの平均値(us)
+    float jitter_mean(void) const { return cycles ? (float)jitter_sum / cycles : 0; }
 };
 
 class Cubic{
     public:
         /**
 		 * すべてのモータ，エンコーダの初期化をする関数
-		 * @param use_B モータドライバB面を使うかどうか
-		 * @param current_limit モータを止める電流の閾値
+		 * @param use_B モータドライバB面を使うかどうか。CUBIC_USE_Bを定義している場合はそちらに従う
+		 * @param current_limit モータを止める電流の閾値(A)。Overcurrent::set_limit()でモータごとに変更できる
 		 */
         static void begin(bool use_B = false, float current_limit = 2.0);
 
-        // データの送受信をまとめて行う関数
+        /**
+         * データの送受信をまとめて行う関数
+         * Dutyを送信した後，前回の締め切りからusだけ後の時刻まで待ってから各センサを受信する。
+         * 締め切りは周期ずつ進めるので，処理時間が変わっても周期はずれない。
+         * 締め切りを1周期以上過ぎていた場合は，遅れを取り戻さずに今の時刻から数え直す。
+         * 待ち時間の間に，Telemetryに溜まったレコードを送信する。
+         * @param us ループの周期(us)。0なら待たない(Telemetryも送らないので，Telemetry::flush()を呼ぶこと)
+         */
         static void update(unsigned int us = 4000);
-    
+
+        /**
+         * データの送受信を開始する関数
+         * Dutyを控えに写してから，Dutyの送信と各センサの受信をキューに積んで開始する。
+         * 受信したデータはupdate_end()を呼ぶまで各get()には反映されないので，その間にcompute()を実行できる。
+         * 送信されるDutyはこの関数を呼ぶ前にput()したもので，各センサの値は1周期遅れて反映される。
+         * @param us ループの周期(us)
+         */
+        static void update_begin(unsigned int us = 4000);
+
+        // update_begin()で開始した送受信が完了しているかどうか
+        static bool update_ready(void);
+
+        // update_begin()で開始した送受信の完了を待ち，受信したデータを反映する関数
+        static void update_end(void);
+
+        // ループ周期の統計を取得する関数
+        static const Loop_stats &loop_stats(void);
+
+        // ループ周期の統計を0に戻す関数
+        static void reset_loop_stats(void);
+
+        // ループ周期の統計をSerial.print()で表示する関数
+        static void print_loop_stats(bool new_line = false);
+
+        /**
+         * update_begin()で毎回実行するSPI転送を追加する関数
+         * 追加した転送はDutyの送信と各センサの受信の後に実行される
+         * @param job 転送を行う関数
+         * @return キューに空きが無ければfalse
+         */
+        static bool add_transfer(CubicTransfer::Job job);
+
     private:
-        // 1つ前のループの時刻
-        static unsigned long time_prev;
+        // 次の締め切りまで待つ関数
+        static void wait_period(unsigned int us);
+
+        // 受信したデータを各get()に反映する関数
+        static void commit(void);
+
+        // update_begin()で実行する転送のキュー
+        static CUBIC_TLS CubicTransfer::Job queue[TRANSFER_QUEUE_SIZE];
+        static CUBIC_TLS int queue_num;
+
+        // update_begin()の後，update_end()を呼んでいないかどうか
+        static CUBIC_TLS bool in_flight;
+
+        // 次の締め切りの時刻(us)。micros()のオーバーフローに合わせて32bitで扱う
+        static CUBIC_TLS uint32_t next_deadline;
+
+        // 締め切りを数えている周期(us)
+        static CUBIC_TLS unsigned int period;
+
+        // ループ周期の統計
+        static CUBIC_TLS Loop_stats stats;
 
-        // モータを止める電流の閾値
-        static float _current_limit;
+        // モータを止める電流の閾値(Overcurrentの初期値)
+        static CUBIC_TLS float _current_limit;
 };
 
 #endif
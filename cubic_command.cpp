@@ -0,0 +1,208 @@
+/**
+ * @file cubic_command.cpp
+ */
+
+#include "cubic_command.h"
+
+bool Command_parser::attach(const uint8_t id, Cubic_controller::Controller &controller, const float target_scale) {
+    if (id >= COMMAND_ID_NUM) return false;
+    controllers[id] = &controller;
+    target_scales[id] = target_scale;
+    return true;
+}
+
+void Command_parser::detach(const uint8_t id) {
+    if (id < COMMAND_ID_NUM) controllers[id] = nullptr;
+}
+
+void Command_parser::set_handler(const Handler handler) {
+    this->handler = handler;
+}
+
+void Command_parser::set_listener(const Handler listener) {
+    this->listener = listener;
+}
+
+uint32_t Command_parser::errors(void) const {
+    return _errors;
+}
+
+int Command_parser::poll(int max_bytes) {
+    int num = 0;
+    while (max_bytes-- > 0 && Serial.available() > 0) {
+        const int c = Serial.read();
+        if (c < 0) break;
+        if (feed((uint8_t)c)) num++;
+    }
+    return num;
+}
+
+bool Command_parser::feed(const uint8_t c) {
+    if (frame_len > 0) {
+        frame[frame_len++] = c;
+        if (frame_len < COMMAND_FRAME_BYTES) return false;
+        frame_len = 0;
+        return parse_frame();
+    }
+
+    // 行の先頭のCOMMAND_SYNCからバイナリ形式
+    if (c == COMMAND_SYNC && line_len == 0 && !line_overflow) {
+        frame[0] = c;
+        frame_len = 1;
+        return false;
+    }
+
+    if (c == '\n') {
+        const bool overflow = line_overflow;
+        line[line_len] = '\0';
+        line_overflow = false;
+        if (overflow) {
+            line_len = 0;
+            _errors++;
+            return false;
+        }
+        if (line_len == 0) {
+            // 空行はハンドラに渡す(サンプルのスケッチでは停止)
+            if (handler == nullptr) return false;
+            handler(COMMAND_ID_ALL, '\n', NAN);
+            return true;
+        }
+        const bool done = parse_line();
+        line_len = 0;
+        return done;
+    }
+    if (c == '\r') return false;
+
+    if (line_len < COMMAND_LINE_MAX) {
+        line[line_len++] = (char)c;
+    }
+    else {
+        // 長すぎる行は改行まで読み捨てる
+        line_overflow = true;
+    }
+    return false;
+}
+
+bool Command_parser::parse_line(void) {
+    const char *p = line;
+    while (*p == ' ') p++;
+
+    uint8_t id = COMMAND_ID_ALL;
+    if (*p >= '0' && *p <= '9') {
+        unsigned int n = 0;
+        while (*p >= '0' && *p <= '9') {
+            n = n * 10 + (*p++ - '0');
+            if (n > 0xFF) break;
+        }
+        if (*p != ':' || n >= COMMAND_ID_NUM) {
+            _errors++;
+            return false;
+        }
+        id = n;
+        p++;
+        while (*p == ' ') p++;
+    }
+
+    const char cmd = *p++;
+    if (cmd == '\0') {
+        _errors++;
+        return false;
+    }
+
+    float values[3];
+    int num = 0;
+    while (true) {
+        while (*p == ' ' || *p == ',') p++;
+        if (*p == '\0') break;
+        char *end;
+        const double v = strtod(p, &end);
+        if (end == p || num >= 3) {
+            _errors++;
+            return false;
+        }
+        values[num++] = v;
+        p = end;
+    }
+    return dispatch(id, cmd, values, num);
+}
+
+bool Command_parser::parse_frame(void) {
+    uint8_t sum = 0;
+    for (int i = 1; i < COMMAND_FRAME_BYTES - 1; i++) sum += frame[i];
+    if (sum != frame[COMMAND_FRAME_BYTES - 1]) {
+        _errors++;
+        return false;
+    }
+
+    const uint32_t bits = (uint32_t)frame[3] | (uint32_t)frame[4] << 8 | (uint32_t)frame[5] << 16 | (uint32_t)frame[6] << 24;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return dispatch(frame[1], (char)frame[2], &value, isnan(value) ? 0 : 1);
+}
+
+bool Command_parser::dispatch(const uint8_t id, const char cmd, const float *values, const int num) {
+    if (id != COMMAND_ID_ALL && (id >= COMMAND_ID_NUM || controllers[id] == nullptr)) {
+        _errors++;
+        return false;
+    }
+
+    bool applied = false;
+    if (id == COMMAND_ID_ALL) {
+        for (int i = 0; i < COMMAND_ID_NUM; i++) {
+            if (controllers[i] != nullptr && apply(i, cmd, values, num)) applied = true;
+        }
+    }
+    else {
+        applied = apply(id, cmd, values, num);
+    }
+    if (applied) {
+        if (listener != nullptr) listener(id, cmd, num > 0 ? values[0] : NAN);
+        return true;
+    }
+
+    // 制御器が処理しないコマンド
+    const bool known = cmd == 'p' || cmd == 'i' || cmd == 'd' || cmd == 'g' || cmd == 's' || cmd == 'l' || cmd == 'r';
+    if (!known && handler != nullptr) {
+        handler(id, cmd, num > 0 ? values[0] : NAN);
+        return true;
+    }
+    // 値の数が合わない，または登録された制御器が無い
+    _errors++;
+    return false;
+}
+
+bool Command_parser::apply(const uint8_t id, const char cmd, const float *values, const int num) {
+    Cubic_controller::Controller &controller = *controllers[id];
+    switch (cmd) {
+        case 'p':
+            if (num != 1) return false;
+            controller.setKp(values[0]);
+            return true;
+        case 'i':
+            if (num != 1) return false;
+            controller.setKi(values[0]);
+            return true;
+        case 'd':
+            if (num != 1) return false;
+            controller.setKd(values[0]);
+            return true;
+        case 'g':
+            if (num != 3) return false;
+            controller.setGains(values[0], values[1], values[2]);
+            return true;
+        case 's':
+            if (num != 1) return false;
+            controller.setTarget(values[0] * target_scales[id]);
+            return true;
+        case 'l':
+            if (num != 1) return false;
+            controller.setLPF(values[0]);
+            return true;
+        case 'r':
+            if (num != 0) return false;
+            controller.reset();
+            return true;
+        default:
+            return false;
+    }
+}
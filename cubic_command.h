@@ -0,0 +1,98 @@
+/**
+ * @file cubic_command.h
+ * @brief Serialから受け取ったコマンドで，制御器のゲインや目標値を実行中に変更する
+ * @details 毎ループpoll()を呼ぶと，届いているバイトだけを読んで解釈します。待ったりStringを確保したりはしません。
+ *
+ * テキスト形式: "[ID:]コマンド 値\n"  (IDを省略すると登録したすべての制御器が対象)
+ *   例: "p 4.0"  "1:s 1.57"  "g 4.0 0.1 0.0"  "0:r"
+ * バイナリ形式: 0xA5, ID, コマンド, 値(float, リトルエンディアン 4byte), チェックサム
+ *   チェックサムはIDから値までの5バイトの和の下位8bit。IDが0xFFならすべての制御器が対象
+ *
+ * コマンド
+ *   p, i, d: 各ゲインを設定する(setKp(), setKi(), setKd())
+ *   g: 3つのゲインを設定する(setGains())。テキスト形式のみ
+ *   s: 目標値を設定する(setTarget())。attach()で目標値の倍率を与えた制御器には，値に倍率をかけて渡す
+ *   l: ローパスフィルタの係数を設定する(setLPF())
+ *   r: 制御器をリセットする(reset())
+ *   それ以外はset_handler()で設定した関数に渡す。空行もコマンド'\n'として渡す
+ * 制御器が実行したコマンドはset_listener()で設定した関数にも渡す
+ */
+
+#pragma once
+#include "Arduino.h"
+#include "Cubic.controller.h"
+
+// 登録できる制御器のIDの数
+constexpr int COMMAND_ID_NUM = 16;
+// すべての制御器を表すID
+constexpr uint8_t COMMAND_ID_ALL = 0xFF;
+// バイナリ形式の先頭のバイト
+constexpr uint8_t COMMAND_SYNC = 0xA5;
+// テキスト形式の1行の最大の長さ(改行を除く)
+constexpr int COMMAND_LINE_MAX = 47;
+// バイナリ形式の1コマンドのバイト数
+constexpr int COMMAND_FRAME_BYTES = 1 + 1 + 1 + 4 + 1;
+
+class Command_parser {
+    public:
+        /**
+         * 制御器が処理しないコマンドを受け取る関数の型
+         * @param id 制御器のID(省略された場合はCOMMAND_ID_ALL)
+         * @param cmd コマンドの文字
+         * @param value 値(省略された場合はNAN)
+         */
+        typedef void (*Handler)(uint8_t id, char cmd, float value);
+
+        /**
+         * 制御器をIDに登録する関数
+         * @param target_scale sコマンドの値にかける倍率(例: 度で目標角度を送るならDEG_TO_RAD)
+         * @return IDが範囲外ならfalse
+         */
+        bool attach(uint8_t id, Cubic_controller::Controller &controller, float target_scale = 1.0f);
+
+        // IDの登録を解除する関数
+        void detach(uint8_t id);
+
+        // 制御器が処理しないコマンドを受け取る関数を設定する関数
+        void set_handler(Handler handler);
+
+        // 制御器が実行したコマンドを受け取る関数を設定する関数(ゲインを変えた後に積分をやり直すなど)
+        void set_listener(Handler listener);
+
+        /**
+         * Serialに届いているバイトを解釈する関数。毎ループ呼んでください
+         * @param max_bytes 1回に読む最大のバイト数
+         * @return 実行したコマンドの数
+         */
+        int poll(int max_bytes = 64);
+
+        /**
+         * 1バイトを解釈する関数
+         * @return コマンドを実行したらtrue
+         */
+        bool feed(uint8_t c);
+
+        // 解釈できなかった，またはチェックサムが合わなかったコマンドの数
+        uint32_t errors(void) const;
+
+    private:
+        Cubic_controller::Controller *controllers[COMMAND_ID_NUM] = {};
+        float target_scales[COMMAND_ID_NUM];
+        Handler handler = nullptr;
+        Handler listener = nullptr;
+
+        char line[COMMAND_LINE_MAX + 1];
+        uint8_t line_len = 0;
+        bool line_overflow = false;
+
+        uint8_t frame[COMMAND_FRAME_BYTES];
+        // 0ならテキスト形式，1以上ならバイナリ形式の受信済みのバイト数
+        uint8_t frame_len = 0;
+
+        uint32_t _errors = 0;
+
+        bool parse_line(void);
+        bool parse_frame(void);
+        bool dispatch(uint8_t id, char cmd, const float *values, int num);
+        bool apply(uint8_t id, char cmd, const float *values, int num);
+};
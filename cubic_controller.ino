@@ -3,6 +3,33 @@
 #include "cubic_arduino.h"
 #include "PID.h"
 #include "Cubic.controller.h"
+#include "cubic_command.h"
+
+static bool stopFlag = false;
+static bool confirmFlag = false;
+static bool resetFlag = false;
+
+// 制御器が処理しないコマンド。cで回転方向の確認、それ以外(空行を含む)は停止
+void onCommand(uint8_t, char cmd, float)
+{
+  if (cmd == 'c')
+  {
+    confirmFlag = true;
+  }
+  else
+  {
+    stopFlag = true;
+  }
+}
+
+// 制御器が実行したコマンド。Kiを変えたら積分をやり直す
+void onApplied(uint8_t, char cmd, float)
+{
+  if (cmd == 'i')
+  {
+    resetFlag = true;
+  }
+}
 
 void setup()
 {
@@ -21,55 +48,36 @@ void loop()
   bool direction = true; // モータが正回転したときにエンコーダの値が+方向に増えるならtrue
   double capableDutyCycle = 0.5; // 最大許容デューティ比。0.0~1.0。省略可能で、デフォルトは1.0。
   double lowpassFilter = 1.0; // ローパスフィルタの係数。0.0~1.0。省略可能で、デフォルトは1.0(フィルタなし)。
-  bool logging = true; // ログをSerial.printで出力するかどうか。省略可能で、デフォルトはfalse。
+  bool logging = true; // ログを記録するかどうか(cubic_telemetry.h)。省略可能で、デフォルトはfalse。
 
   static Cubic_controller::Velocity_PID velocityPID(motorNo, encoderNo, Cubic_controller::encoderType::inc, CPR, Kp, Ki, Kd, velTarget, direction, capableDutyCycle, lowpassFilter, logging);
   static Cubic_controller::Position_PID positionPID(motorNo, encoderNo, Cubic_controller::encoderType::abs, Cubic_controller::AMT22_CPR, Kp, Ki, Kd, posTarget, direction, capableDutyCycle, logging);
 
-  static bool stopFlag = false;
-  static bool confirmFlag = false;
-  if (Serial.available() > 0)
+  // コマンドの書式はcubic_command.hを参照。例: "p 4.0"(両方のKpを設定)、"1:s 90"(positionPIDの目標角度[度]を設定)
+  static Command_parser parser;
+  static bool attached = false;
+  if (!attached)
   {
-    char c = Serial.read();
-    double value = Serial.readStringUntil('\n').toDouble();
-    if (c == 'p')
-    {
-      velocityPID.setKp(value);
-      positionPID.setKp(value);
-    }
-    else if (c == 'i')
-    {
-      velocityPID.setKi(value);
-      positionPID.setKi(value);
-      velocityPID.reset();
-      positionPID.reset();
-    }
-    else if (c == 'd')
-    {
-      velocityPID.setKd(value);
-      positionPID.setKd(value);
-    }
-    else if (c == 's')
-    {
-      velocityPID.setTarget(value);
-      positionPID.setTarget(degToRad(value));
-    }
-    else if (c == 'l'){
-      velocityPID.setLPF(value);
-    }
-    else if (c == 'r'){
-      velocityPID.reset();
-      positionPID.reset();
-    }
-    else if (c == 'c')
-    {
-      confirmFlag = true;
-    }
-    else
-    {
-      stopFlag = true;
-    }
+    parser.attach(0, velocityPID);
+    parser.attach(1, positionPID, DEG_TO_RAD); // 目標角度は度で送る
+    parser.set_handler(onCommand);
+    parser.set_listener(onApplied);
+    attached = true;
+  }
+  const uint32_t errors = parser.errors();
+  parser.poll();
+  // 解釈できなかったコマンドでも停止する
+  if (parser.errors() != errors)
+  {
+    stopFlag = true;
+  }
+  if (resetFlag)
+  {
+    velocityPID.reset();
+    positionPID.reset();
+    resetFlag = false;
   }
+
   if (stopFlag)
   {
     Serial.println("stopping...");
@@ -0,0 +1,62 @@
+/**
+ * @file cubic_multiturn.h
+ * @brief アブソリュートエンコーダの値から多回転の位置を求める
+ * @details 1回転分の値(0 ~ CPR-1)を受け取るたびに，前回の値との差を半回転以内とみなして回転数を数えます。
+ * 計算はすべて整数で，ループを持たないので1回の更新は一定時間で終わります。
+ * アブソリュートエンコーダのチャンネルごとにAbs_encが1つずつ持ち，毎周期更新します(Abs_enc::turn())。
+ */
+
+#pragma once
+#include "Arduino.h"
+#include "cubic_arduino.h"
+
+class Multi_turn {
+    public:
+        // 第1引数：エンコーダのCPR
+        explicit Multi_turn(const uint16_t CPR = ABS_ENC_MAX + 1) : CPR(CPR) {}
+
+        // 最初の値を与えて，回転数を0から数え直す関数
+        void reset(const int32_t count) {
+            _count = count;
+            _turns = 0;
+            _position = count;
+            _started = true;
+        }
+
+        // 新しい値を与え，累積位置[カウント]を返す関数
+        // reset()する前に呼んだ場合は，その値でreset()する
+        int64_t update(const int32_t count) {
+            if (!_started) {
+                reset(count);
+                return _position;
+            }
+            int32_t d = count - _count;
+            // 半回転より大きく跳んだら，0をまたいだとみなす
+            const int32_t wrap = (d < -(int32_t)(CPR / 2)) - (d >= (int32_t)(CPR / 2));
+            d += wrap * (int32_t)CPR;
+            _turns += wrap;
+            _count = count;
+            _position += d;
+            return _position;
+        }
+
+        // 累積位置[カウント]を取得する関数(最初の値 + 回ったカウント数)
+        int64_t position(void) const { return _position; }
+
+        // 最初の値から何回0をまたいだか(正方向が正)を取得する関数
+        // position() == turns() * CPR + count()
+        int32_t turns(void) const { return _turns; }
+
+        // 最後に与えた値を取得する関数
+        int32_t count(void) const { return _count; }
+
+        // reset()またはupdate()で値を与えたかどうか
+        bool started(void) const { return _started; }
+
+    private:
+        uint16_t CPR;
+        int32_t _count = 0;
+        int32_t _turns = 0;
+        int64_t _position = 0;
+        bool _started = false;
+};
@@ -0,0 +1,105 @@
+/**
+ * @file cubic_profiler.cpp
+ */
+
+#include "cubic_profiler.h"
+
+CUBIC_TLS bool Profiler::_enabled = false;
+CUBIC_TLS Profile_stats Profiler::stats[PROFILE_SLOT_NUM];
+
+#ifndef CUBIC_HOST
+// Cortex-M4のDWTサイクルカウンタ
+// (ホストでの実装はhost/cubic_host.cppにある)
+namespace {
+    volatile uint32_t *const DEMCR = (volatile uint32_t *)0xE000EDFC;
+    volatile uint32_t *const DWT_CTRL = (volatile uint32_t *)0xE0001000;
+    volatile uint32_t *const DWT_CYCCNT = (volatile uint32_t *)0xE0001004;
+    constexpr uint32_t DEMCR_TRCENA = 1UL << 24;
+    constexpr uint32_t DWT_CTRL_CYCCNTENA = 1UL << 0;
+    // nRF52840のCPUクロック(MHz)
+    constexpr uint32_t CPU_MHZ = 64;
+}
+
+void Profiler::start_counter(void) {
+    *DEMCR |= DEMCR_TRCENA;
+    *DWT_CYCCNT = 0;
+    *DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t Profiler::now(void) {
+    return *DWT_CYCCNT;
+}
+
+uint32_t Profiler::ticks_per_us(void) {
+    return CPU_MHZ;
+}
+#endif
+
+void Profiler::enable(const bool on) {
+    if (on && !_enabled) start_counter();
+    _enabled = on;
+}
+
+bool Profiler::enabled(void) {
+    return _enabled;
+}
+
+void Profiler::record(const uint8_t slot, const uint32_t ticks) {
+    if (!_enabled || slot >= PROFILE_SLOT_NUM) return;
+
+    Profile_stats &s = stats[slot];
+    if (s.count == 0 || ticks < s.min) s.min = ticks;
+    if (ticks > s.max) s.max = ticks;
+    s.sum += ticks;
+    s.count++;
+
+    // ビンの番号はticksのビット数
+    int bin = 0;
+    for (uint32_t t = ticks; t != 0 && bin < PROFILE_HIST_BINS - 1; t >>= 1) bin++;
+    s.hist[bin]++;
+}
+
+const Profile_stats &Profiler::get(const uint8_t slot) {
+    return stats[slot < PROFILE_SLOT_NUM ? slot : 0];
+}
+
+void Profiler::reset(void) {
+    for (int i = 0; i < PROFILE_SLOT_NUM; i++) {
+        stats[i] = Profile_stats();
+    }
+}
+
+void Profiler::print(void) {
+    static const char *const names[ProfilePhase::COMPUTE] = {"send", "abs_enc", "inc_enc", "adc", "sleep", "decode", "wait"};
+    const float tpu = (float)ticks_per_us();
+
+    for (int i = 0; i < PROFILE_SLOT_NUM; i++) {
+        const Profile_stats &s = stats[i];
+        if (s.count == 0) continue;
+
+        if (i < ProfilePhase::COMPUTE) {
+            Serial.print(names[i]);
+        }
+        else {
+            Serial.print("compute");
+            Serial.print(i - ProfilePhase::COMPUTE);
+        }
+        Serial.print(" n:");
+        Serial.print(s.count);
+        Serial.print(" min:");
+        Serial.print(s.min / tpu);
+        Serial.print(" mean:");
+        Serial.print((float)s.sum / s.count / tpu);
+        Serial.print(" max:");
+        Serial.print(s.max / tpu);
+        Serial.print(" hist");
+        for (int b = 0; b < PROFILE_HIST_BINS; b++) {
+            if (s.hist[b] == 0) continue;
+            Serial.print(" [");
+            Serial.print(b == 0 ? 0UL : 1UL << (b - 1));
+            Serial.print("]:");
+            Serial.print(s.hist[b]);
+        }
+        Serial.println();
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file cubic_profiler.h
+ * @brief 制御ループの各処理にかかった時間を測る
+ * @details ボード(Cortex-M4)ではDWTのサイクルカウンタ，ホストではsteady_clockで測ります。
+ * 処理ごとに回数，最小値，最大値，平均値と，log2のヒストグラムを記録します。
+ */
+
+#pragma once
+#include "Arduino.h"
+#include "cubic_arduino.h"
+
+// 時間を測る処理の番号
+namespace ProfilePhase {
+    constexpr uint8_t SEND = 0;    // DC_motor::send()の送信
+    constexpr uint8_t ABS_ENC = 1; // Abs_enc::receive()の受信
+    constexpr uint8_t INC_ENC = 2; // Inc_enc::receive()の受信
+    constexpr uint8_t ADC = 3;     // Adc::receive()の受信
+    constexpr uint8_t SLEEP = 4;   // Cubic::update()の周期待ち
+    constexpr uint8_t DECODE = 5;  // 受信データの反映
+    constexpr uint8_t WAIT = 6;    // Cubic::update_end()の転送待ち
+    constexpr uint8_t COMPUTE = 7; // 各制御器のcompute()。COMPUTE+モータ番号
+}
+
+// 記録する処理の数
+constexpr int PROFILE_SLOT_NUM = ProfilePhase::COMPUTE + Cubic_board::SLOT_NUM;
+
+// ヒストグラムのビンの数(i番目のビンは2^(i-1)以上2^i未満のtick)
+constexpr int PROFILE_HIST_BINS = 32;
+
+// 1つの処理の統計
+struct Profile_stats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[PROFILE_HIST_BINS];
+};
+
+class Profiler {
+    public:
+        // 計測を有効にする関数(既定では無効)
+        static void enable(bool on = true);
+
+        // 計測が有効かどうか
+        static bool enabled(void);
+
+        // 現在のtickを取得する関数
+        static uint32_t now(void);
+
+        // 1usあたりのtick数
+        static uint32_t ticks_per_us(void);
+
+        /**
+         * 処理にかかった時間を記録する関数
+         * @param slot 処理の番号(ProfilePhase)
+         * @param ticks かかった時間(tick)
+         */
+        static void record(uint8_t slot, uint32_t ticks);
+
+        // 処理の統計を取得する関数
+        static const Profile_stats &get(uint8_t slot);
+
+        // すべての統計を0に戻す関数
+        static void reset(void);
+
+        // 記録のあるすべての処理の統計をSerial.print()で表示する関数
+        // 時間はusで表示し，ヒストグラムは記録のあるビンのみ "[2^iのtick数]:回数" の形で表示する
+        static void print(void);
+
+    private:
+        static CUBIC_TLS bool _enabled;
+        static CUBIC_TLS Profile_stats stats[PROFILE_SLOT_NUM];
+
+        // 計測に使うカウンタを開始する関数
+        static void start_counter(void);
+};
+
+// 生成から破棄までの時間を記録するクラス
+class Profile_scope {
+    public:
+        explicit Profile_scope(uint8_t slot) : slot(slot), start(Profiler::now()) {}
+        ~Profile_scope() { Profiler::record(slot, Profiler::now() - start); }
+
+    private:
+        const uint8_t slot;
+        const uint32_t start;
+};
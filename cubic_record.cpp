@@ -0,0 +1,217 @@
+/**
+ * @file cubic_record.cpp
+ */
+
+#include "cubic_record.h"
+#ifdef CUBIC_HOST
+#include "cubic_host.h"
+#endif
+
+CUBIC_TLS bool Recorder::_enabled = false;
+CUBIC_TLS uint32_t Recorder::seq = 0;
+// B面を使わない構成(Cubic_board)ではB面の分は0のまま
+CUBIC_TLS int16_t Recorder::duty[(DC_MOTOR_NUM+SOL_SUB_NUM)*2];
+static_assert(sizeof(DC_motor::buf) <= sizeof(Record_cycle::duty), "DC_motor::buf must fit in Record_cycle");
+CUBIC_TLS uint32_t Recorder::sent = 0;
+CUBIC_TLS uint32_t Recorder::clock[RECORD_CLOCK_NUM];
+CUBIC_TLS uint8_t Recorder::clock_num = 0;
+CUBIC_TLS Record_cycle Recorder::ring[RECORD_CAPACITY];
+CUBIC_TLS std::atomic<uint32_t> Recorder::head(0);
+CUBIC_TLS std::atomic<uint32_t> Recorder::tail(0);
+CUBIC_TLS std::atomic<uint32_t> Recorder::_dropped(0);
+#ifdef CUBIC_HOST
+CUBIC_TLS const Record_cycle *Recorder::records = nullptr;
+CUBIC_TLS size_t Recorder::record_num = 0;
+CUBIC_TLS size_t Recorder::_played = 0;
+CUBIC_TLS uint32_t Recorder::_mismatches = 0;
+CUBIC_TLS long Recorder::_first_mismatch = -1;
+CUBIC_TLS uint32_t Recorder::_gaps = 0;
+CUBIC_TLS uint8_t Recorder::clock_played = 0;
+CUBIC_TLS uint64_t Recorder::wraps = 0;
+CUBIC_TLS uint32_t Recorder::last_micros = 0;
+#endif
+
+void Recorder::enable(const bool on) {
+    if (on && !_enabled) {
+        // 通し番号は0から数え直し，送っていないレコードは捨てる
+        seq = 0;
+        tail.store(head.load(std::memory_order_relaxed), std::memory_order_release);
+        _dropped.store(0, std::memory_order_relaxed);
+        memcpy(duty, DC_motor::buf, sizeof(DC_motor::buf));
+        sent = micros();
+        clock_num = 0;
+    }
+    _enabled = on;
+}
+
+bool Recorder::enabled(void) {
+    return _enabled;
+}
+
+uint32_t Recorder::now(void) {
+#ifdef CUBIC_HOST
+    // 流し直している間は，次に反映するレコードに残した時刻を順に返す(前のレコードを反映してから読んだ時刻)
+    if (playing()) {
+        const Record_cycle &r = records[_played];
+        if (clock_played < r.clock_num && clock_played < RECORD_CLOCK_NUM) return r.clock[clock_played++];
+        return micros();
+    }
+#endif
+    const uint32_t t = micros();
+    if (_enabled) {
+        if (clock_num < RECORD_CLOCK_NUM) clock[clock_num] = t;
+        if (clock_num < 0xFF) clock_num++;
+    }
+    return t;
+}
+
+void Recorder::capture_duty(void) {
+#ifdef CUBIC_HOST
+    // 流し直している間は，送った時刻を記録した時刻にする(update_begin()の後のcompute()が同じ時刻を読む)
+    if (playing()) {
+        play_time(records[_played].sent);
+        memcpy(duty, DC_motor::buf, sizeof(DC_motor::buf));
+        return;
+    }
+#endif
+    if (!_enabled) return;
+    memcpy(duty, DC_motor::buf, sizeof(DC_motor::buf));
+    sent = micros();
+}
+
+void Recorder::capture(void) {
+    if (!_enabled) return;
+
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= RECORD_CAPACITY) {
+        // 通し番号は進めておき，リプレイで抜けがわかるようにする
+        seq++;
+        clock_num = 0;
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record_cycle &r = ring[h & (RECORD_CAPACITY - 1)];
+    r.seq = seq++;
+    r.timestamp = micros();
+    r.sent = sent;
+    memcpy(r.duty, duty, sizeof(r.duty));
+    memcpy(r.inc, Inc_enc::back, sizeof(r.inc));
+    memcpy(r.abs, Abs_enc::back, sizeof(r.abs));
+    memcpy(r.adc, Adc::back, sizeof(r.adc));
+    r.inc_valid = Inc_enc::back_valid;
+    r.adc_mask = Adc::mask;
+    r.adc_oversample_shift = Adc::oversample_shift;
+    r.clock_num = clock_num;
+    memcpy(r.clock, clock, sizeof(r.clock));
+    clock_num = 0;
+    head.store(h + 1, std::memory_order_release);
+}
+
+bool Recorder::send_one(void) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+
+    // 送信中に上書きされないように，取り出してからインデックスを進める
+    const Record_cycle record = ring[t & (RECORD_CAPACITY - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    // clockは読んだ数だけ送る
+    const int clocks = record.clock_num < RECORD_CLOCK_NUM ? record.clock_num : RECORD_CLOCK_NUM;
+    Telemetry::write_frame(TelemetryType::RECORD, &record, RECORD_HEADER_BYTES + clocks * sizeof(uint32_t));
+    return true;
+}
+
+bool Recorder::skip_one(void) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    tail.store(t + 1, std::memory_order_release);
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Recorder::drain(const uint32_t deadline, const uint32_t margin) {
+    while ((int32_t)(deadline - (uint32_t)micros()) > (int32_t)margin) {
+        // write()が待って締め切りを過ぎないように，空きが無ければ送らない
+        if (Serial.availableForWrite() < RECORD_FRAME_BYTES) {
+            skip_one();
+            return;
+        }
+        if (!send_one()) return;
+    }
+}
+
+void Recorder::flush(void) {
+    while (send_one()) {
+    }
+}
+
+uint32_t Recorder::pending(void) {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+uint32_t Recorder::dropped(void) {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+#ifdef CUBIC_HOST
+void Recorder::play(const Record_cycle *records, const size_t count) {
+    Recorder::records = records;
+    record_num = count;
+    _played = 0;
+    _mismatches = 0;
+    _first_mismatch = -1;
+    _gaps = 0;
+    clock_played = 0;
+    wraps = 0;
+    last_micros = count > 0 ? records[0].sent : 0;
+}
+
+bool Recorder::playing(void) {
+    return _played < record_num;
+}
+
+size_t Recorder::played(void) {
+    return _played;
+}
+
+uint32_t Recorder::mismatches(void) {
+    return _mismatches;
+}
+
+long Recorder::first_mismatch(void) {
+    return _first_mismatch;
+}
+
+uint32_t Recorder::gaps(void) {
+    return _gaps;
+}
+
+void Recorder::play_next(void) {
+    const Record_cycle &r = records[_played];
+    // 抜けの直後は制御器が別の入力から計算しているので，比べない
+    const bool gap = _played > 0 && r.seq != records[_played - 1].seq + 1;
+    if (gap) {
+        _gaps++;
+    }
+    else if (memcmp(duty, r.duty, sizeof(duty)) != 0) {
+        if (_mismatches == 0) _first_mismatch = (long)_played;
+        _mismatches++;
+    }
+
+    // 受信したデータを受信中の控えに書き，時刻を受信を反映した時刻にする
+    play_time(r.timestamp);
+    memcpy(Inc_enc::back, r.inc, sizeof(r.inc));
+    memcpy(Abs_enc::back, r.abs, sizeof(r.abs));
+    memcpy(Adc::back, r.adc, sizeof(r.adc));
+    Inc_enc::back_valid = r.inc_valid;
+    Adc::mask = r.adc_mask;
+    Adc::oversample_shift = r.adc_oversample_shift;
+    _played++;
+    clock_played = 0;
+}
+
+void Recorder::play_time(const uint32_t us) {
+    if (us < last_micros) wraps++;
+    last_micros = us;
+    Cubic_host::set_micros((wraps << 32) + us);
+}
+#endif
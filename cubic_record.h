@@ -0,0 +1,164 @@
+/**
+ * @file cubic_record.h
+ * @brief 受信した生のデータと制御器の出力を周期ごとに記録し，ホストで同じ制御器のコードに流し直す
+ * @details 記録を有効にすると，Cubic::update()ごとにエンコーダとADCから受信した生のデータ(復号前のbufの控え)，
+ * その周期に送ったDC_motor::buf(制御器の出力)，送った時刻と受信を反映した時刻を1つのレコードにしてリングバッファに積みます。
+ * レコードはテレメトリと同じく周期待ちの間にSerialへ送ります。
+ *
+ * 制御器とエンコーダの復号は時刻をmicros()ではなくRecorder::now()で読み，記録中は読んだ時刻もレコードに残します。
+ *
+ * ホストではplay()したレコードを，Cubic::update()が送受信と周期待ちの代わりに順に反映します。
+ * Recorder::now()は記録した時刻を順に返すので，スケッチと同じsetup()とloop()をそのまま動かせば，compute()に掛かった時間によらず
+ * 制御器は同じ入力と時刻から同じ計算をし，出力を記録と比べられます(mismatches())。実時間は待たないので，CPUの速さで進みます。
+ * 1周期にRECORD_CLOCK_NUMより多く時刻を読むと，超えた分は記録できないので一致しないことがあります。
+ *
+ * フレームの形式: COBS(TelemetryType::RECORD 1byte, Record_cycle(読んだ時刻の数だけ), CRC-16 2byte) + 0x00
+ */
+
+#pragma once
+#include "Arduino.h"
+#include "cubic_arduino.h"
+#include "cubic_telemetry.h"
+#include <atomic>
+#include <stddef.h>
+
+// リングバッファに積めるレコードの数(2のべき乗)
+constexpr int RECORD_CAPACITY = 8;
+// 1レコードに記録できる，Recorder::now()で読んだ時刻の数
+constexpr int RECORD_CLOCK_NUM = 16;
+
+// 1周期のレコード(リトルエンディアン，最大224バイト)
+struct Record_cycle {
+    uint32_t seq;       // 通し番号(送れずに捨てたレコードを見つける)
+    uint32_t timestamp; // 受信を反映したときのmicros()
+    uint32_t sent;      // デューティを送ったとき(DC_motor::latch())のmicros()
+    int16_t duty[(DC_MOTOR_NUM+SOL_SUB_NUM)*2];   // この周期に送ったDC_motor::buf
+    uint8_t inc[INC_ENC_NUM*INC_ENC_BYTES*2];     // Inc_encの受信データ
+    uint8_t abs[ABS_ENC_NUM*ABS_ENC_BYTES];       // Abs_encの受信データ
+    uint16_t adc[DC_MOTOR_NUM];                   // Adcの受信データ(オーバーサンプリングの合計)
+    uint8_t inc_valid;  // Inc_encのフレームを正しく受信できたかどうか
+    uint8_t adc_mask;   // Adc::channels()
+    uint8_t adc_oversample_shift;
+    uint8_t clock_num;  // clockの数(RECORD_CLOCK_NUMを超えた場合は読んだ回数。255まで)
+    // 前のレコードを積んでからこのレコードを積むまでにRecorder::now()が返した時刻(送信するのはclock_numの数だけ)
+    uint32_t clock[RECORD_CLOCK_NUM];
+};
+static_assert(sizeof(Record_cycle) == 224, "Record_cycle must be packed");
+static_assert(sizeof(Record_cycle) <= TELEMETRY_DATA_MAX, "Record_cycle must fit in a telemetry frame");
+
+// clockを除いたレコードのバイト数
+constexpr int RECORD_HEADER_BYTES = offsetof(Record_cycle, clock);
+
+// 1レコードのフレームの最大のバイト数(COBSのオーバーヘッドと区切りの0x00を含む)
+constexpr int RECORD_PAYLOAD_BYTES = 1 + sizeof(Record_cycle) + 2;
+constexpr int RECORD_FRAME_BYTES = RECORD_PAYLOAD_BYTES + RECORD_PAYLOAD_BYTES / 254 + 2;
+
+class Recorder {
+    public:
+        // 記録を有効にする関数(既定では無効)。Cubic::begin()の前に有効にすると，begin()の中の受信から記録する
+        static void enable(bool on = true);
+
+        // 記録が有効かどうか
+        static bool enabled(void);
+
+        /**
+         * 制御器が時刻を読む関数。micros()の代わりに使う
+         * 記録中は返した時刻をレコードに残し，ホストで記録を流し直している間は記録した時刻を順に返す
+         */
+        static uint32_t now(void);
+
+        /**
+         * 締め切りまでの空き時間にレコードを送信する関数
+         * Serialの送信バッファに1フレーム分の空きが無ければ，一番古いレコードを送らずに捨て，dropped()に数える
+         * (毎周期1レコードずつ積むので，送れない周期に1つ捨てればリングバッファは古いレコードで詰まらない)
+         * @param deadline この時刻(micros())を過ぎたら送信をやめる
+         * @param margin 締め切りのこの時間(us)前までに送信を終える
+         */
+        static void drain(uint32_t deadline, uint32_t margin = 100);
+
+        // 残っているレコードをすべて送信する関数
+        static void flush(void);
+
+        // 送信待ちのレコードの数
+        static uint32_t pending(void);
+
+        // バッファが一杯で捨てた，またはSerialに空きが無く送らずに捨てたレコードの数
+        static uint32_t dropped(void);
+
+#ifdef CUBIC_HOST
+        /**
+         * 記録したレコードを，この後のCubic::update()で順に反映する関数(ホストのみ)
+         * Cubic::begin()の前に呼ぶと，begin()の中のupdate()から反映する。recordsはすべて反映するまで保持すること
+         * @param records レコード
+         * @param count レコードの数
+         */
+        static void play(const Record_cycle *records, size_t count);
+
+        // まだ反映していないレコードがあるかどうか
+        static bool playing(void);
+
+        // 反映したレコードの数
+        static size_t played(void);
+
+        // 送ったDC_motor::bufが記録と一致しなかった周期の数
+        static uint32_t mismatches(void);
+
+        // 最初に一致しなかったレコードの番号(一致しなかった周期が無ければ-1)
+        static long first_mismatch(void);
+
+        // 通し番号が飛んでいた(ボードで捨てた)箇所の数
+        static uint32_t gaps(void);
+#endif
+
+    private:
+        static CUBIC_TLS bool _enabled;
+        static CUBIC_TLS uint32_t seq;
+        // 直前のDC_motor::latch()で送ったデューティと時刻
+        static CUBIC_TLS int16_t duty[(DC_MOTOR_NUM+SOL_SUB_NUM)*2];
+        static CUBIC_TLS uint32_t sent;
+        // 前のレコードを積んでからnow()が返した時刻
+        static CUBIC_TLS uint32_t clock[RECORD_CLOCK_NUM];
+        static CUBIC_TLS uint8_t clock_num;
+
+        static CUBIC_TLS Record_cycle ring[RECORD_CAPACITY];
+        // 書き込み側だけが進めるインデックス
+        static CUBIC_TLS std::atomic<uint32_t> head;
+        // 読み出し側だけが進めるインデックス
+        static CUBIC_TLS std::atomic<uint32_t> tail;
+        static CUBIC_TLS std::atomic<uint32_t> _dropped;
+
+        // DC_motor::latch()で送るデューティを控える関数
+        static void capture_duty(void);
+
+        // Cubic::commit()で受信データと控えたデューティをレコードにして積む関数
+        static void capture(void);
+
+        // 1レコードを取り出して送信する関数
+        static bool send_one(void);
+
+        // 1レコードを送らずに捨てる関数
+        static bool skip_one(void);
+
+#ifdef CUBIC_HOST
+        static CUBIC_TLS const Record_cycle *records;
+        static CUBIC_TLS size_t record_num;
+        static CUBIC_TLS size_t _played;
+        static CUBIC_TLS uint32_t _mismatches;
+        static CUBIC_TLS long _first_mismatch;
+        static CUBIC_TLS uint32_t _gaps;
+        // 次に反映するレコードのclockのうち，now()が返した数
+        static CUBIC_TLS uint8_t clock_played;
+        // micros()の桁あふれの回数と直前に設定した時刻(仮想時刻を単調に進める)
+        static CUBIC_TLS uint64_t wraps;
+        static CUBIC_TLS uint32_t last_micros;
+
+        // 仮想時刻を記録した時刻にする関数
+        static void play_time(uint32_t us);
+
+        // 次のレコードを受信データの代わりに反映し，送ったデューティを記録と比べる関数
+        static void play_next(void);
+#endif
+
+        friend class DC_motor;
+        friend class Cubic;
+};
@@ -0,0 +1,106 @@
+/**
+ * @file cubic_scalar.h
+ * @brief 制御器の計算に使う数値型
+ * @details PIDやCubic_controllerの各クラスは数値型Tのテンプレートになっていて，double，float，固定小数点数を使えます。
+ * nRF52840(Cortex-M4F)のFPUは単精度のみなので，ボードではfloatかQ16_16にすると計算が速くなります。
+ * Q32_32は128bit整数が必要なので，ホストでのみ使えます(CUBIC_HAS_Q32_32が定義される)。
+ */
+
+#pragma once
+#include "Arduino.h"
+#include <limits.h>
+
+/**
+ * 固定小数点数
+ * @tparam Frac 小数部のビット数
+ * @tparam Rep 値を格納する符号付き整数
+ * @tparam Wide 乗除算の途中で使う，Repの2倍の幅の符号付き整数
+ */
+template <int Frac, class Rep, class Wide>
+class Fixed {
+    public:
+        constexpr Fixed() : _raw(0) {}
+        explicit constexpr Fixed(const double v) : _raw(from_double(v)) {}
+        explicit constexpr Fixed(const float v) : _raw(from_double(v)) {}
+        explicit constexpr Fixed(const int v) : _raw((Rep)((Wide)v * ((Wide)1 << Frac))) {}
+
+        // 内部の整数から作る関数
+        static constexpr Fixed from_raw(const Rep raw) {
+            Fixed f;
+            f._raw = raw;
+            return f;
+        }
+        constexpr Rep raw(void) const { return _raw; }
+
+        explicit constexpr operator double() const { return (double)_raw / (double)((Wide)1 << Frac); }
+        explicit constexpr operator float() const { return (float)_raw / (float)((Wide)1 << Frac); }
+        // 0の方向に丸める
+        explicit constexpr operator int() const { return (int)(_raw < 0 ? -(-_raw >> Frac) : _raw >> Frac); }
+
+        constexpr Fixed operator-() const { return from_raw(-_raw); }
+        constexpr Fixed operator+(const Fixed b) const { return from_raw(_raw + b._raw); }
+        constexpr Fixed operator-(const Fixed b) const { return from_raw(_raw - b._raw); }
+        constexpr Fixed operator*(const Fixed b) const { return from_raw((Rep)(((Wide)_raw * b._raw) >> Frac)); }
+        // 0で割った場合は最大値または最小値にする
+        constexpr Fixed operator/(const Fixed b) const {
+            return b._raw != 0 ? from_raw((Rep)(((Wide)_raw * ((Wide)1 << Frac)) / b._raw)) : from_raw(_raw < 0 ? REP_MIN : REP_MAX);
+        }
+        Fixed &operator+=(const Fixed b) { return *this = *this + b; }
+        Fixed &operator-=(const Fixed b) { return *this = *this - b; }
+        Fixed &operator*=(const Fixed b) { return *this = *this * b; }
+        Fixed &operator/=(const Fixed b) { return *this = *this / b; }
+
+        constexpr bool operator==(const Fixed b) const { return _raw == b._raw; }
+        constexpr bool operator!=(const Fixed b) const { return _raw != b._raw; }
+        constexpr bool operator<(const Fixed b) const { return _raw < b._raw; }
+        constexpr bool operator<=(const Fixed b) const { return _raw <= b._raw; }
+        constexpr bool operator>(const Fixed b) const { return _raw > b._raw; }
+        constexpr bool operator>=(const Fixed b) const { return _raw >= b._raw; }
+
+    private:
+        static constexpr Rep REP_MAX = (Rep)(((Wide)1 << (sizeof(Rep) * 8 - 1)) - 1);
+        static constexpr Rep REP_MIN = -REP_MAX - 1;
+
+        Rep _raw;
+
+        // 四捨五入し，範囲外の値は飽和させる
+        static constexpr Rep from_double(const double v) {
+            const double scaled = v * (double)((Wide)1 << Frac);
+            return scaled >= (double)REP_MAX ? REP_MAX : scaled <= (double)REP_MIN ? REP_MIN : (Rep)(scaled + (scaled >= 0 ? 0.5 : -0.5));
+        }
+};
+
+// 整数部16bit，小数部16bitの固定小数点数(範囲 ±32768，分解能 1.5e-5)
+typedef Fixed<16, int32_t, int64_t> Q16_16;
+
+#ifdef __SIZEOF_INT128__
+#define CUBIC_HAS_Q32_32
+// 整数部32bit，小数部32bitの固定小数点数(範囲 ±2.1e9，分解能 2.3e-10)
+typedef Fixed<32, int64_t, __int128> Q32_32;
+#endif
+
+// 数値型ごとの処理
+template <class T>
+struct Scalar_traits {
+    // 経過時間(us)を秒にする関数
+    static T from_micros(const unsigned long us) { return T(us * (1.0 / 1000000.0)); }
+};
+
+template <>
+struct Scalar_traits<float> {
+    static float from_micros(const unsigned long us) { return (float)us * 1e-6f; }
+};
+
+template <int Frac, class Rep, class Wide>
+struct Scalar_traits<Fixed<Frac, Rep, Wide>> {
+    // 浮動小数点数を使わずに変換する
+    static Fixed<Frac, Rep, Wide> from_micros(const unsigned long us) {
+        return Fixed<Frac, Rep, Wide>::from_raw((Rep)(((Wide)us << Frac) / 1000000));
+    }
+};
+
+// 絶対値
+template <class T>
+constexpr T scalar_abs(const T x) {
+    return x < T(0) ? -x : x;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file cubic_telemetry.cpp
+ */
+
+#include "cubic_telemetry.h"
+
+CUBIC_TLS Telemetry_record Telemetry::ring[TELEMETRY_CAPACITY];
+CUBIC_TLS std::atomic<uint32_t> Telemetry::head(0);
+CUBIC_TLS std::atomic<uint32_t> Telemetry::tail(0);
+CUBIC_TLS std::atomic<uint32_t> Telemetry::_dropped(0);
+
+bool Telemetry::push(const Telemetry_record &record) {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= TELEMETRY_CAPACITY) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    ring[h & (TELEMETRY_CAPACITY - 1)] = record;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+bool Telemetry::send_one(void) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+
+    const Telemetry_record record = ring[t & (TELEMETRY_CAPACITY - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    write_frame(TelemetryType::CONTROLLER, &record, sizeof(record));
+    return true;
+}
+
+void Telemetry::write_frame(const uint8_t type, const void *data, const size_t len) {
+    if (len > TELEMETRY_DATA_MAX) return;
+
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD_BYTES];
+    payload[0] = type;
+    memcpy(&payload[1], data, len);
+    const uint16_t crc = CubicFrame::crc16(payload, 1 + len);
+    payload[1 + len] = crc >> 8;
+    payload[2 + len] = crc & 0xff;
+
+    uint8_t frame[TELEMETRY_MAX_FRAME_BYTES];
+    size_t n = cobs_encode(payload, 3 + len, frame);
+    frame[n++] = 0x00;
+    Serial.write(frame, n);
+}
+
+void Telemetry::drain(const uint32_t deadline, const uint32_t margin) {
+    while ((int32_t)(deadline - (uint32_t)micros()) > (int32_t)margin) {
+        // 送信バッファに1フレーム分の空きが無ければ，write()が待って締め切りを過ぎるので次の周期に回す
+        if (Serial.availableForWrite() < TELEMETRY_FRAME_BYTES) return;
+        if (!send_one()) return;
+    }
+}
+
+void Telemetry::flush(void) {
+    while (send_one()) {
+    }
+}
+
+uint32_t Telemetry::pending(void) {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+uint32_t Telemetry::dropped(void) {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+size_t Telemetry::cobs_encode(const uint8_t *in, const size_t len, uint8_t *out) {
+    size_t code_pos = 0;
+    size_t o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = in[i];
+        if (++code == 0xFF) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    return o;
+}
+
+size_t Telemetry::cobs_decode(const uint8_t *in, const size_t len, uint8_t *out) {
+    size_t o = 0;
+    for (size_t i = 0; i < len;) {
+        const uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len) return 0;
+        for (uint8_t j = 1; j < code; j++) {
+            if (in[i] == 0) return 0;
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < len) out[o++] = 0;
+    }
+    return o;
+}
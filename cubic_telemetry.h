@@ -0,0 +1,121 @@
+/**
+ * @file cubic_telemetry.h
+ * @brief 制御器のログをバイナリで記録し，ループの空き時間にSerialへ送る
+ * @details 制御器のcompute()は固定長のレコードをリングバッファに積むだけで，Serialには書き込みません。
+ * レコードはCubic::update()の周期待ちの間に，COBSでフレーム化して送信します。
+ * 受信したデータはhost/tools/telemetry_decode.cppでCSVに変換できます。
+ *
+ * フレームの形式: COBS(種類 1byte, レコード, CRC-16 2byte) + 0x00
+ */
+
+#pragma once
+#include "Arduino.h"
+#include "cubic_arduino.h"
+#include <atomic>
+
+// リングバッファに積めるレコードの数(2のべき乗)
+constexpr int TELEMETRY_CAPACITY = 32;
+
+// フレームの種類
+namespace TelemetryType {
+    constexpr uint8_t CONTROLLER = 0x01; // Telemetry_record
+    constexpr uint8_t RECORD = 0x02;     // Record_cycle(cubic_record.h)
+}
+
+// Telemetry_record::flagsのビット
+namespace TelemetryFlag {
+    constexpr uint8_t ABS_ENC_ERR_RP2040 = 1 << 0; // RP2040でアブソリュートエンコーダを読めなかった
+    constexpr uint8_t ABS_ENC_ERR = 1 << 1;        // ArduinoとRP2040間の通信エラー
+    constexpr uint8_t ABS_ENC_RANGE = 1 << 2;      // アブソリュートエンコーダの値が範囲外
+}
+
+// 制御器の1回のcompute()のレコード(リトルエンディアン，36バイト)
+struct Telemetry_record {
+    uint32_t timestamp; // micros()
+    uint8_t motorNo;
+    uint8_t flags;      // TelemetryFlag
+    uint16_t reserved;
+    int32_t encoder;    // 読んだエンコーダの値
+    float current;      // 制御量
+    float target;       // 目標値
+    float diff;         // 偏差
+    float integral;     // 偏差の積分
+    float duty;         // 出力したデューティ比
+    float dt;           // 前回からの経過時間[s]
+};
+static_assert(sizeof(Telemetry_record) == 36, "Telemetry_record must be packed");
+
+// 1フレームのCOBS符号化前のバイト数
+constexpr int TELEMETRY_PAYLOAD_BYTES = 1 + sizeof(Telemetry_record) + 2;
+// 1フレームの最大のバイト数(COBSのオーバーヘッドと区切りの0x00を含む)
+constexpr int TELEMETRY_FRAME_BYTES = TELEMETRY_PAYLOAD_BYTES + TELEMETRY_PAYLOAD_BYTES / 254 + 2;
+
+// write_frame()で送れるデータの最大のバイト数
+constexpr int TELEMETRY_DATA_MAX = 224;
+// write_frame()の1フレームの最大のバイト数
+constexpr int TELEMETRY_MAX_PAYLOAD_BYTES = 1 + TELEMETRY_DATA_MAX + 2;
+constexpr int TELEMETRY_MAX_FRAME_BYTES = TELEMETRY_MAX_PAYLOAD_BYTES + TELEMETRY_MAX_PAYLOAD_BYTES / 254 + 2;
+
+class Telemetry {
+    public:
+        /**
+         * レコードをリングバッファに積む関数
+         * 割り込みからも呼べるように，書き込み側と読み出し側はそれぞれ1つのインデックスしか更新しない。
+         * @return バッファが一杯で捨てた場合はfalse
+         */
+        static bool push(const Telemetry_record &record);
+
+        /**
+         * 締め切りまでの空き時間にレコードを送信する関数
+         * Serialの送信バッファに1フレーム分の空きが無くなったら，残りは次の呼び出しで送る
+         * @param deadline この時刻(micros())を過ぎたら送信をやめる
+         * @param margin 締め切りのこの時間(us)前までに送信を終える
+         */
+        static void drain(uint32_t deadline, uint32_t margin = 100);
+
+        // 残っているレコードをすべて送信する関数
+        static void flush(void);
+
+        // 送信待ちのレコードの数
+        static uint32_t pending(void);
+
+        // バッファが一杯で捨てたレコードの数
+        static uint32_t dropped(void);
+
+        /**
+         * 種類，データ，CRCをCOBSでフレーム化してSerialに書き込む関数
+         * @param type フレームの種類(TelemetryType)
+         * @param data データ
+         * @param len dataのバイト数(TELEMETRY_DATA_MAX以下)
+         */
+        static void write_frame(uint8_t type, const void *data, size_t len);
+
+        /**
+         * COBSで符号化する関数
+         * @param in 符号化するデータ
+         * @param len inのバイト数
+         * @param out 出力先。len + len/254 + 1バイト必要
+         * @return outに書いたバイト数(区切りの0x00は含まない)
+         */
+        static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out);
+
+        /**
+         * COBSを復号する関数
+         * @param in 区切りの0x00を含まないフレーム
+         * @param len inのバイト数
+         * @param out 出力先。lenバイト必要
+         * @return outに書いたバイト数。不正なフレームなら0
+         */
+        static size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out);
+
+    private:
+        static CUBIC_TLS Telemetry_record ring[TELEMETRY_CAPACITY];
+        // 書き込み側だけが進めるインデックス
+        static CUBIC_TLS std::atomic<uint32_t> head;
+        // 読み出し側だけが進めるインデックス
+        static CUBIC_TLS std::atomic<uint32_t> tail;
+        static CUBIC_TLS std::atomic<uint32_t> _dropped;
+
+        // 1レコードを取り出して送信する関数
+        static bool send_one(void);
+};
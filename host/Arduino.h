@@ -0,0 +1,121 @@
+/**
+ * @file Arduino.h
+ * @brief ホスト(Linux)ビルド用のArduino APIの代替
+ * @details cubic_arduino.cpp, PID.cpp, Cubic.controller.cppをボード無しでビルドするために、
+ * 使用しているArduino APIのみを提供します。時刻・GPIO・Serialの実体はcubic_host.cppにあります。
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cmath>
+#include <cstdlib>
+
+using std::abs;
+
+typedef uint8_t byte;
+
+constexpr double PI = 3.1415926535897932384626433832795;
+constexpr double HALF_PI = 1.5707963267948966192313216916398;
+constexpr double TWO_PI = 6.283185307179586476925286766559;
+constexpr double DEG_TO_RAD = 0.017453292519943295769236907684886;
+constexpr double RAD_TO_DEG = 57.295779513082320876798154814105;
+
+constexpr int DEC = 10;
+constexpr int HEX = 16;
+constexpr int OCT = 8;
+constexpr int BIN = 2;
+
+enum PinStatus
+{
+    LOW = 0,
+    HIGH = 1,
+    CHANGE = 2,
+    FALLING = 3,
+    RISING = 4
+};
+
+enum PinMode
+{
+    INPUT = 0x0,
+    OUTPUT = 0x1,
+    INPUT_PULLUP = 0x2,
+    INPUT_PULLDOWN = 0x3
+};
+
+// nRF52840のGPIO番号(P0.00~P1.15)
+enum PinName
+{
+    p0, p1, p2, p3, p4, p5, p6, p7, p8, p9,
+    p10, p11, p12, p13, p14, p15, p16, p17, p18, p19,
+    p20, p21, p22, p23, p24, p25, p26, p27, p28, p29,
+    p30, p31, p32, p33, p34, p35, p36, p37, p38, p39,
+    p40, p41, p42, p43, p44, p45, p46, p47,
+    NC = -1
+};
+constexpr int NRF_GPIO_PIN_NUM = 48;
+
+// ボード(unsigned longが32bit)と同じく，2^32で桁あふれする
+uint32_t micros(void);
+uint32_t millis(void);
+void delayMicroseconds(unsigned int us);
+void delay(unsigned long ms);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int val);
+PinStatus digitalRead(int pin);
+
+void nrf_gpio_pin_set(uint32_t pin_number);
+void nrf_gpio_pin_clear(uint32_t pin_number);
+
+template <typename T, typename L, typename H>
+constexpr T constrain(const T x, const L low, const H high)
+{
+    return x < low ? low : (x > high ? high : x);
+}
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud);
+    void end(void);
+    int available(void);
+    int read(void);
+    int peek(void);
+    int availableForWrite(void);
+    void flush(void);
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long long n, int base = DEC);
+    size_t print(unsigned long long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println(void);
+    template <typename T>
+    size_t println(const T &v)
+    {
+        size_t n = print(v);
+        return n + println();
+    }
+    template <typename T>
+    size_t println(const T &v, int format)
+    {
+        size_t n = print(v, format);
+        return n + println();
+    }
+
+    explicit operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,45 @@
+/**
+ * @file SPI.h
+ * @brief ホスト(Linux)ビルド用のSPIライブラリの代替
+ * @details 転送はcubic_host.cppのSPIバスモデルに渡され、選択中のスレーブモデルが応答します。
+ */
+
+#pragma once
+#include "Arduino.h"
+
+constexpr int MSBFIRST = 1;
+constexpr int LSBFIRST = 0;
+
+enum SPIMode
+{
+    SPI_MODE0 = 0,
+    SPI_MODE1 = 1,
+    SPI_MODE2 = 2,
+    SPI_MODE3 = 3
+};
+
+class SPISettings
+{
+public:
+    SPISettings(uint32_t clock = 4000000, int bitOrder = MSBFIRST, SPIMode dataMode = SPI_MODE0)
+        : clock(clock), bitOrder(bitOrder), dataMode(dataMode)
+    {
+    }
+
+    uint32_t clock;
+    int bitOrder;
+    SPIMode dataMode;
+};
+
+class SPIClass
+{
+public:
+    void begin(void);
+    void end(void);
+    void beginTransaction(SPISettings settings);
+    void endTransaction(void);
+    uint8_t transfer(uint8_t data);
+    void transfer(void *buf, size_t count);
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,563 @@
+/**
+ * @file cubic_host.cpp
+ * @brief ホスト(Linux)ビルド用のハードウェア抽象化層の実装
+ */
+
+#include "cubic_host.h"
+#include "Arduino.h"
+#include "SPI.h"
+#include "cubic_arduino.h"
+#include "cubic_profiler.h"
+
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <stdio.h>
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+namespace Cubic_host
+{
+    namespace
+    {
+        constexpr int ARDUINO_PIN_NUM = sizeof(nano33BLE_digitalWriteFast::DIGITAL_PIN_PIN_NAMES) / sizeof(PinName);
+
+        struct Attached_device
+        {
+            int ss_pin;
+            int nrf;
+            Spi_device *device;
+        };
+
+        struct State
+        {
+            Clock_mode mode = Clock_mode::simulated;
+            uint64_t sim_ns = 0;
+            std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+            uint64_t real_offset_ns = 0;
+
+            Spi_timing timing;
+            uint32_t spi_clock = 4000000;
+            uint64_t spi_bytes = 0;
+            uint64_t bus_ns = 0;
+
+            // CubicTransfer::start()で実行中のジョブは時刻を進めず，バスの時刻だけを進める
+            bool deferred = false;
+            uint64_t bus_until_ns = 0;
+            // CubicTransfer::start()で開始したジョブの完了時刻
+            uint64_t transfer_done_ns = 0;
+
+            // nRFのGPIO番号ごとの出力レベル(未設定のピンはプルアップ扱い)
+            bool level[NRF_GPIO_PIN_NUM];
+            std::vector<Attached_device> devices;
+            // ピンごとの，出力の変化を通知するデバイス
+            std::vector<Spi_device *> watchers[NRF_GPIO_PIN_NUM];
+            // Cubic::update()の送受信を肩代わりするモデル
+            Direct_link *direct = nullptr;
+
+            Serial_sink sink = Serial_sink::console;
+            std::string output;
+            std::deque<char> input;
+
+            State()
+            {
+                for (bool &l : level)
+                    l = true;
+            }
+        };
+
+        // スレッドごとに独立したボードを模擬できるようにする
+        thread_local State state;
+
+        // nRFのGPIO番号からArduinoのピン番号への対応(-1は対応なし)
+        struct Reverse_pin_table
+        {
+            int8_t arduino[NRF_GPIO_PIN_NUM];
+
+            Reverse_pin_table()
+            {
+                for (int8_t &a : arduino)
+                    a = -1;
+                for (int i = 0; i < ARDUINO_PIN_NUM; i++)
+                    arduino[nano33BLE_digitalWriteFast::Pin(i)] = i;
+            }
+        };
+        const Reverse_pin_table reverse_pin;
+
+        int nrf_pin(int pin)
+        {
+            if (pin < 0 || pin >= ARDUINO_PIN_NUM)
+                return -1;
+            return nano33BLE_digitalWriteFast::Pin(pin);
+        }
+
+        void write_level(const uint32_t nrf, const bool level)
+        {
+            if (nrf >= (uint32_t)NRF_GPIO_PIN_NUM)
+                return;
+            advance_ns(state.timing.gpio_write_ns);
+            state.bus_ns += state.timing.gpio_write_ns;
+            if (state.level[nrf] == level)
+                return;
+            state.level[nrf] = level;
+
+            const int pin = reverse_pin.arduino[nrf];
+            for (const Attached_device &a : state.devices)
+            {
+                if (a.nrf == (int)nrf)
+                {
+                    if (level)
+                        a.device->deselect();
+                    else
+                        a.device->select();
+                }
+            }
+            for (Spi_device *w : state.watchers[nrf])
+                w->pin_changed(pin, level);
+        }
+
+        void emit(const char *data, const size_t len)
+        {
+            switch (state.sink)
+            {
+            case Serial_sink::console:
+                fwrite(data, 1, len, stdout);
+                break;
+            case Serial_sink::capture:
+                state.output.append(data, len);
+                break;
+            case Serial_sink::discard:
+                break;
+            }
+        }
+    }
+
+    void reset(void)
+    {
+        state.devices.clear();
+        for (std::vector<Spi_device *> &w : state.watchers)
+            w.clear();
+        state.direct = nullptr;
+        state.sim_ns = 0;
+        state.real_offset_ns = 0;
+        state.epoch = std::chrono::steady_clock::now();
+        state.timing = Spi_timing();
+        state.spi_clock = 4000000;
+        state.spi_bytes = 0;
+        state.bus_ns = 0;
+        state.deferred = false;
+        state.bus_until_ns = 0;
+        state.transfer_done_ns = 0;
+        for (bool &l : state.level)
+            l = true;
+        state.output.clear();
+        state.input.clear();
+    }
+
+    void set_clock_mode(const Clock_mode mode)
+    {
+        const uint64_t now = now_ns();
+        state.mode = mode;
+        state.sim_ns = now;
+        state.epoch = std::chrono::steady_clock::now();
+        state.real_offset_ns = now;
+    }
+
+    Clock_mode clock_mode(void)
+    {
+        return state.mode;
+    }
+
+    uint64_t now_ns(void)
+    {
+        if (state.mode == Clock_mode::simulated)
+            return state.sim_ns;
+        return state.real_offset_ns + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state.epoch).count();
+    }
+
+    void advance_ns(const uint64_t ns)
+    {
+        if (state.deferred)
+        {
+            state.bus_until_ns += ns;
+            return;
+        }
+        if (state.mode == Clock_mode::simulated)
+        {
+            state.sim_ns += ns;
+            return;
+        }
+        const uint64_t until = now_ns() + ns;
+        while (now_ns() < until)
+        {
+        }
+    }
+
+    void set_micros(const uint64_t us)
+    {
+        state.sim_ns = us * 1000;
+        state.real_offset_ns = us * 1000;
+        state.epoch = std::chrono::steady_clock::now();
+    }
+
+    void set_spi_timing(const Spi_timing &timing)
+    {
+        state.timing = timing;
+    }
+
+    const Spi_timing &spi_timing(void)
+    {
+        return state.timing;
+    }
+
+    void attach(const int ss_pin, Spi_device *device)
+    {
+        const int nrf = nrf_pin(ss_pin);
+        state.devices.push_back({ss_pin, nrf, device});
+        if (nrf >= 0 && !state.level[nrf])
+            device->select();
+    }
+
+    void watch(const int pin, Spi_device *device)
+    {
+        const int nrf = nrf_pin(pin);
+        if (nrf >= 0)
+            state.watchers[nrf].push_back(device);
+    }
+
+    void detach(Spi_device *device)
+    {
+        for (size_t i = 0; i < state.devices.size();)
+        {
+            if (state.devices[i].device == device)
+                state.devices.erase(state.devices.begin() + i);
+            else
+                i++;
+        }
+        for (std::vector<Spi_device *> &w : state.watchers)
+        {
+            for (size_t i = 0; i < w.size();)
+            {
+                if (w[i] == device)
+                    w.erase(w.begin() + i);
+                else
+                    i++;
+            }
+        }
+    }
+
+    void set_direct(Direct_link *link)
+    {
+        state.direct = link;
+    }
+
+    Direct_link *direct(void)
+    {
+        return state.direct;
+    }
+
+    bool pin_level(const int pin)
+    {
+        const int nrf = nrf_pin(pin);
+        return nrf < 0 ? true : state.level[nrf];
+    }
+
+    uint64_t spi_bytes(void)
+    {
+        return state.spi_bytes;
+    }
+
+    uint64_t bus_ns(void)
+    {
+        return state.bus_ns;
+    }
+
+    uint32_t spi_clock(void)
+    {
+        return state.spi_clock;
+    }
+
+    void set_serial_sink(const Serial_sink sink)
+    {
+        state.sink = sink;
+    }
+
+    std::string &serial_output(void)
+    {
+        return state.output;
+    }
+
+    void serial_input(const char *data, const size_t len)
+    {
+        state.input.insert(state.input.end(), data, data + len);
+    }
+
+    void serial_input(const std::string &data)
+    {
+        serial_input(data.data(), data.size());
+    }
+
+    // overheadがfalseの場合は，まとめて転送する2バイト目以降としてSPI.transfer()1回分のオーバーヘッドを省く
+    uint8_t spi_transfer(const uint8_t mosi, const bool overhead)
+    {
+        // MISOはプルアップされているので，誰も応答しなければ0xFF
+        uint8_t miso = 0xFF;
+        for (const Attached_device &a : state.devices)
+        {
+            if (a.nrf >= 0 && !state.level[a.nrf])
+                miso &= a.device->transfer(mosi);
+        }
+        state.spi_bytes++;
+        const uint64_t ns = 8000000000ULL / state.spi_clock + (overhead ? state.timing.transfer_overhead_ns : 0);
+        state.bus_ns += ns;
+        advance_ns(ns);
+        return miso;
+    }
+
+    void spi_set_clock(const uint32_t clock)
+    {
+        state.spi_clock = clock ? clock : 1;
+    }
+}
+
+void CubicTransfer::start(const Job *jobs, const int num)
+{
+    using namespace Cubic_host;
+    // 実時間ではボードと同じくその場で実行する
+    const bool deferred = state.mode == Clock_mode::simulated;
+    const uint64_t now = now_ns();
+    state.bus_until_ns = now > state.bus_until_ns ? now : state.bus_until_ns;
+    state.deferred = deferred;
+    for (int i = 0; i < num; i++)
+        jobs[i]();
+    state.deferred = false;
+    state.transfer_done_ns = deferred ? state.bus_until_ns : now_ns();
+}
+
+bool CubicTransfer::busy(void)
+{
+    return Cubic_host::now_ns() < Cubic_host::state.transfer_done_ns;
+}
+
+void CubicTransfer::wait(void)
+{
+    const uint64_t now = Cubic_host::now_ns();
+    if (now < Cubic_host::state.transfer_done_ns)
+        Cubic_host::advance_ns(Cubic_host::state.transfer_done_ns - now);
+}
+
+// ホストではsteady_clockのnsをtickとする
+void Profiler::start_counter(void)
+{
+}
+
+uint32_t Profiler::now(void)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t Profiler::ticks_per_us(void)
+{
+    return 1000;
+}
+
+uint32_t micros(void)
+{
+    return (uint32_t)(Cubic_host::now_ns() / 1000);
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t)(Cubic_host::now_ns() / 1000000);
+}
+
+void delayMicroseconds(const unsigned int us)
+{
+    Cubic_host::advance_ns((uint64_t)us * 1000);
+}
+
+void delay(const unsigned long ms)
+{
+    Cubic_host::advance_ns((uint64_t)ms * 1000000);
+}
+
+void pinMode(int, int)
+{
+}
+
+void digitalWrite(const int pin, const int val)
+{
+    const int nrf = Cubic_host::nrf_pin(pin);
+    if (nrf < 0)
+        return;
+    Cubic_host::write_level(nrf, val != LOW);
+}
+
+PinStatus digitalRead(const int pin)
+{
+    return Cubic_host::pin_level(pin) ? HIGH : LOW;
+}
+
+void nrf_gpio_pin_set(const uint32_t pin_number)
+{
+    Cubic_host::write_level(pin_number, true);
+}
+
+void nrf_gpio_pin_clear(const uint32_t pin_number)
+{
+    Cubic_host::write_level(pin_number, false);
+}
+
+
+void SPIClass::begin(void)
+{
+}
+
+void SPIClass::end(void)
+{
+}
+
+void SPIClass::beginTransaction(const SPISettings settings)
+{
+    Cubic_host::spi_set_clock(settings.clock);
+}
+
+void SPIClass::endTransaction(void)
+{
+}
+
+uint8_t SPIClass::transfer(const uint8_t data)
+{
+    return Cubic_host::spi_transfer(data, true);
+}
+
+void SPIClass::transfer(void *buf, const size_t count)
+{
+    uint8_t *p = (uint8_t *)buf;
+    for (size_t i = 0; i < count; i++)
+        p[i] = Cubic_host::spi_transfer(p[i], i == 0);
+}
+
+
+void HardwareSerial::begin(unsigned long)
+{
+}
+
+void HardwareSerial::end(void)
+{
+}
+
+int HardwareSerial::available(void)
+{
+    return (int)Cubic_host::state.input.size();
+}
+
+int HardwareSerial::read(void)
+{
+    if (Cubic_host::state.input.empty())
+        return -1;
+    const char c = Cubic_host::state.input.front();
+    Cubic_host::state.input.pop_front();
+    return (uint8_t)c;
+}
+
+int HardwareSerial::peek(void)
+{
+    if (Cubic_host::state.input.empty())
+        return -1;
+    return (uint8_t)Cubic_host::state.input.front();
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+    return 256;
+}
+
+void HardwareSerial::flush(void)
+{
+    if (Cubic_host::state.sink == Cubic_host::Serial_sink::console)
+        fflush(stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t c)
+{
+    Cubic_host::emit((const char *)&c, 1);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, const size_t size)
+{
+    Cubic_host::emit((const char *)buffer, size);
+    return size;
+}
+
+size_t HardwareSerial::print(const char *s)
+{
+    size_t len = 0;
+    while (s[len])
+        len++;
+    return write((const uint8_t *)s, len);
+}
+
+size_t HardwareSerial::print(const char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(const int n, const int base)
+{
+    return print((long long)n, base);
+}
+
+size_t HardwareSerial::print(const unsigned int n, const int base)
+{
+    return print((unsigned long long)n, base);
+}
+
+size_t HardwareSerial::print(const long n, const int base)
+{
+    return print((long long)n, base);
+}
+
+size_t HardwareSerial::print(const unsigned long n, const int base)
+{
+    return print((unsigned long long)n, base);
+}
+
+size_t HardwareSerial::print(const long long n, const int base)
+{
+    if (n < 0 && base == DEC)
+    {
+        size_t len = print('-');
+        return len + print((unsigned long long)(-(n + 1)) + 1, base);
+    }
+    return print((unsigned long long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned long long n, int base)
+{
+    if (base < 2)
+        base = DEC;
+    char buf[8 * sizeof(n) + 1];
+    char *p = &buf[sizeof(buf)];
+    do
+    {
+        const int digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n);
+    return write((const uint8_t *)p, &buf[sizeof(buf)] - p);
+}
+
+size_t HardwareSerial::print(const double n, const int digits)
+{
+    char buf[64];
+    const int len = snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write((const uint8_t *)buf, len < 0 ? 0 : (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+size_t HardwareSerial::println(void)
+{
+    return write((const uint8_t *)"\r\n", 2);
+}
@@ -0,0 +1,156 @@
+/**
+ * @file cubic_host.h
+ * @brief ホスト(Linux)ビルド用のハードウェア抽象化層
+ * @details Arduino.h, SPI.hの代替が呼び出す時刻，GPIO，SPIバス，Serialの実体です。
+ * SPIのスレーブはSpi_deviceを継承したモデルをSSピンに接続することで差し替えられます。
+ * 時刻は既定で仮想時刻で，delayMicroseconds()やSPI転送の所要時間だけ進みます。
+ * CubicTransfer(Cubic::update_begin()の転送エンジン)も仮想時刻ではここで実装しており，
+ * 転送はその場で行いつつ，時刻はバスの所要時間が経過したときに完了したものとして扱います。
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace Cubic_host
+{
+    /**
+     * @brief 時刻の進め方
+     * @details simulated: 仮想時刻。待ち時間や転送時間は一瞬で済み、その分だけ時刻が進む。
+     * real: std::chrono::steady_clockによる実時間。
+     */
+    enum class Clock_mode
+    {
+        simulated,
+        real
+    };
+
+    /**
+     * @brief SPIバスの所要時間のモデル
+     * @details 1バイトの転送には8bit分のクロックに加えてtransfer_overhead_nsかかるとします。
+     * SPI.transfer(buf, count)でまとめて転送する場合，オーバーヘッドは1回分だけかかります。
+     */
+    struct Spi_timing
+    {
+        /// @brief SPI.transfer()1回あたりのオーバーヘッド[ns]
+        uint32_t transfer_overhead_ns = 1000;
+        /// @brief GPIO(SSなど)の書き込み1回あたりの時間[ns]
+        uint32_t gpio_write_ns = 60;
+    };
+
+    /**
+     * @brief SPIスレーブのモデルの基底クラス
+     * @details SSピンがLOWになるとselect()、HIGHになるとdeselect()が呼ばれます。
+     * 選択中のデバイスが複数ある場合、MISOは各デバイスの応答の論理積になります。
+     */
+    class Spi_device
+    {
+    public:
+        virtual ~Spi_device() = default;
+
+        // SSがLOWになったときに呼ばれる
+        virtual void select(void) {}
+
+        // 1バイトを送受信する。戻り値がMISOに出力される
+        virtual uint8_t transfer(uint8_t mosi) = 0;
+
+        // SSがHIGHになったときに呼ばれる
+        virtual void deselect(void) {}
+
+        // watch()したピンの出力が変化したときに呼ばれる(ピン番号はArduinoのピン番号)
+        virtual void pin_changed(int, bool) {}
+    };
+
+    /**
+     * @brief Cubic::update()の送受信をSPIのバイト列を介さずに行うモデルの基底クラス
+     * @details set_direct()で登録すると，Cubic::update()はDutyの送信と各センサの受信でSPIとGPIOを使わずに
+     * send()とreceive()を呼びます。バスの所要時間やフレームの破損は模擬しないので，物理モデルと制御器を速く回すとき向けです。
+     */
+    class Direct_link
+    {
+    public:
+        virtual ~Direct_link() = default;
+
+        // Dutyを送信するときに呼ばれる
+        virtual void send(void) = 0;
+
+        // 各センサを受信するときに呼ばれる
+        virtual void receive(void) = 0;
+    };
+
+    // すべての状態(時刻，ピン，接続されたデバイス，Serial)を初期化する
+    void reset(void);
+
+    void set_clock_mode(Clock_mode mode);
+    Clock_mode clock_mode(void);
+
+    // 現在時刻[ns]
+    uint64_t now_ns(void);
+
+    // 仮想時刻をns進める(実時間モードでは待つ)
+    void advance_ns(uint64_t ns);
+
+    // 仮想時刻を設定する(micros()のオーバーフローの確認用)
+    void set_micros(uint64_t us);
+
+    void set_spi_timing(const Spi_timing &timing);
+    const Spi_timing &spi_timing(void);
+
+    /**
+     * @brief SPIスレーブのモデルをSSピンに接続する
+     *
+     * @param ss_pin SSのArduinoピン番号
+     * @param device デバイス。呼び出し側が寿命を管理する
+     */
+    void attach(int ss_pin, Spi_device *device);
+
+    /**
+     * @brief ピンの出力の変化をデバイスに通知するようにする
+     *
+     * @param pin Arduinoのピン番号
+     * @param device 通知先のデバイス
+     */
+    void watch(int pin, Spi_device *device);
+
+    // SPIスレーブのモデルを取り外す(watch()も解除する)
+    void detach(Spi_device *device);
+
+    // Cubic::update()の送受信を肩代わりするモデルを登録する(nullptrならSPIで送受信する)
+    void set_direct(Direct_link *link);
+
+    // 登録されているDirect_link(無ければnullptr)
+    Direct_link *direct(void);
+
+    // ピンの出力レベルを取得する(Arduinoのピン番号)
+    bool pin_level(int pin);
+
+    // SPI.transfer()された累計バイト数
+    uint64_t spi_bytes(void);
+
+    // SPI転送とGPIOの書き込みにかかった累計時間[ns]
+    uint64_t bus_ns(void);
+
+    // 現在のSPIクロック[Hz]
+    uint32_t spi_clock(void);
+
+    /**
+     * @brief Serialの出力先
+     * @details console: 標準出力，capture: serial_output()に蓄える，discard: 捨てる
+     */
+    enum class Serial_sink
+    {
+        console,
+        capture,
+        discard
+    };
+
+    void set_serial_sink(Serial_sink sink);
+
+    // captureしたSerialの出力
+    std::string &serial_output(void);
+
+    // Serial.read()で読まれるデータを追加する
+    void serial_input(const char *data, size_t len);
+    void serial_input(const std::string &data);
+}
@@ -0,0 +1,189 @@
+/**
+ * @file cubic_plant.cpp
+ * @brief ホスト(Linux)ビルド用の，DCモータとエンコーダの物理モデル
+ */
+
+#include "cubic_plant.h"
+
+#include <math.h>
+
+namespace Cubic_host
+{
+    Motor_plant::Motor_plant(const Motor_params &params)
+        : _params(params)
+    {
+        // 負荷の慣性はモータ軸に換算する
+        inertia = params.rotor_inertia + params.load_inertia / (params.gear_ratio * params.gear_ratio);
+    }
+
+    void Motor_plant::reset(const double angle)
+    {
+        motor_angle = angle * _params.gear_ratio;
+        motor_velocity = 0.0;
+        _current = 0.0;
+    }
+
+    void Motor_plant::step(const double duty, const double dt)
+    {
+        const Motor_params &p = _params;
+        if (dt != coef_dt)
+        {
+            coef_dt = dt;
+            coef_voltage = p.inductance > 0.0 ? dt / p.inductance : 0.0;
+            coef_current = p.inductance > 0.0 ? 1.0 / (1.0 + dt * p.resistance / p.inductance) : 1.0 / p.resistance;
+            coef_velocity = dt / inertia;
+        }
+        const double emf = p.torque_constant * motor_velocity;
+        const double voltage = p.voltage * duty;
+        if (p.inductance > 0.0)
+            _current = (_current + coef_voltage * (voltage - emf)) * coef_current;
+        else
+            _current = (voltage - emf) * coef_current;
+
+        const double drive = p.torque_constant * _current - p.viscous_friction * motor_velocity - p.load_torque / p.gear_ratio;
+        if (motor_velocity == 0.0 && fabs(drive) <= p.coulomb_friction)
+        {
+            // 静止摩擦で止まったまま
+            return;
+        }
+        const double direction = motor_velocity != 0.0 ? (motor_velocity > 0.0 ? 1.0 : -1.0) : (drive > 0.0 ? 1.0 : -1.0);
+        const double next = motor_velocity + (drive - direction * p.coulomb_friction) * coef_velocity;
+        // 摩擦で向きが反転することはないので，0をまたいだら止める
+        motor_velocity = motor_velocity != 0.0 && next * motor_velocity < 0.0 ? 0.0 : next;
+        motor_angle += motor_velocity * dt;
+    }
+
+    int64_t Motor_plant::inc_count(void) const
+    {
+        const double counts = floor(angle() * _params.inc_cpr / (2.0 * M_PI));
+        return _params.reversed ? -(int64_t)counts : (int64_t)counts;
+    }
+
+    uint16_t Motor_plant::abs_value(void) const
+    {
+        const double turns = (_params.reversed ? -angle() : angle()) / (2.0 * M_PI);
+        const int64_t value = (int64_t)floor((turns - floor(turns)) * _params.abs_cpr);
+        return (uint16_t)(value % _params.abs_cpr);
+    }
+
+
+    Plant_model::Plant_model(Board_model &board)
+        : board(board), last_ns(now_ns())
+    {
+        watch(SS_MD_A, this);
+        watch(SS_MD_B, this);
+        watch(ENABLE_MD_A, this);
+        watch(ENABLE_MD_B, this);
+        watch(SS_INC_ENC, this);
+        watch(SS_ABS_ENC, this);
+        watch(SS_ADC_A, this);
+    }
+
+    Plant_model::~Plant_model()
+    {
+        detach(this);
+        if (direct() == this)
+            set_direct(nullptr);
+    }
+
+    Motor_plant &Plant_model::add_motor(const int motor, const Motor_params &params, const int inc_ch, const int abs_ch)
+    {
+        sync();
+        motors.push_back({Motor_plant(params), motor, inc_ch, abs_ch, 0, 0.0});
+        Motor &m = motors.back();
+        m.inc_written = m.plant.inc_count();
+        latch_duty(m);
+        write_sensors(m);
+        return m.plant;
+    }
+
+    void Plant_model::sync(void)
+    {
+        // 決まった刻みで進め，端数は次に回す(センサの値は最大1刻み遅れる)
+        const uint64_t n = (now_ns() - last_ns) / step_ns;
+        if (n > 0)
+        {
+            const double dt = step_ns * 1e-9;
+            for (Motor &m : motors)
+            {
+                for (uint64_t i = 0; i < n; i++)
+                    m.plant.step(m.duty, dt);
+                write_sensors(m);
+            }
+            last_ns += n * step_ns;
+            _steps += n;
+        }
+        // 新しいDutyは次の刻みから効く
+        for (Motor &m : motors)
+            latch_duty(m);
+    }
+
+    void Plant_model::send(void)
+    {
+        board.send();
+        sync();
+    }
+
+    void Plant_model::receive(void)
+    {
+        sync();
+        board.receive();
+    }
+
+    void Plant_model::latch_duty(Motor &m)
+    {
+        constexpr int slots = Motor_driver_slave::SLOT_NUM;
+        const Motor_driver_slave &md = m.motor < slots ? board.md_a : board.md_b;
+        m.duty = (double)md.duty(m.motor % slots) / DUTY_SPI_MAX;
+    }
+
+    void Plant_model::write_sensors(Motor &m)
+    {
+        if (m.inc_ch >= 0)
+        {
+            const int64_t count = m.plant.inc_count();
+            board.inc.add_count(m.inc_ch, (int32_t)(count - m.inc_written));
+            m.inc_written = count;
+        }
+        if (m.abs_ch >= 0)
+            board.abs.set_value(m.abs_ch, m.plant.abs_value());
+        if (m.motor < DC_MOTOR_NUM)
+            board.set_motor_current(m.motor, (float)m.plant.current());
+    }
+
+
+    Step_metrics step_metrics(const std::vector<double> &time, const std::vector<double> &value, const double initial, const double target)
+    {
+        Step_metrics m = {-1.0, 0.0, -1.0, 0.0};
+        const size_t n = value.size();
+        const double span = target - initial;
+        if (n == 0 || span == 0.0)
+            return m;
+
+        // 変化量に対する割合
+        double t10 = -1.0, peak = 0.0;
+        size_t settled = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            const double r = (value[i] - initial) / span;
+            if (t10 < 0.0 && r >= 0.1)
+                t10 = time[i];
+            if (m.rise_time < 0.0 && r >= 0.9)
+                m.rise_time = time[i] - t10;
+            peak = fmax(peak, r);
+            if (fabs(r - 1.0) > 0.02)
+                settled = i + 1;
+        }
+        m.overshoot = fmax(0.0, peak - 1.0) * 100.0;
+        if (settled < n)
+            m.settling_time = time[settled];
+
+        // 最後の10%(少なくとも1点)
+        const size_t tail = n - (n >= 10 ? n / 10 : 1);
+        double sum = 0.0;
+        for (size_t i = tail; i < n; i++)
+            sum += fabs(target - value[i]);
+        m.steady_state_error = sum / (n - tail);
+        return m;
+    }
+}
@@ -0,0 +1,202 @@
+/**
+ * @file cubic_plant.h
+ * @brief ホスト(Linux)ビルド用の，DCモータとエンコーダの物理モデル
+ * @details Board_modelのモータドライバが受け取ったDutyでモータを回し，その角度をエンコーダとADCのモデルに書き込みます。
+ * ライブラリからはDC_motor，Inc_enc，Abs_enc，Adcを通して実機と同じように見えます。
+ *
+ * モデルはSSとENABLEのピンが変化するたびに仮想時刻まで一定の刻みで進めるので，エンコーダは読まれた時刻(の直前の刻み)の角度を返し，
+ * Dutyは送信された時刻の次の刻みから効きます。乱数は使わないので，同じ入力からは毎回同じ結果になります。
+ *
+ * Cubic_host::set_direct(&plant)で直結モードにすると，Cubic::update()はSPIのバイト列を模擬せずにモデルと直接やり取りし，
+ * 送信時と受信時にモデルを進めます。バスの所要時間の分だけ時刻がずれますが，1ループが桁違いに速くなります。
+ */
+
+#pragma once
+#include "cubic_host.h"
+#include "cubic_slave.h"
+
+#include <vector>
+
+namespace Cubic_host
+{
+    /**
+     * @brief DCモータ，ギア，負荷，エンコーダのパラメータ
+     * @details 慣性，粘性摩擦，クーロン摩擦はモータ軸，負荷の慣性とトルクとエンコーダは出力軸(ギアの後)で与えます。
+     */
+    struct Motor_params
+    {
+        /// @brief 電源電圧[V](duty比1のときの電圧)
+        double voltage = 24.0;
+        /// @brief 巻線抵抗[Ω]
+        double resistance = 2.5;
+        /// @brief インダクタンス[H]。0なら電流は電圧に即座に従う
+        double inductance = 0.5e-3;
+        /// @brief トルク定数[Nm/A](逆起電力定数[V/(rad/s)]と同じとする)
+        double torque_constant = 0.02;
+        /// @brief ロータの慣性モーメント[kg m^2]
+        double rotor_inertia = 1e-5;
+        /// @brief 粘性摩擦[Nm/(rad/s)]
+        double viscous_friction = 1e-6;
+        /// @brief クーロン摩擦(静止摩擦も同じ)[Nm]
+        double coulomb_friction = 2e-3;
+        /// @brief 減速比(モータ軸の回転数 / 出力軸の回転数)
+        double gear_ratio = 19.2;
+        /// @brief 出力軸の負荷の慣性モーメント[kg m^2]
+        double load_inertia = 1e-3;
+        /// @brief 出力軸に常にかかるトルク(重力など)[Nm]
+        double load_torque = 0.0;
+        /// @brief インクリメンタルエンコーダのCPR(出力軸1回転あたり)
+        int inc_cpr = 2048 * 4;
+        /// @brief アブソリュートエンコーダのCPR(出力軸1回転あたり)
+        int abs_cpr = 16384;
+        /// @brief 正のDutyでエンコーダが減る向きに取り付けているかどうか
+        bool reversed = false;
+    };
+
+    /**
+     * @brief 1つのDCモータの物理モデル
+     * @details 電流は後退オイラー法，角速度は半陰的オイラー法で進めるので，刻みを細かくしなくても発散しません。
+     */
+    class Motor_plant
+    {
+    public:
+        explicit Motor_plant(const Motor_params &params = Motor_params());
+
+        /**
+         * @brief duty比を一定としてdt[s]進める
+         *
+         * @param duty -1~1
+         * @param dt 刻み[s]
+         */
+        void step(double duty, double dt);
+
+        // 出力軸の角度を設定し，静止させる
+        void reset(double angle = 0.0);
+
+        const Motor_params &params(void) const { return _params; }
+
+        // 出力軸の角度[rad]，角速度[rad/s]
+        double angle(void) const { return motor_angle / _params.gear_ratio; }
+        double velocity(void) const { return motor_velocity / _params.gear_ratio; }
+
+        // 巻線電流[A]
+        double current(void) const { return _current; }
+
+        // エンコーダの値(向きを含む)
+        int64_t inc_count(void) const;
+        uint16_t abs_value(void) const;
+
+    private:
+        Motor_params _params;
+        double inertia;
+        // 刻みごとに変わらない係数(割り算を毎回しないように，刻みが変わったときに求め直す)
+        double coef_dt = 0.0;
+        double coef_voltage;
+        double coef_current;
+        double coef_velocity;
+        double motor_angle = 0.0;
+        double motor_velocity = 0.0;
+        double _current = 0.0;
+    };
+
+    /**
+     * @brief Board_modelにつないだモータの物理モデル
+     * @details モータ番号はDC_motor::put()と同じで，DC_MOTOR_NUM未満ならADCに電流も書き込みます。
+     *
+     * @code
+     * Cubic_host::Board_model board;
+     * Cubic_host::Plant_model plant(board);
+     * plant.add_motor(0, Cubic_host::Motor_params(), 0, -1);  // モータ0，インクリメンタルエンコーダ0
+     * Cubic::begin(true, 10.0);
+     * @endcode
+     */
+    class Plant_model : public Spi_device, public Direct_link
+    {
+    public:
+        explicit Plant_model(Board_model &board);
+        ~Plant_model();
+        Plant_model(const Plant_model &) = delete;
+        Plant_model &operator=(const Plant_model &) = delete;
+
+        /**
+         * @brief モータを追加する
+         *
+         * @param motor モータ番号(DC_motor::put()の番号)
+         * @param params パラメータ
+         * @param inc_ch 書き込むインクリメンタルエンコーダの番号。-1なら書き込まない
+         * @param abs_ch 書き込むアブソリュートエンコーダの番号。-1なら書き込まない
+         * @return Motor_plant& 追加したモータ(次にadd_motor()するまで有効)
+         */
+        Motor_plant &add_motor(int motor, const Motor_params &params, int inc_ch, int abs_ch);
+
+        // add_motor()した順のi番目のモータ
+        Motor_plant &motor(int i) { return motors[i].plant; }
+        int motor_num(void) const { return (int)motors.size(); }
+
+        // 仮想時刻まで刻みごとに進め，エンコーダとADCに書き込む。ピンが変化したときにも呼ばれる
+        void sync(void);
+
+        // step()の刻み[ns](既定は20us)
+        void set_step_ns(uint32_t ns) { step_ns = ns > 0 ? ns : 1; }
+
+        // これまでに進めた刻みの数
+        uint64_t steps(void) const { return _steps; }
+
+        uint8_t transfer(uint8_t) override { return 0xFF; }
+        void pin_changed(int, bool) override { sync(); }
+
+        // 直結モードで，Dutyを渡してから進める(新しいDutyは次の刻みから効く)
+        void send(void) override;
+
+        // 直結モードで，進めてからセンサの値を渡す
+        void receive(void) override;
+
+    private:
+        struct Motor
+        {
+            Motor_plant plant;
+            int motor;
+            int inc_ch;
+            int abs_ch;
+            int64_t inc_written;
+            double duty;
+        };
+
+        // モータドライバが受け取ったDutyを読む
+        void latch_duty(Motor &m);
+
+        // エンコーダとADCに書き込む
+        void write_sensors(Motor &m);
+
+        Board_model &board;
+        std::vector<Motor> motors;
+        uint64_t last_ns;
+        uint32_t step_ns = 20000;
+        uint64_t _steps = 0;
+    };
+
+    /**
+     * @brief ステップ応答の評価値
+     */
+    struct Step_metrics
+    {
+        /// @brief 変化量の10%から90%に達するまでの時間[s]。達しなければ負
+        double rise_time;
+        /// @brief 行き過ぎ量[%](変化量に対する割合)
+        double overshoot;
+        /// @brief 目標値の±2%(変化量に対する割合)に収まり続けるようになった時刻[s]。収まらなければ負
+        double settling_time;
+        /// @brief 最後の10%の区間の目標値との差の絶対値の平均
+        double steady_state_error;
+    };
+
+    /**
+     * @brief ステップ応答を評価する
+     *
+     * @param time 時刻[s](ステップを与えた時刻を0とする)
+     * @param value 応答
+     * @param initial ステップ前の値
+     * @param target 目標値
+     */
+    Step_metrics step_metrics(const std::vector<double> &time, const std::vector<double> &value, double initial, double target);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file cubic_replay.cpp
+ * @brief ホスト(Linux)ビルド用の，記録(cubic_record.h)の読み込み
+ */
+
+#include "cubic_replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace Cubic_host
+{
+    Record_stats parse_records(const uint8_t *data, const size_t len, std::vector<Record_cycle> &records)
+    {
+        Record_stats stats = {0, 0, 0};
+        uint8_t payload[TELEMETRY_MAX_FRAME_BYTES];
+        size_t begin = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (data[i] != 0)
+                continue;
+            const size_t n = i - begin;
+            const uint8_t *frame = &data[begin];
+            begin = i + 1;
+            if (n == 0)
+                continue;
+
+            // 長すぎるフレームは区切りを見失ったものとして捨てる
+            const size_t decoded = n <= TELEMETRY_MAX_FRAME_BYTES ? Telemetry::cobs_decode(frame, n, payload) : 0;
+            if (decoded < 3 || CubicFrame::crc16(payload, decoded - 2) != (uint16_t)(payload[decoded - 2] << 8 | payload[decoded - 1]))
+            {
+                stats.bad++;
+                continue;
+            }
+            const size_t len = decoded - 3;
+            if (payload[0] != TelemetryType::RECORD || len < RECORD_HEADER_BYTES || len > sizeof(Record_cycle))
+            {
+                stats.other++;
+                continue;
+            }
+            // clockは読んだ数だけ送られてくる
+            Record_cycle r = {};
+            memcpy(&r, &payload[1], len);
+            const size_t clocks = r.clock_num < RECORD_CLOCK_NUM ? r.clock_num : RECORD_CLOCK_NUM;
+            if (len != RECORD_HEADER_BYTES + clocks * sizeof(uint32_t))
+            {
+                stats.bad++;
+                continue;
+            }
+            records.push_back(r);
+            stats.records++;
+        }
+        return stats;
+    }
+
+    bool load_records(const char *path, std::vector<Record_cycle> &records, Record_stats *stats)
+    {
+        FILE *in = fopen(path, "rb");
+        if (in == nullptr)
+            return false;
+        std::vector<uint8_t> data;
+        uint8_t chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+            data.insert(data.end(), chunk, chunk + n);
+        fclose(in);
+
+        const Record_stats s = parse_records(data.data(), data.size(), records);
+        if (stats != nullptr)
+            *stats = s;
+        return true;
+    }
+}
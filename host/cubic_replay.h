@@ -0,0 +1,48 @@
+/**
+ * @file cubic_replay.h
+ * @brief ホスト(Linux)ビルド用の，記録(cubic_record.h)の読み込み
+ * @details ボードがSerialに送ったバイト列から記録のフレームを取り出します。読み込んだレコードをRecorder::play()に与え，
+ * スケッチと同じsetup()とloop()を動かすと，Cubic::update()が記録した受信データを順に反映します。
+ *
+ * @code
+ * std::vector<Record_cycle> records;
+ * Cubic_host::load_records("match.bin", records);
+ * Cubic_host::reset();
+ * Recorder::play(records.data(), records.size());
+ * setup();
+ * while (Recorder::playing())
+ *     loop();
+ * printf("%u\n", Recorder::mismatches());
+ * @endcode
+ */
+
+#pragma once
+#include "cubic_record.h"
+
+#include <vector>
+
+namespace Cubic_host
+{
+    struct Record_stats
+    {
+        /// @brief 取り出したレコードの数
+        size_t records;
+        /// @brief 読み飛ばした他の種類(テレメトリなど)のフレームの数
+        size_t other;
+        /// @brief COBSかCRCが不正で捨てたフレームの数
+        size_t bad;
+    };
+
+    /**
+     * @brief 0x00で区切られたフレームのストリームからレコードを取り出し，recordsの後ろに追加する
+     * @details 途中から記録を始めた場合でも，次の0x00から同期します。
+     */
+    Record_stats parse_records(const uint8_t *data, size_t len, std::vector<Record_cycle> &records);
+
+    /**
+     * @brief ファイルからレコードを読み込む
+     *
+     * @return bool ファイルを開けたかどうか
+     */
+    bool load_records(const char *path, std::vector<Record_cycle> &records, Record_stats *stats = nullptr);
+}
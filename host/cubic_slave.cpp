@@ -0,0 +1,360 @@
+/**
+ * @file cubic_slave.cpp
+ * @brief ホスト(Linux)ビルド用の，Cubicの各SPIスレーブのモデルの実装
+ */
+
+#include "cubic_slave.h"
+
+#include <string.h>
+
+namespace Cubic_host
+{
+    Motor_driver_slave::Motor_driver_slave(const int enable_pin, const uint8_t version)
+        : enable_pin(enable_pin), version(version)
+    {
+    }
+
+    void Motor_driver_slave::pin_changed(const int pin, const bool level)
+    {
+        if (pin == enable_pin)
+            enable_level = level;
+    }
+
+    void Motor_driver_slave::select(void)
+    {
+        position = 0;
+        command = 0;
+    }
+
+    void Motor_driver_slave::finish_frame(void)
+    {
+        const int len = SLOT_NUM * DC_MOTOR_BYTES;
+        if (corrupt)
+        {
+            frame[3] ^= 0x01;
+            corrupt = false;
+        }
+        const uint16_t crc = (frame[3 + len] << 8) | frame[4 + len];
+        if (frame[2] != len || CubicFrame::crc16(&frame[1], len + 2) != crc)
+        {
+            ack = CubicFrame::NAK;
+            _naks++;
+            return;
+        }
+        const uint8_t seq = frame[1];
+        if (received_seq && seq != (uint8_t)(last_seq + 1))
+            _dropped++;
+        received_seq = true;
+        last_seq = seq;
+
+        for (int i = 0; i < SLOT_NUM; i++)
+            duties[i] = (int16_t)(frame[3 + i * 2] | (frame[4 + i * 2] << 8));
+        ack = CubicFrame::ACK;
+        _frames++;
+    }
+
+    uint8_t Motor_driver_slave::transfer(const uint8_t mosi)
+    {
+        const int pos = position++;
+        if (pos == 0 && !enable_level && version >= CubicFrame::VERSION_BURST && (mosi == CubicFrame::CMD_VERSION || mosi == CubicFrame::CMD_DUTY))
+        {
+            command = mosi;
+            frame[0] = mosi;
+            ack = CubicFrame::NAK;
+            return 0xFF;
+        }
+
+        switch (command)
+        {
+        case CubicFrame::CMD_VERSION:
+            return pos == 1 ? CubicFrame::SYNC : pos == 2 ? version : pos == 3 ? (uint8_t)~version : 0x00;
+        case CubicFrame::CMD_DUTY:
+            // CRCの2バイト目までを受信したら判定し，応答待ちの1バイトの後にACK/NAKとシーケンス番号を返す
+            if (pos < DC_MOTOR_FRAME_BYTES - 3)
+            {
+                frame[pos] = mosi;
+                if (pos == DC_MOTOR_FRAME_BYTES - 4)
+                    finish_frame();
+                return 0x00;
+            }
+            if (pos == DC_MOTOR_FRAME_BYTES - 2)
+                return ack;
+            if (pos == DC_MOTOR_FRAME_BYTES - 1)
+                return frame[1];
+            return 0x00;
+        default:
+            break;
+        }
+
+        // 従来のプロトコル
+        if (!enable_level)
+        {
+            index = 0;
+            return 0xFF;
+        }
+        if (index >= SLOT_NUM * DC_MOTOR_BYTES)
+            return 0x00;
+
+        rx[index++] = mosi;
+        if (index == SLOT_NUM * DC_MOTOR_BYTES)
+        {
+            for (int i = 0; i < SLOT_NUM; i++)
+                duties[i] = (int16_t)(rx[i * 2] | (rx[i * 2 + 1] << 8));
+            _frames++;
+        }
+        return 0x00;
+    }
+
+    void Motor_driver_slave::receive_duty(const int16_t *duty)
+    {
+        for (int i = 0; i < SLOT_NUM; i++)
+            duties[i] = duty[i];
+        _frames++;
+    }
+
+    int16_t Motor_driver_slave::duty(const int slot) const
+    {
+        if (slot < 0 || slot >= SLOT_NUM)
+            return 0;
+        return duties[slot];
+    }
+
+
+    Inc_enc_slave::Inc_enc_slave(const uint8_t version)
+        : version(version)
+    {
+    }
+
+    uint8_t Inc_enc_slave::count_byte(const int i) const
+    {
+        return (uint8_t)((uint32_t)counts[i / INC_ENC_BYTES] >> (8 * (i % INC_ENC_BYTES)));
+    }
+
+    void Inc_enc_slave::build_frame(void)
+    {
+        const int len = CH_NUM * INC_ENC_BYTES;
+        frame[0] = CubicFrame::SYNC;
+        frame[1] = len;
+        for (int i = 0; i < len; i++)
+            frame[2 + i] = count_byte(i);
+        const uint16_t crc = CubicFrame::crc16(&frame[1], len + 1);
+        frame[INC_ENC_FRAME_BYTES - 2] = crc >> 8;
+        frame[INC_ENC_FRAME_BYTES - 1] = crc & 0xff;
+        if (corrupt)
+        {
+            frame[2] ^= 0x01;
+            corrupt = false;
+        }
+        _frames++;
+    }
+
+    void Inc_enc_slave::select(void)
+    {
+        position = 0;
+        command = 0;
+    }
+
+    uint8_t Inc_enc_slave::transfer(const uint8_t mosi)
+    {
+        const int pos = position++;
+        if (pos == 0)
+        {
+            const uint8_t ret = count_byte(index);
+            if (version >= CubicFrame::VERSION_BURST && (mosi == CubicFrame::CMD_VERSION || mosi == CubicFrame::CMD_INC_BURST))
+            {
+                command = mosi;
+                if (command == CubicFrame::CMD_INC_BURST)
+                    build_frame();
+            }
+            else
+            {
+                index = (index + 1) % (CH_NUM * INC_ENC_BYTES);
+            }
+            return ret;
+        }
+
+        switch (command)
+        {
+        case CubicFrame::CMD_VERSION:
+            return pos == 1 ? CubicFrame::SYNC : pos == 2 ? version : pos == 3 ? (uint8_t)~version : 0x00;
+        case CubicFrame::CMD_INC_BURST:
+            return pos - 1 < INC_ENC_FRAME_BYTES ? frame[pos - 1] : 0x00;
+        default:
+        {
+            // 従来のプロトコルではSSを下げたままでも1バイトごとに送信位置を進める
+            const uint8_t ret = count_byte(index);
+            index = (index + 1) % (CH_NUM * INC_ENC_BYTES);
+            return ret;
+        }
+        }
+    }
+
+    void Inc_enc_slave::pin_changed(const int pin, const bool level)
+    {
+        if (pin != INC_ENC_RESET || level)
+            return;
+        for (int32_t &c : counts)
+            c = 0;
+        index = 0;
+    }
+
+
+    Abs_enc_slave::Abs_enc_slave()
+    {
+        for (int i = 0; i < ABS_ENC_NUM; i++)
+            set_error(i);
+    }
+
+    uint16_t Abs_enc_slave::add_parity(uint16_t value)
+    {
+        value &= 0x3fff;
+        bool odd = true;
+        bool even = true;
+        for (int i = 0; i < 14; i += 2)
+        {
+            even ^= (value >> i) & 1;
+            odd ^= (value >> (i + 1)) & 1;
+        }
+        return value | (uint16_t)odd << 15 | (uint16_t)even << 14;
+    }
+
+    void Abs_enc_slave::set_value(const int ch, const uint16_t value)
+    {
+        words[ch] = add_parity(value);
+    }
+
+    void Abs_enc_slave::set_error(const int ch)
+    {
+        words[ch] = ABS_ENC_ERR_RP2040;
+    }
+
+    uint8_t Abs_enc_slave::transfer(uint8_t)
+    {
+        const uint16_t word = words[index / ABS_ENC_BYTES];
+        const uint8_t ret = (uint8_t)(word >> (8 * (index % ABS_ENC_BYTES)));
+        index = (index + 1) % (ABS_ENC_NUM * ABS_ENC_BYTES);
+        return ret;
+    }
+
+
+    Adc_slave::Adc_slave()
+    {
+        for (int i = 0; i < CH_NUM; i++)
+            raw[i] = (uint16_t)CURRENT_RES;
+    }
+
+    void Adc_slave::select(void)
+    {
+        index = 0;
+    }
+
+    uint8_t Adc_slave::transfer(const uint8_t mosi)
+    {
+        uint8_t ret = 0xFF;
+        switch (index)
+        {
+        case 0:
+            command = mosi;
+            break;
+        case 1:
+        {
+            const int ch = ((command & 0x01) << 2) | (mosi >> 6);
+            command = ch;
+            ret = (uint8_t)(raw[ch] >> 8) & 0x0f;
+            break;
+        }
+        case 2:
+            ret = (uint8_t)raw[command];
+            _conversions++;
+            break;
+        default:
+            break;
+        }
+        index++;
+        return ret;
+    }
+
+    void Adc_slave::set_raw(const int ch, const uint16_t value)
+    {
+        raw[ch] = value & 0x0fff;
+    }
+
+    void Adc_slave::set_current(const int ch, const float current)
+    {
+        const float counts = current / CURRENT_MAX * CURRENT_RES + CURRENT_RES;
+        set_raw(ch, (uint16_t)constrain(counts + 0.5f, 0.0f, 4095.0f));
+    }
+
+
+    Board_model::Board_model(const uint8_t version)
+        : md_a(ENABLE_MD_A, version), md_b(ENABLE_MD_B, version), inc(version)
+    {
+        attach(SS_MD_A, &md_a);
+        watch(ENABLE_MD_A, &md_a);
+        attach(SS_MD_B, &md_b);
+        watch(ENABLE_MD_B, &md_b);
+        attach(SS_INC_ENC, &inc);
+        watch(INC_ENC_RESET, &inc);
+        attach(SS_ABS_ENC, &abs);
+        attach(SS_ADC_A, &adc);
+    }
+
+    Board_model::~Board_model()
+    {
+        detach(&md_a);
+        detach(&md_b);
+        detach(&inc);
+        detach(&abs);
+        detach(&adc);
+        if (direct() == this)
+            set_direct(nullptr);
+    }
+
+    void Board_model::send(void)
+    {
+        md_a.receive_duty(&DC_motor::out[0]);
+        if (DC_motor::use_B())
+            md_b.receive_duty(&DC_motor::out[Motor_driver_slave::SLOT_NUM]);
+        // フレームは壊れないので，常にACKが返ってきたものとする
+        DC_motor::_seq++;
+        DC_motor::_acked = true;
+    }
+
+    void Board_model::receive(void)
+    {
+        // SPIで受信するときと同じバイト列(リトルエンディアン)を組み立ててから写す
+        uint8_t inc_bytes[sizeof(Inc_enc::back)];
+        for (int i = 0; i < Inc_enc_slave::CH_NUM; i++)
+        {
+            for (int b = 0; b < INC_ENC_BYTES; b++)
+                inc_bytes[i * INC_ENC_BYTES + b] = (uint8_t)((uint32_t)inc.count(i) >> (8 * b));
+        }
+        memcpy(Inc_enc::back, inc_bytes, sizeof(inc_bytes));
+        Inc_enc::back_valid = true;
+
+        uint8_t abs_bytes[sizeof(Abs_enc::back)];
+        for (int i = 0; i < ABS_ENC_NUM; i++)
+        {
+            const uint16_t w = abs.word(i);
+            abs_bytes[i * ABS_ENC_BYTES] = (uint8_t)w;
+            abs_bytes[i * ABS_ENC_BYTES + 1] = (uint8_t)(w >> 8);
+        }
+        memcpy(Abs_enc::back, abs_bytes, sizeof(abs_bytes));
+
+        const int samples = 1 << Adc::oversample_shift;
+        for (int i = 0; i < DC_MOTOR_NUM; i++)
+        {
+            if (!(Adc::mask & (1 << i)))
+                continue;
+            uint16_t sum = 0;
+            for (int j = 0; j < samples; j++)
+                sum += adc.convert(Adc::ch[i]);
+            Adc::back[i] = sum;
+        }
+    }
+
+    void Board_model::set_motor_current(const int motor, const float current)
+    {
+        adc.set_current(Adc::ch[motor], current);
+    }
+}
@@ -0,0 +1,228 @@
+/**
+ * @file cubic_slave.h
+ * @brief ホスト(Linux)ビルド用の，Cubicの各SPIスレーブ(RP2040，ADC)のモデル
+ * @details cubic_arduino.cppが送受信するバイト列と同じものを返すように作られています。
+ */
+
+#pragma once
+#include "cubic_host.h"
+#include "cubic_arduino.h"
+
+namespace Cubic_host
+{
+    /**
+     * @brief モータドライバのRP2040のモデル
+     * @details 従来のプロトコルでは，ENABLE_MDがLOWの間に受信したバイトは送信要求として0xFFを返し，
+     * その後ENABLE_MDがHIGHの間に受信した(DC_MOTOR_NUM+SOL_SUB_NUM)*DC_MOTOR_BYTESバイトをDutyとして受け取ります。
+     *
+     * CubicFrame::VERSION_BURST以上を指定すると，ENABLE_MDがLOWの状態でSSを下げた直後の1バイトがコマンドであれば
+     * バージョンの応答，またはDutyフレームの受信とACK/NAKの応答を行います。CRCが合わないフレームのDutyは反映しません。
+     */
+    class Motor_driver_slave : public Spi_device
+    {
+    public:
+        static constexpr int SLOT_NUM = DC_MOTOR_NUM + SOL_SUB_NUM;
+
+        /**
+         * @param enable_pin ENABLE_MD_AまたはENABLE_MD_B
+         * @param version ファームウェアが対応するプロトコルバージョン
+         */
+        explicit Motor_driver_slave(int enable_pin, uint8_t version = CubicFrame::VERSION_BURST);
+
+        void select(void) override;
+        uint8_t transfer(uint8_t mosi) override;
+        void pin_changed(int pin, bool level) override;
+
+        // 最後に受け取ったDuty(-DUTY_SPI_MAX~DUTY_SPI_MAX)
+        int16_t duty(int slot) const;
+
+        // Dutyを受け取った回数
+        uint32_t frames(void) const { return _frames; }
+
+        // CRCが合わずにNAKを返した回数
+        uint32_t naks(void) const { return _naks; }
+
+        // シーケンス番号が飛んでいた回数
+        uint32_t dropped(void) const { return _dropped; }
+
+        // 次に受信するDutyフレームのデータを1bit反転させる(通信エラーの再現用)
+        void corrupt_next_frame(void) { corrupt = true; }
+
+        // SPIを介さずにDutyを受け取る(直結モード用)
+        void receive_duty(const int16_t *duty);
+
+    private:
+        // Dutyフレームを最後まで受信したときに呼ばれる
+        void finish_frame(void);
+
+        const int enable_pin;
+        const uint8_t version;
+        bool enable_level = true;
+        int index = SLOT_NUM * DC_MOTOR_BYTES;
+        uint8_t rx[SLOT_NUM * DC_MOTOR_BYTES] = {};
+        int16_t duties[SLOT_NUM] = {};
+        uint32_t _frames = 0;
+
+        // SSを下げてから受信したバイト数
+        int position = 0;
+        // 受信したコマンド(0は従来のプロトコル)
+        uint8_t command = 0;
+        uint8_t frame[DC_MOTOR_FRAME_BYTES] = {};
+        uint8_t ack = CubicFrame::NAK;
+        bool received_seq = false;
+        uint8_t last_seq = 0;
+        bool corrupt = false;
+        uint32_t _naks = 0;
+        uint32_t _dropped = 0;
+    };
+
+    /**
+     * @brief インクリメントエンコーダのRP2040のモデル
+     * @details 従来のプロトコルでは，1バイト受信するごとに累積値のバイト列を先頭から順に返し，
+     * INC_ENC_NUM*INC_ENC_BYTES*2バイトで一巡します。
+     * INC_ENC_RESETがLOWになると累積値と送信位置を0に戻します。
+     *
+     * CubicFrame::VERSION_BURST以上を指定すると，SSを下げた直後の1バイトがコマンドであれば
+     * バージョンの応答または一括読み出しフレームを返します。
+     * コマンドの受信中はまだ内容が分からないので，1バイト目には従来どおり累積値のバイトを出力します。
+     */
+    class Inc_enc_slave : public Spi_device
+    {
+    public:
+        static constexpr int CH_NUM = INC_ENC_NUM * 2;
+
+        /**
+         * @param version ファームウェアが対応するプロトコルバージョン
+         */
+        explicit Inc_enc_slave(uint8_t version = CubicFrame::VERSION_BURST);
+
+        void select(void) override;
+        uint8_t transfer(uint8_t mosi) override;
+        void pin_changed(int pin, bool level) override;
+
+        void set_count(int ch, int32_t count) { counts[ch] = count; }
+        void add_count(int ch, int32_t diff) { counts[ch] += diff; }
+        int32_t count(int ch) const { return counts[ch]; }
+
+        // 次の一括読み出しフレームのデータを1bit反転させる(通信エラーの再現用)
+        void corrupt_next_frame(void) { corrupt = true; }
+
+        // 送った一括読み出しフレームの数
+        uint32_t frames(void) const { return _frames; }
+
+    protected:
+        // 送信するバイト列の1バイトを取り出す
+        uint8_t count_byte(int i) const;
+
+        // 一括読み出しフレームを組み立てる
+        void build_frame(void);
+
+        const uint8_t version;
+        int32_t counts[CH_NUM] = {};
+        int index = 0;
+
+        // SSを下げてから受信したバイト数
+        int position = 0;
+        // 受信したコマンド(0は従来のプロトコル)
+        uint8_t command = 0;
+        uint8_t frame[INC_ENC_FRAME_BYTES] = {};
+        bool corrupt = false;
+        uint32_t _frames = 0;
+    };
+
+    /**
+     * @brief アブソリュートエンコーダ(AMT22)を読むRP2040のモデル
+     * @details 1バイト受信するごとにパリティ付きの値のバイト列を先頭から順に返します。
+     */
+    class Abs_enc_slave : public Spi_device
+    {
+    public:
+        Abs_enc_slave();
+
+        uint8_t transfer(uint8_t mosi) override;
+
+        // 値(0~ABS_ENC_MAX)を設定する
+        void set_value(int ch, uint16_t value);
+
+        // RP2040で読めなかった状態にする
+        void set_error(int ch);
+
+        // パリティビットを付加する
+        static uint16_t add_parity(uint16_t value);
+
+        // 送信するパリティ付きの値
+        uint16_t word(int ch) const { return words[ch]; }
+
+    private:
+        uint16_t words[ABS_ENC_NUM];
+        int index = 0;
+    };
+
+    /**
+     * @brief 電流センサを読むADC(MCP3208)のモデル
+     */
+    class Adc_slave : public Spi_device
+    {
+    public:
+        static constexpr int CH_NUM = 8;
+
+        Adc_slave();
+
+        void select(void) override;
+        uint8_t transfer(uint8_t mosi) override;
+
+        // 変換値(0~4095)を設定する
+        void set_raw(int ch, uint16_t raw);
+
+        // 電流値[A]から変換値を設定する
+        void set_current(int ch, float current);
+
+        // 変換した回数
+        uint32_t conversions(void) const { return _conversions; }
+
+        // SPIを介さずに1回変換する(直結モード用)
+        uint16_t convert(int ch)
+        {
+            _conversions++;
+            return raw[ch];
+        }
+
+    private:
+        uint16_t raw[CH_NUM];
+        int index = 0;
+        uint8_t command = 0;
+        uint32_t _conversions = 0;
+    };
+
+    /**
+     * @brief Cubicの全スレーブをまとめたモデル
+     * @details 構築時に各SSピンへ接続し，破棄時に取り外します。
+     * set_direct()で登録すると，Cubic::update()はSPIを介さずに各スレーブの値を直接やり取りします。
+     */
+    class Board_model : public Direct_link
+    {
+    public:
+        /**
+         * @param version RP2040のファームウェアが対応するプロトコルバージョン
+         */
+        explicit Board_model(uint8_t version = CubicFrame::VERSION_BURST);
+        ~Board_model();
+        Board_model(const Board_model &) = delete;
+        Board_model &operator=(const Board_model &) = delete;
+
+        Motor_driver_slave md_a;
+        Motor_driver_slave md_b;
+        Inc_enc_slave inc;
+        Abs_enc_slave abs;
+        Adc_slave adc;
+
+        // DC_motorが送信するDutyを各モータドライバに渡す(直結モード)
+        void send(void) override;
+
+        // 各スレーブの値をInc_enc，Abs_enc，Adcが受信したことにする(直結モード)
+        void receive(void) override;
+
+        // モータ番号(DC_motor::put()の番号)に対応するADCのチャンネルに電流値[A]を設定する
+        void set_motor_current(int motor, float current);
+    };
+}
@@ -0,0 +1,281 @@
+/**
+ * @file cubic_sweep.cpp
+ * @brief ホスト(Linux)ビルド用の，モータの物理モデル(cubic_plant.h)を使ったゲインの探索
+ */
+
+#include "cubic_sweep.h"
+#include "cubic_arduino.h"
+#include "Cubic.controller.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <math.h>
+
+using namespace Cubic_controller;
+
+namespace Cubic_host
+{
+    namespace
+    {
+        struct Worker_queue
+        {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        // 自分のキューの後ろから取る
+        bool pop(Worker_queue &queue, size_t &task)
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                return false;
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+
+        // 他のスレッドのキューの前から盗む
+        bool steal(Worker_queue &queue, size_t &task)
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                return false;
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
+        }
+
+        // 新しいボードとモータ0の物理モデルを作り，直結モードでCubicを始める
+        struct Bench
+        {
+            Board_model board;
+            Plant_model plant;
+            Motor_plant &motor;
+
+            explicit Bench(const Sweep_config &config)
+                : board(), plant(board), motor(plant.add_motor(0, config.params, 0, 0))
+            {
+                set_direct(&plant);
+                Cubic::begin(false, config.current_limit);
+                Cubic::update(config.period);
+            }
+
+            double value(const Sweep_mode mode) const { return mode == Sweep_mode::velocity ? motor.velocity() : motor.angle(); }
+        };
+
+        void reset_thread(void)
+        {
+            reset();
+            set_serial_sink(Serial_sink::discard);
+        }
+    }
+
+    Work_stealing_pool::Work_stealing_pool(const unsigned int threads)
+    {
+        _threads = threads > 0 ? threads : std::thread::hardware_concurrency();
+        if (_threads == 0)
+            _threads = 1;
+    }
+
+    void Work_stealing_pool::run(const size_t n, const std::function<void(size_t)> &task)
+    {
+        const unsigned int count = (unsigned int)std::min<size_t>(_threads, n > 0 ? n : 1);
+        std::vector<std::unique_ptr<Worker_queue>> queues;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            queues.emplace_back(new Worker_queue);
+            // 近い番号は似た候補なので，連続した塊で配る
+            for (size_t t = n * i / count; t < n * (i + 1) / count; t++)
+                queues[i]->tasks.push_back(t);
+        }
+
+        std::vector<size_t> steals(count, 0);
+        auto work = [&](const unsigned int id)
+        {
+            size_t t;
+            for (;;)
+            {
+                if (pop(*queues[id], t))
+                {
+                    task(t);
+                    continue;
+                }
+                // 仕事は後から増えないので，全てのキューが空なら終わり
+                bool stolen = false;
+                for (unsigned int k = 1; k < count && !stolen; k++)
+                    stolen = steal(*queues[(id + k) % count], t);
+                if (!stolen)
+                    return;
+                steals[id]++;
+                task(t);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < count; i++)
+            workers.emplace_back(work, i);
+        work(0);
+        for (std::thread &w : workers)
+            w.join();
+
+        _steals = 0;
+        for (const size_t s : steals)
+            _steals += s;
+    }
+
+    Sweep_score evaluate(const Sweep_config &config, const Sweep_gains &gains)
+    {
+        reset_thread();
+        Bench bench(config);
+
+        Controller_slot slot;
+        double initial, target;
+        if (config.mode == Sweep_mode::velocity)
+        {
+            slot.emplace<Velocity_PID>(0, 0, encoderType::inc, (uint16_t)config.params.inc_cpr, gains.Kp, gains.Ki, gains.Kd, config.step, !config.params.reversed, gains.capableDutyCycle, gains.p);
+            initial = bench.motor.velocity();
+            target = config.step;
+        }
+        else
+        {
+            Position_PID &pid = slot.emplace<Position_PID>(0, 0, encoderType::abs, (uint16_t)config.params.abs_cpr, gains.Kp, gains.Ki, gains.Kd, 0.0, !config.params.reversed, gains.capableDutyCycle);
+            pid.setTarget(pid.getCurrent() + config.step);
+            initial = bench.motor.angle();
+            target = initial + config.step;
+        }
+
+        std::vector<double> time, value;
+        time.reserve(config.ticks);
+        value.reserve(config.ticks);
+        Sweep_score score = {0.0, 0.0, INFINITY, false};
+        const uint32_t start = micros();
+        uint32_t previous = start;
+        for (int i = 0; i < config.ticks; i++)
+        {
+            Cubic::update(config.period);
+            slot->compute();
+            const uint32_t now = micros();
+            const double v = bench.value(config.mode);
+            if (!isfinite(v))
+            {
+                score.ise = INFINITY;
+                return score;
+            }
+            score.ise += (target - v) * (target - v) * (now - previous) * 1e-6;
+            previous = now;
+            time.push_back((now - start) * 1e-6);
+            value.push_back(v);
+        }
+
+        const Step_metrics m = step_metrics(time, value, initial, target);
+        score.overshoot = m.overshoot;
+        score.valid = m.settling_time >= 0.0;
+        if (score.valid)
+            score.settling_time = m.settling_time;
+        return score;
+    }
+
+    std::vector<Sweep_result> sweep(const Sweep_config &config, const std::vector<Sweep_gains> &candidates, Work_stealing_pool &pool)
+    {
+        std::vector<Sweep_result> results(candidates.size());
+        // 結果は番号の位置に書くだけなので，ロックはいらない
+        pool.run(candidates.size(), [&](const size_t i)
+                 { results[i] = {candidates[i], evaluate(config, candidates[i])}; });
+        return results;
+    }
+
+    std::vector<Sweep_result> pareto_front(const std::vector<Sweep_result> &results)
+    {
+        auto dominates = [](const Sweep_score &a, const Sweep_score &b)
+        {
+            return a.ise <= b.ise && a.overshoot <= b.overshoot && a.settling_time <= b.settling_time &&
+                   (a.ise < b.ise || a.overshoot < b.overshoot || a.settling_time < b.settling_time);
+        };
+
+        std::vector<Sweep_result> front;
+        for (const Sweep_result &r : results)
+        {
+            if (!r.score.valid)
+                continue;
+            bool dominated = false;
+            for (const Sweep_result &other : results)
+            {
+                if (other.score.valid && dominates(other.score, r.score))
+                {
+                    dominated = true;
+                    break;
+                }
+            }
+            if (!dominated)
+                front.push_back(r);
+        }
+        std::stable_sort(front.begin(), front.end(), [](const Sweep_result &a, const Sweep_result &b)
+                         { return a.score.ise < b.score.ise; });
+        return front;
+    }
+
+    Relay_result relay_feedback(const Sweep_config &config, const double relay_duty, const double setpoint, const double hysteresis, const int max_ticks)
+    {
+        reset_thread();
+        Bench bench(config);
+
+        const bool velocity = config.mode == Sweep_mode::velocity;
+        const enum encoderType type = velocity ? encoderType::inc : encoderType::abs;
+        const uint16_t cpr = (uint16_t)(velocity ? config.params.inc_cpr : config.params.abs_cpr);
+        // 位置は制御器と同じ角度(アブソリュートエンコーダの値から-PIずらしたもの)で与える
+        const double center = velocity ? setpoint : bench.motor.angle() - PI + setpoint;
+        Relay_autotune autotune(0, 0, type, cpr, !config.params.reversed, relay_duty, center, hysteresis);
+
+        Relay_result result = {0.0, 0.0, 0.0, false};
+        for (int i = 0; i < max_ticks && !result.finished; i++)
+        {
+            Cubic::update(config.period);
+            result.finished = autotune.compute();
+        }
+        result.ultimate_gain = autotune.getUltimateGain();
+        result.ultimate_period = autotune.getUltimatePeriod();
+        result.amplitude = autotune.getAmplitude();
+        return result;
+    }
+
+    std::vector<Sweep_gains> gain_grid(const Sweep_mode mode, const double ultimate_gain, const double ultimate_period, const int levels, const std::vector<double> &duties)
+    {
+        const int n = levels > 1 ? levels : 2;
+        // ジーグラ・ニコルスの限界感度法
+        const double Kp = 0.6 * ultimate_gain;
+        const double Ki = ultimate_period > 0.0 ? 1.2 * ultimate_gain / ultimate_period : 0.0;
+        const double Kd = 0.075 * ultimate_gain * ultimate_period;
+
+        // 中心の1/4~4倍を対数で等分する
+        auto around = [](const double center, const int count, const bool zero)
+        {
+            std::vector<double> v;
+            if (zero)
+                v.push_back(0.0);
+            for (int i = 0; i < count; i++)
+                v.push_back(center * pow(4.0, count > 1 ? 2.0 * i / (count - 1) - 1.0 : 0.0));
+            return v;
+        };
+        const std::vector<double> kp = around(Kp, n, false);
+        const std::vector<double> ki = around(Ki, n - 1, true);
+        const std::vector<double> kd = around(Kd, n - 1, true);
+        std::vector<double> p = {1.0};
+        if (mode == Sweep_mode::velocity)
+        {
+            for (int i = 1; i < std::min(n, 3); i++)
+                p.push_back(p.back() / 2.0);
+        }
+
+        std::vector<Sweep_gains> grid;
+        for (const double d : duties)
+            for (const double pp : p)
+                for (const double kdv : kd)
+                    for (const double kiv : ki)
+                        for (const double kpv : kp)
+                            grid.push_back({kpv, kiv, kdv, pp, d});
+        return grid;
+    }
+}
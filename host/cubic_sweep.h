@@ -0,0 +1,153 @@
+/**
+ * @file cubic_sweep.h
+ * @brief ホスト(Linux)ビルド用の，モータの物理モデル(cubic_plant.h)を使ったゲインの探索
+ * @details 候補のゲインごとにVelocity_PIDかPosition_PIDのステップ応答を閉ループで動かし，ISE，行き過ぎ量，整定時間で評価します。
+ * 候補はワークスティーリングのスレッドプールで全コアに分けます。Cubicとホストの状態はスレッドごとに持つ(CUBIC_TLS)ので，
+ * 各スレッドが独立したボードを模擬でき，結果はスレッド数によらず同じになります。
+ * 探索の出発点は，同じ物理モデルでRelay_autotuneを動かして測った限界ゲインと限界周期から決められます。
+ */
+
+#pragma once
+#include "cubic_plant.h"
+
+#include <functional>
+#include <vector>
+
+namespace Cubic_host
+{
+    /**
+     * @brief 探索する制御器
+     * @details velocity: インクリメンタルエンコーダでVelocity_PID，position: アブソリュートエンコーダでPosition_PID
+     */
+    enum class Sweep_mode
+    {
+        velocity,
+        position
+    };
+
+    /**
+     * @brief 1回の評価の条件
+     */
+    struct Sweep_config
+    {
+        Sweep_mode mode = Sweep_mode::velocity;
+        /// @brief モータ0のパラメータ
+        Motor_params params;
+        /// @brief ステップの大きさ[rad/s]または[rad]。速度は0から，位置は今の角度から
+        double step = 20.0;
+        /// @brief ループ回数
+        int ticks = 1000;
+        /// @brief ループの周期[us]
+        unsigned int period = 1000;
+        /// @brief Cubic::begin()に与える電流の上限[A]
+        float current_limit = 10.0;
+    };
+
+    /**
+     * @brief 候補のゲイン
+     * @details pはVelocity_PIDのローパスフィルタの係数で，Position_PIDでは使いません。
+     */
+    struct Sweep_gains
+    {
+        double Kp;
+        double Ki;
+        double Kd;
+        double p;
+        double capableDutyCycle;
+    };
+
+    /**
+     * @brief ステップ応答の評価値(どれも小さいほど良い)
+     */
+    struct Sweep_score
+    {
+        /// @brief 誤差の2乗の積分[単位^2 s]
+        double ise;
+        /// @brief 行き過ぎ量[%]
+        double overshoot;
+        /// @brief 整定時間[s]
+        double settling_time;
+        /// @brief 発散せず，最後まで±2%に収まったかどうか。falseならパレート集合に入れない
+        bool valid;
+    };
+
+    struct Sweep_result
+    {
+        Sweep_gains gains;
+        Sweep_score score;
+    };
+
+    /**
+     * @brief リレーフィードバックで測った結果
+     */
+    struct Relay_result
+    {
+        double ultimate_gain;
+        double ultimate_period;
+        double amplitude;
+        /// @brief max_ticksのうちに測り終わったかどうか
+        bool finished;
+    };
+
+    /**
+     * @brief ワークスティーリングのスレッドプール
+     * @details 仕事の番号を各スレッドの両端キューに連続した塊で配り，各スレッドは自分のキューの後ろから取り，
+     * 空になったら他のスレッドのキューの前から盗みます。評価にかかる時間が候補ごとに違っても，最後まで全スレッドが働きます。
+     */
+    class Work_stealing_pool
+    {
+    public:
+        // 0ならstd::thread::hardware_concurrency()
+        explicit Work_stealing_pool(unsigned int threads = 0);
+
+        /**
+         * @brief task(0)~task(n-1)を全スレッドで実行し，全て終わるまで待つ
+         * @details taskは複数のスレッドから同時に呼ばれます。
+         */
+        void run(size_t n, const std::function<void(size_t)> &task);
+
+        unsigned int threads(void) const { return _threads; }
+
+        // 直前のrun()で他のスレッドから盗んだ仕事の数
+        size_t steals(void) const { return _steals; }
+
+    private:
+        unsigned int _threads;
+        size_t _steals = 0;
+    };
+
+    /**
+     * @brief 呼び出したスレッドで新しいボードと物理モデルを作り，1つの候補を評価する
+     * @details Cubic_host::reset()とCubic::begin()を呼ぶので，そのスレッドの状態は初期化されます。
+     */
+    Sweep_score evaluate(const Sweep_config &config, const Sweep_gains &gains);
+
+    /**
+     * @brief 全ての候補をスレッドプールで評価する
+     *
+     * @return std::vector<Sweep_result> candidatesと同じ順の結果
+     */
+    std::vector<Sweep_result> sweep(const Sweep_config &config, const std::vector<Sweep_gains> &candidates, Work_stealing_pool &pool);
+
+    /**
+     * @brief 評価値のどれでも他の候補に負けない(パレート最適な)候補を，ISEの小さい順に返す
+     */
+    std::vector<Sweep_result> pareto_front(const std::vector<Sweep_result> &results);
+
+    /**
+     * @brief 呼び出したスレッドで新しいボードと物理モデルを作り，Relay_autotuneで限界ゲインと限界周期を測る
+     *
+     * @param relay_duty リレーの出力の大きさ
+     * @param setpoint 発振させる中心の値。位置では今の角度からの変位
+     * @param hysteresis ヒステリシスの幅
+     * @param max_ticks ループ回数の上限
+     */
+    Relay_result relay_feedback(const Sweep_config &config, double relay_duty, double setpoint, double hysteresis, int max_ticks = 5000);
+
+    /**
+     * @brief 限界ゲインと限界周期から，ジーグラ・ニコルスのゲインを中心に対数で並べた候補を作る
+     * @details Kpは中心の1/4~4倍をlevels個，Ki，Kdは0とその範囲のlevels-1個，pはvelocityのときだけ1, 1/2, 1/4(levelsが3未満ならその個数)，
+     * capableDutyCycleはdutiesの全てを組み合わせます。
+     */
+    std::vector<Sweep_gains> gain_grid(Sweep_mode mode, double ultimate_gain, double ultimate_period, int levels, const std::vector<double> &duties);
+}
@@ -0,0 +1,266 @@
+/**
+ * @file loop_bench.cpp
+ * @brief ホスト上でCubic::update()とVelocity_PID::compute()を回し，1ループあたりの実行時間を測ります。
+ * @details 時刻は仮想時刻なので，周期待ちやSPI転送の待ち時間はホストの実行時間には含まれません。
+ *
+ * 使い方: cubic_loop_bench [ループ数] [オプション]
+ *   ループ数は正の整数(既定は1000000)。不明なオプションやループ数では使い方を表示して終了コード1を返す
+ *   --legacy        RP2040を従来のプロトコルのファームウェアとして模擬する
+ *   --pipeline      Cubic::update_begin()/update_end()でSPI転送とcompute()を重ねる
+ *   --period=us     ループの周期[us](0で周期を待たない。既定は4000)
+ *   --compute=us    compute()1回にかかる時間として仮想時刻を進める量[us](既定は0)
+ *   --axes=n        制御する軸数(既定は1)
+ *   --group         各軸のVelocity_PIDの代わりにControllerGroupでまとめて計算する
+ *   --profile       Profilerで各処理のホストでの実行時間を測って表示する
+ *   --corrupt       ループの後に壊れたフレームを受信させ，エラーとして扱われ，続けば従来のプロトコルに戻ることを確かめる(失敗すれば終了コード1)
+ *   --wrap          ループの中ほどでmicros()が桁あふれするように時刻を始め，周期と制御器のdtが乱れないことを確かめる(失敗すれば終了コード1)
+ */
+
+#include "cubic_arduino.h"
+#include "Cubic.controller.h"
+#include "cubic_profiler.h"
+#include "cubic_host.h"
+#include "cubic_slave.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+namespace
+{
+    // 壊れた一括読み出しフレームを1回受信させ，エラーが1回数えられ，その周期の差分値が0になることを確かめる
+    bool check_inc_corruption(Cubic_host::Board_model &board, const unsigned int period)
+    {
+        const uint32_t errors = Inc_enc::frame_errors();
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            board.inc.add_count(j, 100 + j);
+        board.inc.corrupt_next_frame();
+        Cubic::update(period);
+        bool ok = Inc_enc::frame_errors() == errors + 1 && !Inc_enc::snapshot().valid;
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            ok &= Inc_enc::get_diff(j) == 0;
+
+        // 次の受信で，壊れていた周期の分も含めて追いつく
+        Cubic::update(period);
+        ok &= Inc_enc::frame_errors() == errors + 1 && Inc_enc::snapshot().valid;
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            ok &= Inc_enc::get_diff(j) == 100 + j;
+        return ok;
+    }
+
+    // 一括読み出しをINC_ENC_BURST_FAIL_MAX回続けて失敗させ，従来のプロトコルに戻っても累積値が続くことを確かめる
+    bool check_inc_fallback(Cubic_host::Board_model &board, const unsigned int period)
+    {
+        int32_t before[INC_ENC_NUM];
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            before[j] = Inc_enc::get(j);
+        for (int i = 0; i < INC_ENC_BURST_FAIL_MAX; i++)
+        {
+            board.inc.corrupt_next_frame();
+            Cubic::update(period);
+        }
+        bool ok = Inc_enc::version() == CubicFrame::VERSION_BURST;
+
+        // 戻した直後の受信はRP2040の累積値が0に戻っているが，get()は前回の値から続く
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            board.inc.add_count(j, 7);
+        Cubic::update(period);
+        ok &= Inc_enc::version() == CubicFrame::VERSION_LEGACY && Inc_enc::snapshot().valid;
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            ok &= Inc_enc::get(j) == before[j] && Inc_enc::get_diff(j) == 0;
+
+        // 以降は従来のプロトコルで差分値が届く
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            board.inc.add_count(j, 100 + j);
+        Cubic::update(period);
+        for (int j = 0; j < INC_ENC_NUM; j++)
+            ok &= Inc_enc::get(j) == before[j] + 100 + j && Inc_enc::get_diff(j) == 100 + j;
+        return ok;
+    }
+
+    // 壊れたDutyフレームを1回送らせ，エラーが1回数えられ，モータドライバが前回のDutyを保つことを確かめる
+    bool check_duty_corruption(Cubic_host::Board_model &board, const unsigned int period)
+    {
+        constexpr int slots = Cubic_host::Motor_driver_slave::SLOT_NUM;
+        const uint32_t errors = DC_motor::frame_errors();
+        const uint32_t naks = board.md_a.naks();
+        uint8_t num[slots];
+        int16_t kept[slots], duty[slots];
+        for (int j = 0; j < slots; j++)
+        {
+            num[j] = j;
+            kept[j] = board.md_a.duty(j);
+            duty[j] = kept[j] > 0 ? -100 - j : 100 + j;
+        }
+        DC_motor::put(num, duty, slots);
+        board.md_a.corrupt_next_frame();
+        Cubic::update(period);
+        bool ok = DC_motor::frame_errors() == errors + 1 && !DC_motor::acked() && board.md_a.naks() == naks + 1;
+        for (int j = 0; j < slots; j++)
+            ok &= board.md_a.duty(j) == kept[j];
+
+        // 次の送信で新しいDutyが届く
+        Cubic::update(period);
+        ok &= DC_motor::frame_errors() == errors + 1 && DC_motor::acked();
+        for (int j = 0; j < slots; j++)
+            ok &= board.md_a.duty(j) == duty[j];
+        return ok;
+    }
+
+    // 使い方を表示して，終了コード1を返す
+    int usage(const char *name)
+    {
+        fprintf(stderr, "usage: %s [loops] [--legacy] [--pipeline] [--period=us] [--compute=us] [--axes=n] [--group] [--profile] [--corrupt] [--wrap]\n", name);
+        return 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long loops = 1000000;
+    uint8_t version = CubicFrame::VERSION_BURST;
+    bool pipeline = false;
+    unsigned int period = 4000;
+    unsigned int compute_us = 0;
+    int axes = 1;
+    bool profile = false;
+    bool use_group = false;
+    bool corrupt = false;
+    bool wrap = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--legacy") == 0)
+            version = CubicFrame::VERSION_LEGACY;
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            pipeline = true;
+        else if (strncmp(argv[i], "--period=", 9) == 0)
+            period = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--compute=", 10) == 0)
+            compute_us = atoi(argv[i] + 10);
+        else if (strcmp(argv[i], "--group") == 0)
+            use_group = true;
+        else if (strcmp(argv[i], "--profile") == 0)
+            profile = true;
+        else if (strcmp(argv[i], "--corrupt") == 0)
+            corrupt = true;
+        else if (strcmp(argv[i], "--wrap") == 0)
+            wrap = true;
+        else if (strncmp(argv[i], "--axes=", 7) == 0)
+            axes = constrain(atoi(argv[i] + 7), 1, DC_MOTOR_NUM);
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return usage(argv[0]);
+        }
+        else
+        {
+            // ループ数は正の整数だけを受け付ける
+            char *end;
+            loops = strtol(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0' || loops <= 0)
+            {
+                fprintf(stderr, "invalid loop count: %s\n", argv[i]);
+                return usage(argv[0]);
+            }
+        }
+    }
+
+    Cubic_host::set_serial_sink(Cubic_host::Serial_sink::discard);
+    // 周期0では1ループを500usとみなして，ループの中ほどで0xFFFFFFFFを越えるようにする
+    const uint64_t wrap_span = (uint64_t)(period ? period : 500) * loops / 2;
+    const uint64_t wrap_start = wrap_span < 0x100000000ULL ? 0x100000000ULL - wrap_span : 0;
+    if (wrap)
+        Cubic_host::set_micros(wrap_start);
+    Cubic_host::Board_model board(version);
+    Cubic::begin(true);
+
+    std::vector<std::unique_ptr<Cubic_controller::Velocity_PID>> controllers;
+    Cubic_controller::ControllerGroup group;
+    for (int i = 0; i < axes; i++)
+    {
+        if (use_group)
+            group.addVelocity(i, i, 2048 * 4, 0.5, 0.1, 0.0, 4.0, true, 0.5);
+        else
+            controllers.emplace_back(new Cubic_controller::Velocity_PID(i, i, Cubic_controller::encoderType::inc, 2048 * 4, 0.5, 0.1, 0.0, 4.0, true, 0.5));
+    }
+
+    Profiler::enable(profile);
+
+    const uint32_t sim_start = micros();
+    const uint64_t bus_start = Cubic_host::bus_ns();
+    const uint64_t bytes_start = Cubic_host::spi_bytes();
+    const auto start = std::chrono::steady_clock::now();
+    double max_dt = 0.0;
+    for (long i = 0; i < loops; i++)
+    {
+        for (int j = 0; j < axes; j++)
+            board.inc.add_count(j, board.md_a.duty(j) / 1024);
+
+        if (pipeline)
+            Cubic::update_begin(period);
+        for (auto &c : controllers)
+        {
+            c->compute();
+            Cubic_host::advance_ns((uint64_t)compute_us * 1000);
+            // 最初の2回は，制御器を作ってからの時間と周期を変えたときの数え直しを含むので除く
+            if (wrap && i > 1)
+                max_dt = fmax(max_dt, c->getDt());
+        }
+        if (use_group)
+        {
+            group.compute();
+            Cubic_host::advance_ns((uint64_t)compute_us * 1000 * axes);
+        }
+        if (pipeline)
+            Cubic::update_end();
+        else
+            Cubic::update(period);
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double sim_sec = (micros() - sim_start) * 1e-6;
+
+    printf("loops: %ld, axes: %d, inc_enc protocol: %d, dc_motor protocol: %d, %s, %s\n", loops, axes, Inc_enc::version(), DC_motor::version(), pipeline ? "pipelined" : "blocking", use_group ? "ControllerGroup" : "Velocity_PID");
+    printf("host: %.3f s (%.0f loops/s, %.1f ns/loop)\n", sec, loops / sec, sec * 1e9 / loops);
+    printf("simulated: %.3f s (%.1f us/loop)\n", sim_sec, sim_sec * 1e6 / loops);
+    printf("spi bytes/loop: %.1f, bus time/loop: %.1f us\n", (double)(Cubic_host::spi_bytes() - bytes_start) / loops, (Cubic_host::bus_ns() - bus_start) * 1e-3 / loops);
+    printf("loop: cycles %u, overruns %u, late max %u us, jitter %d/%.1f/%d us\n", (unsigned)Cubic::loop_stats().cycles, (unsigned)Cubic::loop_stats().overruns, (unsigned)Cubic::loop_stats().late_max, (int)Cubic::loop_stats().jitter_min, Cubic::loop_stats().jitter_mean(), (int)Cubic::loop_stats().jitter_max);
+    printf("frame errors: inc_enc %u, dc_motor %u\n", (unsigned)Inc_enc::frame_errors(), (unsigned)DC_motor::frame_errors());
+    if (profile)
+    {
+        Cubic_host::set_serial_sink(Cubic_host::Serial_sink::console);
+        Profiler::print();
+    }
+
+    if (wrap)
+    {
+        // 周期を待っていれば締め切りを外さず，dtは周期と制御器の計算時間を越えない
+        const Loop_stats &stats = Cubic::loop_stats();
+        const double dt_limit = ((period ? period : 500) + compute_us * axes) * 1e-6 * 1.5;
+        const bool periodic = period == 0 || (stats.cycles == (uint32_t)loops && stats.overruns == 0 && stats.late_max == 0);
+        const bool wrap_ok = wrap_start > 0 && periodic && max_dt < dt_limit;
+        printf("micros wrap: start %llu us, max dt %.6f s, %s\n", (unsigned long long)wrap_start, max_dt, wrap_ok ? "ok" : "FAILED");
+        if (!wrap_ok)
+            return 1;
+    }
+
+    if (corrupt)
+    {
+        // 従来のプロトコルにはCRCが無いので確かめられない
+        if (Inc_enc::version() < CubicFrame::VERSION_BURST || DC_motor::version() < CubicFrame::VERSION_BURST)
+        {
+            printf("corrupt frame: skipped (legacy protocol)\n");
+            return 0;
+        }
+        const bool inc_ok = check_inc_corruption(board, period);
+        const bool duty_ok = check_duty_corruption(board, period);
+        // 従来のプロトコルに戻すので最後に確かめる
+        const bool fallback_ok = check_inc_fallback(board, period);
+        printf("corrupt frame: inc_enc %s, dc_motor %s, inc_enc fallback %s\n", inc_ok ? "ok" : "FAILED", duty_ok ? "ok" : "FAILED", fallback_ok ? "ok" : "FAILED");
+        return inc_ok && duty_ok && fallback_ok ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file gain_sweep.cpp
+ * @brief モータの物理モデル(cubic_plant.h)でVelocity_PIDかPosition_PIDのゲインを総当たりで評価し，パレート集合を表示します。
+ * @details まず同じ物理モデルでRelay_autotuneを動かして限界ゲインと限界周期を測り，ジーグラ・ニコルスのゲインを中心に候補を並べます。
+ * 候補はワークスティーリングのスレッドプールで全コアに分けて評価します。
+ *
+ * 使い方: cubic_gain_sweep [オプション]
+ *   --mode=velocity|position  探索する制御器(既定はvelocity)
+ *   --threads=n     スレッド数(既定はコア数)
+ *   --levels=n      各ゲインの段数(既定は7)
+ *   --duties=a,b    capableDutyCycleの候補(既定は0.6,0.9)
+ *   --ticks=n       1回の評価のループ回数(既定は1000)
+ *   --period=us     ループの周期[us](既定は1000)
+ *   --ku=x --tu=s   リレーフィードバックを行わず，この限界ゲインと限界周期[s]を使う
+ *   --csv           全ての候補の評価値をCSVで出力する
+ * パレート集合が空なら終了コード1を返します。
+ */
+
+#include "cubic_arduino.h"
+#include "cubic_host.h"
+#include "cubic_plant.h"
+#include "cubic_sweep.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+    // リレーの出力と中心。速度は0rad/sのまわりで正転と逆転を繰り返し，位置は今の角度のまわりで振る
+    constexpr double RELAY_DUTY = 0.3;
+    constexpr double RELAY_HYSTERESIS_VELOCITY = 1.0;
+    constexpr double RELAY_HYSTERESIS_POSITION = 0.01;
+
+    std::vector<double> parse_list(const char *s)
+    {
+        std::vector<double> v;
+        while (*s)
+        {
+            char *end;
+            v.push_back(strtod(s, &end));
+            if (end == s)
+                break;
+            s = *end == ',' ? end + 1 : end;
+        }
+        return v;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Cubic_host::Sweep_config config;
+    unsigned int threads = 0;
+    int levels = 7;
+    std::vector<double> duties = {0.6, 0.9};
+    double ku = 0.0, tu = 0.0;
+    bool csv = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mode=position") == 0)
+            config.mode = Cubic_host::Sweep_mode::position;
+        else if (strcmp(argv[i], "--mode=velocity") == 0)
+            config.mode = Cubic_host::Sweep_mode::velocity;
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--levels=", 9) == 0)
+            levels = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--duties=", 9) == 0)
+            duties = parse_list(argv[i] + 9);
+        else if (strncmp(argv[i], "--ticks=", 8) == 0)
+            config.ticks = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--period=", 9) == 0)
+            config.period = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--ku=", 5) == 0)
+            ku = atof(argv[i] + 5);
+        else if (strncmp(argv[i], "--tu=", 5) == 0)
+            tu = atof(argv[i] + 5);
+        else if (strcmp(argv[i], "--csv") == 0)
+            csv = true;
+    }
+    const bool velocity = config.mode == Cubic_host::Sweep_mode::velocity;
+    config.step = velocity ? 20.0 : 2.0;
+    if (config.ticks <= 0)
+        config.ticks = 1;
+    if (duties.empty())
+        duties.push_back(1.0);
+
+    if (ku <= 0.0 || tu <= 0.0)
+    {
+        const Cubic_host::Relay_result relay = Cubic_host::relay_feedback(config, RELAY_DUTY, 0.0, velocity ? RELAY_HYSTERESIS_VELOCITY : RELAY_HYSTERESIS_POSITION);
+        printf("relay     Ku %.4g  Tu %.4g s  amplitude %.4g  %s\n", relay.ultimate_gain, relay.ultimate_period, relay.amplitude,
+               relay.finished ? "finished" : "NOT FINISHED");
+        if (!relay.finished)
+            return 1;
+        ku = relay.ultimate_gain;
+        tu = relay.ultimate_period;
+    }
+
+    const std::vector<Cubic_host::Sweep_gains> candidates = Cubic_host::gain_grid(config.mode, ku, tu, levels, duties);
+    Cubic_host::Work_stealing_pool pool(threads);
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<Cubic_host::Sweep_result> results = Cubic_host::sweep(config, candidates, pool);
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const std::vector<Cubic_host::Sweep_result> front = Cubic_host::pareto_front(results);
+
+    size_t valid = 0;
+    for (const Cubic_host::Sweep_result &r : results)
+        valid += r.score.valid;
+    printf("sweep     %zu candidates (%zu settled) on %u threads in %.2f s, %zu steals\n", results.size(), valid, pool.threads(), wall, pool.steals());
+    printf("pareto    %zu\n", front.size());
+    printf("%10s %10s %10s %5s %5s | %10s %9s %9s\n", "Kp", "Ki", "Kd", "p", "duty", "ISE", "overshoot", "settling");
+    for (const Cubic_host::Sweep_result &r : front)
+    {
+        printf("%10.4g %10.4g %10.4g %5.3g %5.3g | %10.4g %8.2f%% %8.4fs\n", r.gains.Kp, r.gains.Ki, r.gains.Kd, r.gains.p, r.gains.capableDutyCycle,
+               r.score.ise, r.score.overshoot, r.score.settling_time);
+    }
+    if (csv)
+    {
+        printf("Kp,Ki,Kd,p,duty,ise,overshoot,settling,valid\n");
+        for (const Cubic_host::Sweep_result &r : results)
+        {
+            printf("%g,%g,%g,%g,%g,%g,%g,%g,%d\n", r.gains.Kp, r.gains.Ki, r.gains.Kd, r.gains.p, r.gains.capableDutyCycle,
+                   r.score.ise, r.score.overshoot, r.score.settling_time, r.score.valid ? 1 : 0);
+        }
+    }
+    return front.empty() ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file plant_metrics.cpp
+ * @brief モータの物理モデル(cubic_plant.h)でVelocity_PIDとPosition_PIDのステップ応答を閉ループで動かし，評価値を表示します。
+ * @details 時刻は仮想時刻で，既定では直結モード(Cubic_host::set_direct())でSPIのバイト列を模擬しないので，実時間より数千倍速く回ります。
+ * 各制御器を2回ずつ動かし，応答が一致する(決定的である)ことも確かめます。
+ *
+ * 使い方: cubic_plant_metrics [オプション]
+ *   --ticks=n       ループ回数(既定は2000)
+ *   --period=us     ループの周期[us](既定は1000)
+ *   --spi           直結モードにせず，SPIのバイト列とバスの所要時間も模擬する
+ *   --csv           各ループの時刻，目標値，応答をCSVで出力する
+ * 一致しない応答があれば終了コード1を返します。
+ */
+
+#include "cubic_arduino.h"
+#include "Cubic.controller.h"
+#include "cubic_host.h"
+#include "cubic_slave.h"
+#include "cubic_plant.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Cubic_controller;
+
+namespace
+{
+    constexpr uint16_t INC_CPR = 2048 * 4;
+    constexpr float CURRENT_LIMIT = 10.0;
+
+    struct Run
+    {
+        std::vector<double> time;
+        std::vector<double> value;
+        double initial;
+        double target;
+        double cpu_ns_per_tick;
+        double speedup;
+    };
+
+    enum class Mode
+    {
+        velocity,
+        position
+    };
+
+    // 1回分の閉ループ。Cubicと仮想時刻は毎回初期化する
+    // velocity: 0から20rad/sへのステップ，position: 今の角度から2radのステップ
+    Run run(const Mode mode, const int ticks, const unsigned int period, const bool spi)
+    {
+        Cubic_host::reset();
+        Cubic_host::set_serial_sink(Cubic_host::Serial_sink::discard);
+        Cubic_host::Board_model board;
+        Cubic_host::Plant_model plant(board);
+        Cubic_host::Motor_plant &motor = plant.add_motor(0, Cubic_host::Motor_params(), 0, 0);
+        if (!spi)
+            Cubic_host::set_direct(&plant);
+        Cubic::begin(false, CURRENT_LIMIT);
+        Cubic::update(period);
+
+        Run r;
+        Controller_slot slot;
+        if (mode == Mode::velocity)
+        {
+            Velocity_PID &pid = slot.emplace<Velocity_PID>(0, 0, encoderType::inc, INC_CPR, 0.03, 0.4, 0.0, 20.0, true, 0.9);
+            pid.setVelocityEstimator(velocityEstimator::pll, 100.0);
+            r.initial = motor.velocity();
+            r.target = 20.0;
+        }
+        else
+        {
+            Position_PID &pid = slot.emplace<Position_PID>(0, 0, encoderType::abs, AMT22_CPR, 1.0, 0.5, 0.02, 0.0, true, 0.9);
+            pid.setTarget(pid.getCurrent() + 2.0);
+            r.initial = motor.angle();
+            r.target = motor.angle() + 2.0;
+        }
+
+        const uint32_t sim_start = micros();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ticks; i++)
+        {
+            Cubic::update(period);
+            slot->compute();
+            r.value.push_back(mode == Mode::velocity ? motor.velocity() : motor.angle());
+            r.time.push_back((micros() - sim_start) * 1e-6);
+        }
+        const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        r.cpu_ns_per_tick = wall * 1e9 / ticks;
+        r.speedup = r.time.back() / wall;
+        return r;
+    }
+
+    bool report(const char *name, const Run &a, const Run &b, const bool csv)
+    {
+        const Cubic_host::Step_metrics m = Cubic_host::step_metrics(a.time, a.value, a.initial, a.target);
+        const bool same = a.value == b.value;
+        printf("%-9s rise %.4f s  overshoot %.2f %%  settling %.4f s  steady-state error %.3e  cpu %.0f ns/tick  x%.0f real time  %s\n",
+               name, m.rise_time, m.overshoot, m.settling_time, m.steady_state_error, a.cpu_ns_per_tick, a.speedup,
+               same ? "deterministic" : "NOT DETERMINISTIC");
+        if (csv)
+        {
+            for (size_t i = 0; i < a.value.size(); i++)
+                printf("%s,%.6f,%.6f,%.6f\n", name, a.time[i], a.target, a.value[i]);
+        }
+        return same;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int ticks = 2000;
+    unsigned int period = 1000;
+    bool spi = false;
+    bool csv = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--ticks=", 8) == 0)
+            ticks = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--period=", 9) == 0)
+            period = atoi(argv[i] + 9);
+        else if (strcmp(argv[i], "--spi") == 0)
+            spi = true;
+        else if (strcmp(argv[i], "--csv") == 0)
+            csv = true;
+    }
+    if (ticks <= 0)
+        ticks = 1;
+
+    bool ok = true;
+    ok &= report("velocity", run(Mode::velocity, ticks, period, spi), run(Mode::velocity, ticks, period, spi), csv);
+    ok &= report("position", run(Mode::position, ticks, period, spi), run(Mode::position, ticks, period, spi), csv);
+    return ok ? 0 : 1;
+}
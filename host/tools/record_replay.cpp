@@ -0,0 +1,223 @@
+/**
+ * @file record_replay.cpp
+ * @brief 記録(cubic_record.h)を作り，同じ制御器のコードに流し直して，出力が記録と1ビットまで一致するかを確かめます。
+ * @details setup()とloop()はスケッチの代わりで，速度制御(モータ0)と位置制御(モータ1)の目標値を途中で切り替えます。
+ * 記録はモータの物理モデル(cubic_plant.h)で動かして作るか，ボードで記録したファイルを与えます。
+ * ボードの記録を流し直すときは，setup()とloop()をボードのスケッチと同じにしてください。
+ *
+ * 使い方: cubic_record_replay [オプション] [記録ファイル]
+ *   --record=file   物理モデルで動かして記録をfileに書き出す
+ *   --ticks=n       --recordのループ回数(既定は3000)
+ *   --kp-scale=x    流し直すときにKpをx倍する(制御器を変えたときに，どの周期から出力が変わるかを見る)
+ * 物理モデルで記録するときは，ボードでcompute()に掛かる時間の代わりに，各compute()の前に仮想時刻を周期ごとに違う時間だけ進めます。
+ * 流し直すときは進めないので，制御器が記録した時刻(Recorder::now())を使えていなければ一致しません。
+ * 記録ファイルを省略すると，物理モデルで記録してから2回流し直し，2回とも記録と一致すること(ビット単位で再現できること)を確かめます。
+ * 記録と一致しない周期があれば終了コード1を返します。
+ */
+
+#include "cubic_arduino.h"
+#include "Cubic.controller.h"
+#include "cubic_host.h"
+#include "cubic_slave.h"
+#include "cubic_plant.h"
+#include "cubic_record.h"
+#include "cubic_replay.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Cubic_controller;
+
+namespace
+{
+    constexpr uint16_t INC_CPR = 2048 * 4;
+    constexpr unsigned int PERIOD = 1000;
+    constexpr float CURRENT_LIMIT = 10.0;
+
+    // スケッチの代わり
+    struct Sketch
+    {
+        Controller_slot velocity;
+        Controller_slot position;
+        double home = 0.0;
+        int tick = 0;
+        // compute()の前に仮想時刻を進めるかどうか(記録するときだけ)
+        bool busy = false;
+
+        // ボードでcompute()に掛かる時間の代わり(周期ごとに変える)
+        void work(const int salt)
+        {
+            if (busy)
+                delayMicroseconds(20 + (tick * 37 + salt * 11) % 61);
+        }
+
+        void setup(const double kp_scale)
+        {
+            Cubic::begin(false, CURRENT_LIMIT);
+            Velocity_PID &v = velocity.emplace<Velocity_PID>(0, 0, encoderType::inc, INC_CPR, 0.03 * kp_scale, 0.4, 0.0, 0.0, true, 0.9);
+            v.setVelocityEstimator(velocityEstimator::pll, 100.0);
+            Position_PID &p = position.emplace<Position_PID>(1, 1, encoderType::abs, AMT22_CPR, 1.0 * kp_scale, 0.5, 0.02, 0.0, true, 0.9);
+            home = p.getCurrent();
+            p.setTarget(home);
+        }
+
+        void loop(void)
+        {
+            Cubic::update(PERIOD);
+            if (tick == 100)
+            {
+                velocity->setTarget(20.0);
+                position->setTarget(home + 2.0);
+            }
+            else if (tick == 1500)
+            {
+                velocity->setTarget(-10.0);
+                position->setTarget(home);
+            }
+            work(0);
+            velocity->compute();
+            work(1);
+            position->compute();
+            tick++;
+        }
+    };
+
+    // 物理モデルで動かし，Serialに送った記録を返す
+    std::string record(const int ticks)
+    {
+        Cubic_host::reset();
+        Cubic_host::set_serial_sink(Cubic_host::Serial_sink::capture);
+        Cubic_host::Board_model board;
+        Cubic_host::Plant_model plant(board);
+        plant.add_motor(0, Cubic_host::Motor_params(), 0, -1);
+        plant.add_motor(1, Cubic_host::Motor_params(), -1, 1);
+
+        // begin()の中の受信から記録する
+        Recorder::enable();
+        Sketch sketch;
+        sketch.busy = true;
+        sketch.setup(1.0);
+        for (int i = 0; i < ticks; i++)
+            sketch.loop();
+        Recorder::flush();
+        Recorder::enable(false);
+        if (Recorder::dropped() > 0)
+            fprintf(stderr, "dropped %u records\n", (unsigned)Recorder::dropped());
+        return Cubic_host::serial_output();
+    }
+
+    struct Result
+    {
+        size_t played;
+        uint32_t mismatches;
+        long first_mismatch;
+        uint32_t gaps;
+        // 各周期のモータ0, 1の出力のFNV-1aハッシュ
+        uint64_t hash;
+        double ns_per_cycle;
+    };
+
+    Result replay(const std::vector<Record_cycle> &records, const double kp_scale)
+    {
+        Cubic_host::reset();
+        Cubic_host::set_serial_sink(Cubic_host::Serial_sink::discard);
+        Recorder::play(records.data(), records.size());
+
+        Result r;
+        r.hash = 1469598103934665603ULL;
+        const auto start = std::chrono::steady_clock::now();
+        Sketch sketch;
+        sketch.setup(kp_scale);
+        while (Recorder::playing())
+        {
+            sketch.loop();
+            for (int m = 0; m < 2; m++)
+            {
+                r.hash ^= (uint16_t)DC_motor::get(m);
+                r.hash *= 1099511628211ULL;
+            }
+        }
+        const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        r.played = Recorder::played();
+        r.mismatches = Recorder::mismatches();
+        r.first_mismatch = Recorder::first_mismatch();
+        r.gaps = Recorder::gaps();
+        r.ns_per_cycle = r.played > 0 ? wall * 1e9 / r.played : 0.0;
+        return r;
+    }
+
+    void report(const char *name, const Result &r)
+    {
+        printf("%-9s %zu cycles  mismatches %u (first %ld)  gaps %u  hash %016llx  cpu %.0f ns/cycle  x%.0f real time\n",
+               name, r.played, (unsigned)r.mismatches, r.first_mismatch, (unsigned)r.gaps, (unsigned long long)r.hash, r.ns_per_cycle,
+               r.ns_per_cycle > 0.0 ? PERIOD * 1000.0 / r.ns_per_cycle : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *record_path = nullptr;
+    const char *replay_path = nullptr;
+    int ticks = 3000;
+    double kp_scale = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--record=", 9) == 0)
+            record_path = argv[i] + 9;
+        else if (strncmp(argv[i], "--ticks=", 8) == 0)
+            ticks = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--kp-scale=", 11) == 0)
+            kp_scale = atof(argv[i] + 11);
+        else
+            replay_path = argv[i];
+    }
+    if (ticks <= 0)
+        ticks = 1;
+
+    if (record_path != nullptr)
+    {
+        const std::string log = record(ticks);
+        FILE *out = fopen(record_path, "wb");
+        if (out == nullptr || fwrite(log.data(), 1, log.size(), out) != log.size())
+        {
+            perror(record_path);
+            return 1;
+        }
+        fclose(out);
+        printf("recorded  %d ticks, %zu bytes\n", ticks, log.size());
+        return 0;
+    }
+
+    std::vector<Record_cycle> records;
+    Cubic_host::Record_stats stats;
+    if (replay_path != nullptr)
+    {
+        if (!Cubic_host::load_records(replay_path, records, &stats))
+        {
+            perror(replay_path);
+            return 1;
+        }
+    }
+    else
+    {
+        const std::string log = record(ticks);
+        stats = Cubic_host::parse_records((const uint8_t *)log.data(), log.size(), records);
+    }
+    printf("records   %zu  other frames %zu  bad frames %zu\n", stats.records, stats.other, stats.bad);
+
+    const Result first = replay(records, kp_scale);
+    report("replay", first);
+    if (replay_path != nullptr)
+        return first.mismatches == 0 ? 0 : 1;
+
+    const Result second = replay(records, kp_scale);
+    report("replay", second);
+    // 2回の結果が同じなら，記録と違っても流し直しは再現できている
+    const bool reproducible = first.hash == second.hash && first.mismatches == second.mismatches;
+    printf("%s\n", reproducible ? "bit-reproducible" : "NOT REPRODUCIBLE");
+    return reproducible && first.mismatches == 0 ? 0 : 1;
+}
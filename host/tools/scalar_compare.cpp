@@ -0,0 +1,204 @@
+/**
+ * @file scalar_compare.cpp
+ * @brief 数値型(float, Q16_16, Q32_32)ごとの制御器の出力を，doubleの出力(ゴールデンベクタ)と比べます。
+ * @details doubleの制御器でモータの模型を閉ループで動かし，各ステップの入力(エンコーダの値)と出力を記録します。
+ * 同じ入力を各数値型の制御器に開ループで与え，出力のduty比の差の最大値が許容値以下かを確かめます。
+ *
+ * 使い方: cubic_scalar_compare [ステップ数]
+ * 許容値を超えた数値型があれば終了コード1を返します。
+ */
+
+#include "cubic_arduino.h"
+#include "Cubic.controller.h"
+#include "cubic_host.h"
+#include "cubic_slave.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Cubic_controller;
+
+namespace
+{
+    constexpr uint16_t CPR = 2048 * 4;
+    constexpr unsigned int PERIOD_US = 4000;
+
+    // 1ステップの入力
+    struct Step
+    {
+        unsigned int period;  // このステップの前の経過時間[us]
+        int16_t inc_diff;     // インクリメンタルエンコーダの差分
+        uint16_t abs_value;   // アブソリュートエンコーダの値
+        double velTarget;     // 速度制御の目標値[rad/s]
+        double posTarget;     // 位置制御の目標値[rad]
+    };
+
+    // 各ステップの出力(duty比)
+    struct Output
+    {
+        std::vector<double> velocity;
+        std::vector<double> position;
+        std::vector<double> group;
+    };
+
+    Cubic_host::Board_model *board;
+
+    // 目標値を切り替え，周期に少し揺らぎのある入力列を作る
+    std::vector<Step> make_targets(const int steps)
+    {
+        std::vector<Step> in(steps);
+        uint32_t seed = 1;
+        for (int i = 0; i < steps; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            in[i].period = PERIOD_US - 50 + (seed >> 16) % 101;
+            in[i].velTarget = (i / 500) % 2 == 0 ? 20.0 : -8.0;
+            in[i].posTarget = (i / 700) % 3 == 0 ? degToRad(90.0) : (i / 700) % 3 == 1 ? degToRad(-120.0) : degToRad(10.0);
+        }
+        return in;
+    }
+
+    // 1次遅れのモータの模型で，duty比から角速度と角度を進める
+    struct Plant
+    {
+        double velocity = 0.0;
+        double angle = 0.0;
+        double counts = 0.0;
+
+        int16_t step(const double duty, const double dt)
+        {
+            const double tau = 0.05, gain = 60.0;
+            velocity += (gain * duty - velocity) * dt / tau;
+            angle += velocity * dt;
+            const double prev = counts;
+            counts += velocity * dt * CPR / TWO_PI;
+            return (int16_t)(lround(counts) - lround(prev));
+        }
+        uint16_t abs_value() const
+        {
+            const double turns = angle / TWO_PI;
+            return (uint16_t)lround((turns - floor(turns)) * AMT22_CPR) % AMT22_CPR;
+        }
+    };
+
+    void apply_inputs(const Step &s)
+    {
+        Cubic_host::advance_ns((uint64_t)s.period * 1000);
+        board->inc.add_count(0, s.inc_diff);
+        board->inc.add_count(1, s.inc_diff);
+        board->abs.set_value(0, s.abs_value);
+        board->abs.set_value(1, s.abs_value);
+        Cubic::update(0);
+    }
+
+    // doubleで閉ループを回して入力列と出力(ゴールデンベクタ)を作る
+    Output make_golden(std::vector<Step> &in)
+    {
+        Plant velPlant, posPlant;
+        in[0].abs_value = posPlant.abs_value();
+        in[0].inc_diff = 0;
+        apply_inputs(in[0]);
+
+        Velocity_PID vel(0, 0, encoderType::inc, CPR, 0.02, 0.05, 0.0005, in[0].velTarget, true, 0.9, 0.5);
+        Position_PID pos(1, 0, encoderType::abs, AMT22_CPR, 0.6, 0.3, 0.02, in[0].posTarget, true, 0.9);
+        ControllerGroup group;
+        group.addVelocity(2, 1, CPR, 0.02, 0.05, 0.0005, in[0].velTarget, true, 0.9, 0.5);
+        group.addPosition(3, 1, AMT22_CPR, 0.6, 0.3, 0.02, in[0].posTarget, true, 0.9);
+
+        Output out;
+        double velDuty = 0.0, posDuty = 0.0;
+        for (size_t i = 1; i < in.size(); i++)
+        {
+            const double dt = in[i].period * 1e-6;
+            in[i].inc_diff = velPlant.step(velDuty, dt);
+            posPlant.step(posDuty, dt);
+            in[i].abs_value = posPlant.abs_value();
+            apply_inputs(in[i]);
+
+            vel.setTarget(in[i].velTarget);
+            pos.setTarget(in[i].posTarget);
+            group.setTarget(0, in[i].velTarget);
+            group.setTarget(1, in[i].posTarget);
+            velDuty = vel.compute();
+            posDuty = pos.compute();
+            group.compute();
+            out.velocity.push_back(velDuty);
+            out.position.push_back(posDuty);
+            out.group.push_back(group.getDutyCycle(0) + group.getDutyCycle(1));
+        }
+        return out;
+    }
+
+    // 数値型Tの制御器に同じ入力を与える
+    template <class T>
+    Output replay(const std::vector<Step> &in)
+    {
+        apply_inputs(in[0]);
+        Basic_Velocity_PID<T> vel(0, 0, encoderType::inc, CPR, T(0.02), T(0.05), T(0.0005), T(in[0].velTarget), true, T(0.9), T(0.5));
+        Basic_Position_PID<T> pos(1, 0, encoderType::abs, AMT22_CPR, T(0.6), T(0.3), T(0.02), T(in[0].posTarget), true, T(0.9));
+        Basic_ControllerGroup<T> group;
+        group.addVelocity(2, 1, CPR, T(0.02), T(0.05), T(0.0005), T(in[0].velTarget), true, T(0.9), T(0.5));
+        group.addPosition(3, 1, AMT22_CPR, T(0.6), T(0.3), T(0.02), T(in[0].posTarget), true, T(0.9));
+
+        Output out;
+        for (size_t i = 1; i < in.size(); i++)
+        {
+            apply_inputs(in[i]);
+            vel.setTarget(T(in[i].velTarget));
+            pos.setTarget(T(in[i].posTarget));
+            group.setTarget(0, T(in[i].velTarget));
+            group.setTarget(1, T(in[i].posTarget));
+            out.velocity.push_back((double)vel.compute());
+            out.position.push_back((double)pos.compute());
+            group.compute();
+            out.group.push_back((double)group.getDutyCycle(0) + (double)group.getDutyCycle(1));
+        }
+        return out;
+    }
+
+    double max_diff(const std::vector<double> &a, const std::vector<double> &b)
+    {
+        double m = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            const double d = fabs(a[i] - b[i]);
+            m = isnan(d) ? INFINITY : fmax(m, d);
+        }
+        return m;
+    }
+
+    // 許容値を超えていなければtrue
+    bool report(const char *name, const Output &golden, const Output &out, const double bound)
+    {
+        const double v = max_diff(golden.velocity, out.velocity);
+        const double p = max_diff(golden.position, out.position);
+        const double g = max_diff(golden.group, out.group);
+        const bool ok = v <= bound && p <= bound && g <= bound;
+        printf("%-8s velocity %.3e  position %.3e  group %.3e  (bound %.0e) %s\n", name, v, p, g, bound, ok ? "ok" : "FAIL");
+        return ok;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int steps = argc > 1 ? atoi(argv[1]) : 5000;
+
+    Cubic_host::set_serial_sink(Cubic_host::Serial_sink::discard);
+    Cubic_host::Board_model model;
+    board = &model;
+    Cubic::begin(true);
+
+    std::vector<Step> in = make_targets(steps);
+    const Output golden = make_golden(in);
+
+    bool ok = true;
+    ok &= report("double", golden, replay<double>(in), 0.0);
+    ok &= report("float", golden, replay<float>(in), 1e-3);
+    ok &= report("Q16_16", golden, replay<Q16_16>(in), 5e-2);
+#ifdef CUBIC_HAS_Q32_32
+    ok &= report("Q32_32", golden, replay<Q32_32>(in), 1e-6);
+#endif
+    return ok ? 0 : 1;
+}
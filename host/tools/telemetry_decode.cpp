@@ -0,0 +1,73 @@
+/**
+ * @file telemetry_decode.cpp
+ * @brief cubic_telemetry.hのバイナリのストリームをCSVに変換します。
+ * @details 0x00で区切られたフレームをCOBSで復号し，CRCが合わないフレームは読み飛ばします。
+ * 記録(cubic_record.h)のフレームは読み飛ばします。
+ * フレームの途中から記録を始めた場合でも，次の0x00から同期します。
+ *
+ * 使い方: cubic_telemetry_decode [入力ファイル]  (省略すると標準入力から読む)
+ *   例: stty -F /dev/ttyACM0 115200 raw && cat /dev/ttyACM0 | cubic_telemetry_decode > log.csv
+ */
+
+#include "cubic_arduino.h"
+#include "cubic_telemetry.h"
+
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    if (argc > 1)
+    {
+        in = fopen(argv[1], "rb");
+        if (in == nullptr)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    printf("timestamp,motorNo,flags,encoder,current,target,diff,integral,duty,dt\n");
+
+    unsigned long good = 0, bad = 0, other = 0;
+    std::vector<uint8_t> frame;
+    uint8_t payload[TELEMETRY_MAX_FRAME_BYTES];
+    int c;
+    while ((c = fgetc(in)) != EOF)
+    {
+        if (c != 0)
+        {
+            // 長すぎるフレームは区切りを見失ったものとして，次の0x00まで読み捨てる
+            if (frame.size() <= TELEMETRY_MAX_FRAME_BYTES)
+                frame.push_back((uint8_t)c);
+            continue;
+        }
+        if (frame.empty())
+            continue;
+
+        const size_t len = frame.size() <= TELEMETRY_MAX_FRAME_BYTES ? Telemetry::cobs_decode(frame.data(), frame.size(), payload) : 0;
+        frame.clear();
+        if (len < 3 || CubicFrame::crc16(payload, len - 2) != (uint16_t)(payload[len - 2] << 8 | payload[len - 1]))
+        {
+            bad++;
+            continue;
+        }
+        if (payload[0] != TelemetryType::CONTROLLER || len != TELEMETRY_PAYLOAD_BYTES)
+        {
+            other++;
+            continue;
+        }
+
+        Telemetry_record r;
+        memcpy(&r, &payload[1], sizeof(r));
+        printf("%u,%u,%u,%d,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", (unsigned)r.timestamp, r.motorNo, r.flags, (int)r.encoder, r.current, r.target, r.diff, r.integral, r.duty, r.dt);
+        good++;
+    }
+    fprintf(stderr, "records: %lu, bad frames: %lu, other frames: %lu\n", good, bad, other);
+
+    if (in != stdin)
+        fclose(in);
+    return 0;
+}